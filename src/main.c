@@ -26,11 +26,13 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <string.h>
 #include <stdlib.h>
 #include <getopt.h>
 #include <limits.h>
+#include <time.h>
 
 #ifndef O_BINARY
 #define O_BINARY 0
@@ -38,62 +40,673 @@
 
 
 #include "sceadan.h"
+#include "sceadan_input.h"
+#include "sceadan_export.h"
+#include "sceadan_cache.h"
+#include "sceadan_dedup.h"
+#include "reader.h"
+#include "writer.h"
+#include "threadpool.h"
 
 /* Globals for the stand-alone program */
 
 size_t block_factor = 0;
 int    opt_train = 0;
+int    opt_jobs = 0;                    /* classifier threads; 0 classifies on the main thread */
+int    opt_sorted = 0;                  /* with -j, print results ordered by path */
+size_t opt_window = 0;                  /* --window: classify sliding windows of this many bytes */
+size_t opt_step = 0;                    /* --step: distance between windows; defaults to the window */
+size_t opt_levels[SCEADAN_MULTIRES_MAX_LEVELS]; /* --levels: block sizes to classify in one pass */
+int    opt_nlevels = 0;
+int    opt_depth = 0;                   /* --queue-depth: reads in flight for image mode */
+int    opt_direct = 0;                  /* --direct: open images with O_DIRECT */
+double opt_margin = 0;                  /* --margin: container mode stops reading once this sure */
+const char *opt_model = 0;              /* -m: model file (text or binary) instead of the precompiled one */
+int    opt_stats = 0;                   /* -s: print per-stage statistics on stderr at the end */
+int    opt_format = SCEADAN_DUMP_JSON;  /* --format: how -t writes the vectors */
+const char *opt_csr = 0;                /* --csr: -t writes CSR shards with this prefix instead */
+uint64_t opt_shard_rows = 0;            /* --shard-rows: rows per CSR shard; 0 for the default */
+const char *opt_cache = 0;              /* --cache: file of results to reuse for unchanged files */
+int    opt_cache_strict = 0;            /* --cache-strict: also compare the files' contents */
+size_t opt_dedup = 0;                   /* --dedup: label repeated blocks from an LRU of this many */
+int    opt_output = WRITER_TEXT;        /* --output: how block mode writes its results */
+bool   opt_extents = false;             /* --extents: block mode merges runs of one type */
 
-static void do_output(const char *path,uint64_t offset,int file_type )
+static sceadan_csr_writer *csr;         /* --csr: shared by every classifier */
+static int quiet;                       /* --format libsvm, --csr: only the vectors, no result lines */
+static sceadan_cache *cache;            /* --cache: shared by every classifier */
+static sceadan_dedup *dedup;            /* --dedup: shared by every classifier */
+
+static struct sceadan_stats stats;      /* -s: every classifier's, added up as they are freed */
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void do_output(FILE *out,const char *path,uint64_t offset,int file_type )
+{
+    if(quiet) return;
+    fprintf(out,"%-10" PRId64 " %s # %s\n", offset,sceadan_name_for_type(file_type),path);
+}
+
+
+/* Per-thread classifier state, reused from file to file */
+struct classifier {
+    sceadan     *s;
+    sceadan_ctx *ctx;                   /* for block, window and multi-resolution mode */
+    uint64_t     io_ns;                 /* -s: time spent reading for the ctx */
+    uint64_t     fingerprint;           /* --cache: of the model and the options */
+    const uint8_t **bufs;               /* --queue-depth: a buffer's blocks, for the batch */
+    size_t      *lens;
+    size_t       nbufs;                 /* room in bufs and lens */
+};
+
+static void classifier_init(struct classifier *c)
+{
+    c->s = sceadan_open(opt_model);
+    if(c->s==0){ fprintf(stderr,"cannot open model %s\n",opt_model ? opt_model : "(default)"); exit(1); }
+    struct sceadan_stats st;
+    if(opt_stats && sceadan_get_stats(c->s,&st)){
+        fprintf(stderr,"-s: this build does not collect statistics (configure --enable-stats)\n");
+        exit(1);
+    }
+    c->ctx = 0;
+    c->io_ns = 0;
+    c->bufs  = 0;
+    c->lens  = 0;
+    c->nbufs = 0;
+    if(cache){                          /* the options that change the lines, seeded with the model */
+        const uint64_t sizes[5] = {block_factor,opt_window,opt_step,(uint64_t)opt_nlevels,opt_extents};
+        c->fingerprint = sceadan_hash64(sizes,sizeof(sizes),sceadan_fingerprint(c->s));
+        c->fingerprint = sceadan_hash64(opt_levels,opt_nlevels*sizeof(size_t),c->fingerprint);
+        c->fingerprint = sceadan_hash64(&opt_margin,sizeof(opt_margin),c->fingerprint);
+    }
+    if(block_factor || opt_window || opt_nlevels){
+        c->ctx = sceadan_ctx_create(c->s);
+        if(c->ctx==0){ perror("malloc"); exit(1); }
+        if(dedup) sceadan_ctx_set_dedup(c->ctx,dedup);
+    }
+}
+
+static void classifier_free(struct classifier *c)
+{
+    if(c->ctx) sceadan_ctx_destroy(c->ctx);
+    free(c->bufs);
+    free(c->lens);
+    if(opt_stats){                      /* called on the main thread, once the workers are done */
+        struct sceadan_stats st;
+        sceadan_get_stats(c->s,&st);
+        st.ns[SCEADAN_STAGE_IO] += c->io_ns;
+        sceadan_stats_add(&stats,&st);
+    }
+    sceadan_close(c->s);
+}
+
+static void print_stats(FILE *out,const struct sceadan_stats *st)
+{
+    static const char *names[SCEADAN_NSTAGES] = {"io","update","finalize","predict"};
+    double total = 0;
+    for(int i=0;i<SCEADAN_NSTAGES;i++) total += st->ns[i]/1e9;
+    fprintf(out,"# bytes: %" PRIu64 "  blocks: %" PRIu64 "\n",st->bytes,st->blocks);
+    fprintf(out,"# early exits: random %" PRIu64 "  ucv_const %" PRIu64 "  bcv_const %" PRIu64 "\n",
+            st->rand_exits,st->ucv_const_exits,st->bcv_const_exits);
+    if(st->dedup_blocks){
+        const uint64_t hits = st->dedup_fill+st->dedup_hits;
+        fprintf(out,"# dedup: %" PRIu64 " of %" PRIu64 " blocks (%.1f%%) from memory: one byte repeated %" PRIu64 "  seen before %" PRIu64 "\n",
+                hits,st->dedup_blocks,100.0*hits/st->dedup_blocks,st->dedup_fill,st->dedup_hits);
+    }
+    fprintf(out,"# %-9s %10s %6s %10s",  "stage","seconds","%","MB/s");
+    if(st->perf) fprintf(out," %12s %6s %14s","Mcycles","IPC","cache misses");
+    fputc('\n',out);
+    for(int i=0;i<SCEADAN_NSTAGES;i++){
+        const double sec = st->ns[i]/1e9;
+        fprintf(out,"# %-9s %10.3f %6.1f %10.1f",names[i],sec,total>0 ? 100*sec/total : 0,
+                sec>0 ? st->bytes/sec/1e6 : 0);
+        if(st->perf){
+            fprintf(out," %12.1f %6.2f %14" PRIu64,st->cycles[i]/1e6,
+                    st->cycles[i] ? (double)st->instructions[i]/st->cycles[i] : 0,st->cache_misses[i]);
+        }
+        fputc('\n',out);
+    }
+}
+
+/* one file being classified; passed to the input and result callbacks */
+struct file_output {
+    struct classifier *c;
+    FILE       *out;
+    const char *path;
+    uint64_t    offset;                 /* block mode: offset of the next block */
+    uint64_t    piece_done;             /* -s: when the last piece was finished */
+    writer     *w;                      /* block mode: the results, unless quiet */
+};
+
+/* -s: the time between one piece and the next is spent reading */
+static void piece_begin(struct file_output *fo)
 {
-    printf("%-10" PRId64 " %s # %s\n", offset,sceadan_name_for_type(file_type),path);
+    if(opt_stats) fo->c->io_ns += now_ns() - fo->piece_done;
 }
 
+static void piece_end(struct file_output *fo)
+{
+    if(opt_stats) fo->piece_done = now_ns();
+}
 
+static int block_piece(void *arg,const uint8_t *buf,size_t len)
+{
+    struct file_output *fo = (struct file_output *)arg;
+    piece_begin(fo);
+    const int file_type = sceadan_ctx_classify(fo->c->ctx,buf,len);
+    if(fo->w){
+        writer_block(fo->w,fo->offset,len,file_type);
+        if(opt_train && writer_flush(fo->w)){ perror("write"); exit(1); } /* between the block's vectors and the next's */
+    }
+    fo->offset += len;
+    piece_end(fo);
+    return 0;
+}
+
+static void window_output(void *arg,uint64_t offset,int file_type)
+{
+    const struct file_output *fo = (const struct file_output *)arg;
+    do_output(fo->out,fo->path,offset,file_type);
+}
+
+static int window_piece(void *arg,const uint8_t *buf,size_t len)
+{
+    struct file_output *fo = (struct file_output *)arg;
+    piece_begin(fo);
+    sceadan_window_update(fo->c->ctx,buf,len,window_output,fo);
+    piece_end(fo);
+    return 0;
+}
+
+static void multires_output(void *arg,size_t block_size,uint64_t offset,int file_type)
+{
+    const struct file_output *fo = (const struct file_output *)arg;
+    if(quiet) return;
+    fprintf(fo->out,"%-10" PRId64 " %-8zu %s # %s\n", offset,block_size,sceadan_name_for_type(file_type),fo->path);
+}
+
+static int multires_piece(void *arg,const uint8_t *buf,size_t len)
+{
+    struct file_output *fo = (struct file_output *)arg;
+    piece_begin(fo);
+    sceadan_multires_update(fo->c->ctx,buf,len,multires_output,fo);
+    piece_end(fo);
+    return 0;
+}
+
+/* -t: c dumps the vectors to out, or to the CSR shards */
+static void dump_vectors_to(struct classifier *c,FILE *out)
+{
+    if(csr){
+        sceadan_dump_vectors_to_csr(c->s,opt_train,csr);
+        return;
+    }
+    sceadan_dump_vectors_on_classify(c->s,opt_train,out);
+    sceadan_dump_vectors_format(c->s,opt_format);
+}
+
+/* classify one file, writing the results to out */
+static void classify_path(struct classifier *c,const char *path,FILE *out)
+{
+    if(opt_train) dump_vectors_to(c,out);
+        
+    /* Test the single-file classifier */
+    if(block_factor==0 && opt_window==0 && opt_nlevels==0){
+        if(opt_margin>0){               /* progressive: report how much was read */
+            uint64_t bytes_read = 0;
+            const int file_type = sceadan_classify_file_progressive(c->s,path,opt_margin,&bytes_read);
+            if(!quiet) fprintf(out,"%-10d %-10" PRIu64 " %s # %s\n",0,bytes_read,sceadan_name_for_type(file_type),path);
+            return;
+        }
+        do_output(out,path,0,sceadan_classify_file(c->s,path));
+        return;
+    }
+        
+    struct file_output fo = {c,out,path,0,0};
+    piece_end(&fo);
+    const int fd = open(path, O_RDONLY|O_BINARY);
+    if (fd<0){perror("open");exit(0);}
+
+    if(opt_window){                     /* sliding windows */
+        if(sceadan_window_begin(c->ctx,opt_window,opt_step)){
+            fprintf(stderr,"cannot start a %zu byte window\n",opt_window);
+            exit(1);
+        }
+        if(sceadan_input_each(fd,0,window_piece,&fo)){ perror("read"); exit(0);}
+        piece_begin(&fo);
+        sceadan_window_finish(c->ctx,window_output,&fo);
+    } else if(opt_nlevels){             /* several block sizes from one read */
+        if(sceadan_multires_begin(c->ctx,opt_levels,opt_nlevels)){
+            fprintf(stderr,"cannot start multi-resolution classification\n");
+            exit(1);
+        }
+        if(sceadan_input_each(fd,0,multires_piece,&fo)){ perror("read"); exit(0);}
+        piece_begin(&fo);
+        sceadan_multires_finish(c->ctx,multires_output,&fo);
+    } else {                            /* one block at a time */
+        if(!quiet){
+            fo.w = writer_open(out,opt_output,opt_extents);
+            if(fo.w==0){ perror("malloc"); exit(1); }
+            writer_file(fo.w,path);
+        }
+        if(sceadan_input_each(fd,block_factor,block_piece,&fo)){ perror("read"); exit(0);}
+        piece_begin(&fo);
+        if(fo.w && writer_close(fo.w)){ perror("write"); exit(1); }
+    }
+    close(fd);
+}
+
+/*
+ * --cache: an unchanged file's lines come from the cache, without
+ * opening it. Lines are cached without the path at their end, which a
+ * rename or another hard link changes; a file whose lines do not all
+ * end in its path is not cached.
+ */
+static void classify_cached(struct classifier *c,const char *path,FILE *out)
+{
+    struct sceadan_cache_key key;
+    if(cache==0 || sceadan_cache_key(cache,path,c->fingerprint,&key)){
+        classify_path(c,path,out);
+        return;
+    }
+    char  *text;
+    size_t len;
+    if(sceadan_cache_get(cache,&key,&text,&len)){
+        for(const char *line=text;line<text+len;){
+            const char *nl = (const char *)memchr(line,'\n',text+len-line);
+            fwrite(line,1,nl-line,out);
+            fprintf(out,"%s\n",path);
+            line = nl+1;
+        }
+        free(text);
+        return;
+    }
+    FILE *mem = open_memstream(&text,&len);
+    if(mem==0){ perror("open_memstream"); exit(1); }
+    classify_path(c,path,mem);
+    fclose(mem);
+    fwrite(text,1,len,out);
+
+    const size_t plen = strlen(path);
+    size_t kept = 0;
+    for(size_t i=0;i<len;){
+        const char *nl = (const char *)memchr(text+i,'\n',len-i);
+        const size_t n = nl ? (size_t)(nl-(text+i)) : 0;
+        if(nl==0 || n<plen || memcmp(nl-plen,path,plen)){
+            free(text);
+            return;
+        }
+        memmove(text+kept,text+i,n-plen);
+        kept += n-plen;
+        text[kept++] = '\n';
+        i += n+1;
+    }
+    if(sceadan_cache_put(cache,&key,text,kept)){ perror(opt_cache); exit(1); }
+    free(text);
+}
+
+
+/* Single-threaded: classify each file as ftw() finds it */
+static struct classifier serial;
 
 static int process_file(const char path[],
                         const struct stat *const sb,
                         const int typeflag )
 {
     if(typeflag==FTW_F){
-        sceadan *s = sceadan_open(0);
-        
-        if(opt_train){
-            sceadan_dump_vectors_on_classify(s,opt_train,stdout);
-        }
-        
-        /* Test the single-file classifier */
-        if(block_factor==0){
-            do_output(path,0,sceadan_classify_file(s,path));
-            sceadan_close(s);
-            return 0;
+        classify_cached(&serial,path,stdout);
+    }
+    return 0;
+}
+
+
+/*
+ * Multi-threaded (-j): the main thread walks the tree and feeds the
+ * paths to a work-stealing pool of classifiers. Each file's results
+ * are buffered and written in one piece, so lines from different
+ * files never interleave. Without --sorted they are streamed as files
+ * finish. With --sorted the paths are collected and sorted first, then
+ * submitted in order; each file is printed as soon as the files before
+ * it have been, and the submitter stays at most SORTED_WINDOW files
+ * ahead of the printing so a slow file cannot leave a backlog of
+ * results in memory.
+ */
+struct job {
+    char   *path;
+    char   *out;                        /* this file's output lines */
+    size_t  outlen;
+    bool    done;
+};
+
+#define SORTED_WINDOW (64*opt_jobs)
+
+static threadpool     *pool = 0;
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  output_cond = PTHREAD_COND_INITIALIZER;  /* --sorted: printed advanced */
+static char          **paths = 0;       /* --sorted: every path, then sorted */
+static size_t          npaths = 0;
+static size_t          paths_cap = 0;
+static struct job    **ordered = 0;     /* --sorted: submitted jobs in path order */
+static size_t          printed = 0;     /* --sorted: jobs before this one are printed */
+
+static void job_free(struct job *j)
+{
+    free(j->path);
+    free(j->out);
+    free(j);
+}
+
+static void classify_job(void *worker_arg,void *item)
+{
+    struct classifier *c = (struct classifier *)worker_arg;
+    struct job *j = (struct job *)item;
+    FILE *out = open_memstream(&j->out,&j->outlen);
+    if(out==0){ perror("open_memstream"); exit(1); }
+    classify_cached(c,j->path,out);
+    fclose(out);
+
+    pthread_mutex_lock(&output_lock);
+    if(opt_sorted){
+        j->done = true;
+        while(printed<npaths && ordered[printed] && ordered[printed]->done){
+            fwrite(ordered[printed]->out,1,ordered[printed]->outlen,stdout);
+            job_free(ordered[printed]);
+            ordered[printed++] = 0;
         }
-        
-        /* Test the incremental classifier */
-        const int fd = open(path, O_RDONLY|O_BINARY);
-        if (fd<0){perror("open");exit(0);}
-        uint8_t   *buf = malloc(block_factor);
-        if(buf==0){ perror("malloc"); exit(1); }
-        
-        /* Read the file one block at a time */
-        uint64_t offset = 0;
-        while(true){
-            const ssize_t rd = read (fd, buf, block_factor);
-            if(rd==-1){ perror("read"); exit(0);}
-            if(rd==0) break;
-            do_output(path,offset,sceadan_classify_buf(s,buf,rd));
-            offset += rd;
+        pthread_cond_signal(&output_cond);
+    } else {
+        fwrite(j->out,1,j->outlen,stdout);
+        job_free(j);
+    }
+    pthread_mutex_unlock(&output_lock);
+}
+
+static struct job *job_new(const char *path)
+{
+    struct job *j = (struct job *)calloc(1,sizeof(*j));
+    if(j==0 || (j->path = strdup(path))==0){ perror("malloc"); exit(1); }
+    return j;
+}
+
+static int submit_file(const char path[],
+                       const struct stat *const sb,
+                       const int typeflag )
+{
+    if(typeflag==FTW_F){
+        threadpool_submit(pool,job_new(path));
+    }
+    return 0;
+}
+
+/* --sorted: only the paths while walking; they are submitted once sorted */
+static int collect_file(const char path[],
+                        const struct stat *const sb,
+                        const int typeflag )
+{
+    if(typeflag==FTW_F){
+        if(npaths==paths_cap){
+            paths_cap = paths_cap ? paths_cap*2 : 1024;
+            paths = (char **)realloc(paths,paths_cap*sizeof(*paths));
+            if(paths==0){ perror("realloc"); exit(1); }
         }
-        free(buf);
-        sceadan_close(s);
+        paths[npaths] = strdup(path);
+        if(paths[npaths++]==0){ perror("malloc"); exit(1); }
     }
     return 0;
 }
 
+static int path_cmp(const void *a,const void *b)
+{
+    return strcmp(*(char *const *)a,*(char *const *)b);
+}
+
+static void submit_sorted(void)
+{
+    qsort(paths,npaths,sizeof(*paths),path_cmp);
+    ordered = (struct job **)calloc(npaths ? npaths : 1,sizeof(*ordered));
+    if(ordered==0){ perror("calloc"); exit(1); }
+    for(size_t i=0;i<npaths;i++){
+        struct job *j = job_new(paths[i]);
+        free(paths[i]);
+        pthread_mutex_lock(&output_lock);
+        while(i-printed>=(size_t)SORTED_WINDOW){
+            pthread_cond_wait(&output_cond,&output_lock);
+        }
+        ordered[i] = j;
+        pthread_mutex_unlock(&output_lock);
+        threadpool_submit(pool,j);
+    }
+}
+
 #define FTW_MAXOPENFD 8
+static void process_dir_parallel(const char path[])
+{
+    struct classifier *classifiers = (struct classifier *)calloc(opt_jobs,sizeof(struct classifier));
+    void **args = (void **)calloc(opt_jobs,sizeof(void *));
+    if(classifiers==0 || args==0){ perror("calloc"); exit(1); }
+    for(int i=0;i<opt_jobs;i++){
+        classifier_init(&classifiers[i]);
+        args[i] = &classifiers[i];
+    }
+    pool = threadpool_create(opt_jobs,classify_job,args);
+    if(opt_sorted){
+        ftw (path, &collect_file, FTW_MAXOPENFD);
+        submit_sorted();
+    } else {
+        ftw (path, &submit_file, FTW_MAXOPENFD);
+    }
+    threadpool_wait(pool);
+    pool = 0;
+
+    if(opt_sorted){
+        free(paths);
+        free(ordered);
+        paths   = 0;
+        ordered = 0;
+        npaths  = paths_cap = printed = 0;
+    }
+    for(int i=0;i<opt_jobs;i++) classifier_free(&classifiers[i]);
+    free(classifiers);
+    free(args);
+}
+
+/*
+ * Image mode (--queue-depth): for raw images and block devices. The
+ * reader keeps opt_depth large reads in flight while a pool of
+ * classifiers works through the buffers that have arrived. Each
+ * buffer's labels are handed to the writer in offset order once all the
+ * buffers before it are done, so extents run across buffers. A buffer
+ * goes back to the reader only once its labels are written, so a slow
+ * buffer holds the reader back instead of letting results pile up: at
+ * most opt_depth are waiting at a time, in a ring indexed by sequence
+ * number.
+ */
+struct chunk_result {
+    char    *out;                       /* -t: the vectors */
+    size_t   outlen;
+    int     *labels;                    /* one per block; kept for the next buffer in this slot */
+    size_t   nlabels;                   /* room in labels */
+    struct reader_buf *buf;
+    bool     done;
+};
+
+static struct {
+    const char          *path;
+    reader              *r;
+    writer              *w;             /* unless quiet */
+    pthread_mutex_t      lock;
+    pthread_cond_t       cond;
+    struct chunk_result *results;       /* by buffer sequence number, modulo nresults */
+    size_t               nresults;      /* opt_depth */
+    size_t               printed;       /* results before this have been written */
+    size_t               submitted;
+    size_t               finished;
+} image = {0,0,0,PTHREAD_MUTEX_INITIALIZER,PTHREAD_COND_INITIALIZER,0,0,0,0,0};
+
+/* write the results that are ready, in order, and give their buffers
+ * back to the reader; call with image.lock held */
+static void image_flush(void)
+{
+    while(image.results[image.printed % image.nresults].done){
+        struct chunk_result *cr = &image.results[image.printed++ % image.nresults];
+        const struct reader_buf *b = cr->buf;
+        if(cr->out){                    /* -t: the vectors, then the labels */
+            if(image.w && writer_flush(image.w)){ perror("write"); exit(1); }
+            fwrite(cr->out,1,cr->outlen,stdout);
+            free(cr->out);
+            cr->out = 0;
+        }
+        for(size_t i=0;image.w && i*block_factor<b->len;i++){
+            const size_t n = (b->len-i*block_factor < block_factor) ? b->len-i*block_factor : block_factor;
+            writer_block(image.w,b->offset+i*block_factor,n,cr->labels[i]);
+        }
+        cr->done = false;
+        reader_release(image.r,cr->buf);
+    }
+}
+
+static void classify_chunk(void *worker_arg,void *item)
+{
+    struct classifier *c = (struct classifier *)worker_arg;
+    struct reader_buf *b = (struct reader_buf *)item;
+    char  *out = 0;
+    size_t outlen = 0;
+    FILE *f = 0;
+    if(opt_train){
+        f = open_memstream(&out,&outlen);
+        if(f==0){ perror("open_memstream"); exit(1); }
+        dump_vectors_to(c,f);
+    }
+
+    /* the buffer's blocks are scored as a batch. Its slot is this
+     * worker's until the labels are written, so it needs no lock yet. */
+    struct chunk_result *cr = &image.results[b->seq % image.nresults];
+    const size_t nblocks = (b->len+block_factor-1)/block_factor;
+    if(nblocks>c->nbufs){
+        c->bufs = (const uint8_t **)realloc(c->bufs,nblocks*sizeof(*c->bufs));
+        c->lens = (size_t *)realloc(c->lens,nblocks*sizeof(*c->lens));
+        if(c->bufs==0 || c->lens==0){ perror("realloc"); exit(1); }
+        c->nbufs = nblocks;
+    }
+    if(nblocks>cr->nlabels){
+        cr->labels = (int *)realloc(cr->labels,nblocks*sizeof(*cr->labels));
+        if(cr->labels==0){ perror("realloc"); exit(1); }
+        cr->nlabels = nblocks;
+    }
+    for(size_t i=0;i<nblocks;i++){
+        c->bufs[i] = b->data+i*block_factor;
+        c->lens[i] = (b->len-i*block_factor < block_factor) ? b->len-i*block_factor : block_factor;
+    }
+    if(sceadan_ctx_classify_batch(c->ctx,c->bufs,c->lens,nblocks,cr->labels)){ perror("sceadan_ctx_classify_batch"); exit(1); }
+    if(f) fclose(f);
+
+    pthread_mutex_lock(&image.lock);
+    cr->out    = out;
+    cr->outlen = outlen;
+    cr->buf    = b;
+    cr->done   = true;
+    image.finished++;
+    image_flush();
+    pthread_cond_broadcast(&image.cond);
+    pthread_mutex_unlock(&image.lock);
+}
+
+static int process_image_file(const char path[],
+                              const struct stat *const sb,
+                              const int typeflag )
+{
+    if(typeflag!=FTW_F) return 0;
+    int fd = -1;
+#ifdef O_DIRECT
+    if(opt_direct) fd = open(path, O_RDONLY|O_BINARY|O_DIRECT);
+#endif
+    if(fd<0) fd = open(path, O_RDONLY|O_BINARY); /* not every filesystem allows O_DIRECT */
+    if(fd<0){perror("open");exit(0);}
+    image.path = path;
+    image.r = reader_open(fd,block_factor,opt_depth,opt_direct);
+    if(image.r==0){ perror("reader_open"); exit(1); }
+    if(!quiet){
+        image.w = writer_open(stdout,opt_output,opt_extents);
+        if(image.w==0){ perror("malloc"); exit(1); }
+        writer_file(image.w,path);
+    }
+    image.nresults = opt_depth;
+    image.results  = (struct chunk_result *)calloc(image.nresults,sizeof(*image.results));
+    if(image.results==0){ perror("calloc"); exit(1); }
+
+    struct reader_buf *b;
+    uint64_t waited = opt_stats ? now_ns() : 0;
+    while((b = reader_next(image.r))!=0){
+        if(opt_stats) stats.ns[SCEADAN_STAGE_IO] += now_ns() - waited; /* -s: waiting for the reader is reading */
+        pthread_mutex_lock(&image.lock);
+        image.submitted++;
+        pthread_mutex_unlock(&image.lock);
+        threadpool_submit(pool,b);
+        if(opt_stats) waited = now_ns();
+    }
+    pthread_mutex_lock(&image.lock);
+    while(image.finished<image.submitted){
+        pthread_cond_wait(&image.cond,&image.lock);
+    }
+    image_flush();
+    pthread_mutex_unlock(&image.lock);
+    if(image.w && writer_close(image.w)){ perror("write"); exit(1); }
+    image.w = 0;
+
+    if(reader_error(image.r)){
+        errno = reader_error(image.r);
+        perror("read");
+        exit(0);
+    }
+    reader_close(image.r);
+    close(fd);
+    for(size_t i=0;i<image.nresults;i++) free(image.results[i].labels);
+    free(image.results);
+    image.results   = 0;
+    image.nresults  = 0;
+    image.printed   = 0;
+    image.submitted = 0;
+    image.finished  = 0;
+    return 0;
+}
+
+static void process_dir_image(const char path[])
+{
+    const int nworkers = opt_jobs>0 ? opt_jobs : 1;
+    struct classifier *classifiers = (struct classifier *)calloc(nworkers,sizeof(struct classifier));
+    void **args = (void **)calloc(nworkers,sizeof(void *));
+    if(classifiers==0 || args==0){ perror("calloc"); exit(1); }
+    for(int i=0;i<nworkers;i++){
+        classifier_init(&classifiers[i]);
+        args[i] = &classifiers[i];
+    }
+    pool = threadpool_create(nworkers,classify_chunk,args);
+    ftw (path, &process_image_file, FTW_MAXOPENFD);
+    threadpool_wait(pool);
+    pool = 0;
+    for(int i=0;i<nworkers;i++) classifier_free(&classifiers[i]);
+    free(classifiers);
+    free(args);
+}
+
 static void process_dir( const          char path[])
 {
+    if(opt_depth>0){
+        process_dir_image(path);
+        return;
+    }
+    if(opt_jobs>0){
+        process_dir_parallel(path);
+        return;
+    }
+    classifier_init(&serial);
     ftw (path, &process_file, FTW_MAXOPENFD);
+    classifier_free(&serial);
 }
 
 
@@ -103,6 +716,32 @@ void usage()
     puts("usage: sceadan_app [options] inputfile [block factor]");
     puts("where [options] are:");
     puts("  -t <class>  - generate features for <class> and output to stdout");
+    puts("  --format json|libsvm - with -t, write JSON (the default) or liblinear/libsvm sparse lines");
+    puts("  --csr <prefix> - with -t, write binary CSR shards <prefix>-00000.csr, ... instead");
+    puts("  --shard-rows <n> - with --csr, at most <n> rows per shard");
+    puts("  -j <n>      - classify with <n> threads");
+    puts("  -m <file>   - use this model: liblinear's text format, or a binary model file (mcompile -b)");
+    puts("  --sorted    - with -j, print results in path order instead of as they finish");
+    puts("  --window <w> - classify every <w>-byte window (w even) instead of fixed blocks");
+    puts("  --step <s>  - with --window, advance <s> bytes (s even) between windows; default <w>");
+    puts("  --levels <a,b,...> - classify blocks of each size from one read, e.g. 512,4096,65536,1048576;");
+    puts("                each size a multiple of the one before");
+    puts("  --queue-depth <n> - image mode: keep <n> large reads in flight (io_uring, or pread threads)");
+    puts("                while -j classifiers work on the data; needs a block factor");
+    puts("  --direct    - with --queue-depth, bypass the page cache with O_DIRECT");
+    puts("  --margin <m> - container mode: classify at 64 KiB, 1 MiB, 8 MiB, ... and stop reading once");
+    puts("                the top two classes' decision values differ by <m>; prints the bytes read");
+    puts("  --cache <file> - reuse the results in <file> for files whose device, inode, size and mtime");
+    puts("                are unchanged, without reading them; add the others' (not with -t or --queue-depth)");
+    puts("  --cache-strict - with --cache, reuse results only for files whose contents hash the same");
+    puts("  --dedup <n> - block mode: remember the labels of blocks that are one byte repeated, and of");
+    puts("                the last <n> others (65536 is a good size), and reuse them for repeats");
+    puts("  --output text|csv|jsonl|binary - block mode: how to write the results (default text)");
+    puts("  --extents   - block mode: merge consecutive blocks of the same type into one result");
+    puts("                with the extent's offset and length");
+    puts("  -s          - print bytes, blocks, early exits and time per stage on stderr at the end");
+    puts("                (needs a build configured with --enable-stats; --enable-stats=perf adds");
+    puts("                cycles, IPC and cache misses)");
     puts("  -h          - generate help");
     puts("");
     puts("Classes");
@@ -114,13 +753,95 @@ void usage()
 
 int main (int argc, char *const argv[])
 {
+    static const struct option longopts[] = {
+        {"sorted", no_argument, 0, 'S'},
+        {"window", required_argument, 0, 'W'},
+        {"step",   required_argument, 0, 'P'},
+        {"levels", required_argument, 0, 'L'},
+        {"queue-depth", required_argument, 0, 'Q'},
+        {"direct", no_argument, 0, 'D'},
+        {"margin", required_argument, 0, 'M'},
+        {"format", required_argument, 0, 'F'},
+        {"csr",    required_argument, 0, 'C'},
+        {"shard-rows", required_argument, 0, 'R'},
+        {"cache",  required_argument, 0, 'K'},
+        {"cache-strict", no_argument, 0, 'H'},
+        {"dedup",  required_argument, 0, 'U'},
+        {"output", required_argument, 0, 'O'},
+        {"extents", no_argument, 0, 'E'},
+        {"help",   no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
     int ch;
-    while((ch = getopt(argc,argv,"t:h")) != -1){
+    while((ch = getopt_long(argc,argv,"t:j:m:sh",longopts,0)) != -1){
         switch(ch){
         case 't':
             opt_train = atoi(optarg);
             break;
+        case 'j':
+            opt_jobs = atoi(optarg);
+            break;
+        case 'm':
+            opt_model = optarg;
+            break;
+        case 's':
+            opt_stats = 1;
+            break;
+        case 'S':
+            opt_sorted = 1;
+            break;
+        case 'W':
+            opt_window = strtoul(optarg,0,10);
+            break;
+        case 'P':
+            opt_step = strtoul(optarg,0,10);
+            break;
+        case 'Q':
+            opt_depth = atoi(optarg);
+            break;
+        case 'D':
+            opt_direct = 1;
+            break;
+        case 'M':
+            opt_margin = strtod(optarg,0);
+            break;
+        case 'F':
+            if(strcmp(optarg,"json")==0) opt_format = SCEADAN_DUMP_JSON;
+            else if(strcmp(optarg,"libsvm")==0) opt_format = SCEADAN_DUMP_LIBSVM;
+            else usage();
+            break;
+        case 'C':
+            opt_csr = optarg;
+            break;
+        case 'R':
+            opt_shard_rows = strtoull(optarg,0,10);
+            break;
+        case 'K':
+            opt_cache = optarg;
+            break;
+        case 'H':
+            opt_cache_strict = 1;
+            break;
+        case 'U':
+            opt_dedup = strtoul(optarg,0,10);
+            break;
+        case 'O':
+            opt_output = writer_format(optarg);
+            if(opt_output<0) usage();
+            break;
+        case 'E':
+            opt_extents = true;
+            break;
+        case 'L':
+            for(char *p=optarg;*p;){
+                if(opt_nlevels==SCEADAN_MULTIRES_MAX_LEVELS) usage();
+                opt_levels[opt_nlevels++] = strtoul(p,&p,10);
+                if(*p==',') p++;
+                else if(*p) usage();
+            }
+            break;
         case 'h':
+        default:
             usage();
             exit(0);
         }
@@ -140,6 +861,53 @@ int main (int argc, char *const argv[])
     }
 
     if(argc!=0) usage();
+    if(opt_step && opt_window==0) usage();
+    if(opt_window && opt_nlevels) usage();
+    if(opt_depth && (block_factor==0 || opt_window || opt_nlevels)) usage();
+    if(opt_direct && opt_depth==0) usage();
+    if(opt_margin>0 && (block_factor || opt_window || opt_nlevels)) usage();
+    if((opt_format!=SCEADAN_DUMP_JSON || opt_csr) && opt_train==0) usage();
+    if(opt_shard_rows && opt_csr==0) usage();
+    if(opt_cache && (opt_train || opt_depth)) usage();
+    if(opt_cache_strict && opt_cache==0) usage();
+    if(opt_dedup && (block_factor==0 || opt_window || opt_nlevels || opt_train)) usage();
+    if((opt_output!=WRITER_TEXT || opt_extents) && (block_factor==0 || opt_window || opt_nlevels)) usage();
+    if(opt_cache && opt_output!=WRITER_TEXT) usage(); /* the cache keeps text lines */
+    quiet = opt_format!=SCEADAN_DUMP_JSON || opt_csr; /* JSON dumps always had the result lines */
+    if(opt_window){
+        if(opt_step==0) opt_step = opt_window;
+        if(opt_window%2 || opt_step%2){
+            fprintf(stderr,"--window and --step must be even\n");
+            exit(1);
+        }
+    }
+    if(opt_csr){
+        csr = sceadan_csr_writer_create(opt_csr,opt_shard_rows);
+        if(csr==0){ perror(opt_csr); exit(1); }
+    } else if(opt_train){
+        setvbuf(stdout,0,_IOFBF,1<<20);  /* vectors are large */
+    }
+    if(opt_cache){
+        cache = sceadan_cache_open(opt_cache,opt_cache_strict);
+        if(cache==0){ perror(opt_cache); exit(1); }
+    }
+    if(opt_dedup){
+        dedup = sceadan_dedup_create(opt_dedup);
+        if(dedup==0){ perror("sceadan_dedup_create"); exit(1); }
+    }
+    if(block_factor && !quiet) writer_header(stdout,opt_output);
     process_dir(input_target); /* if input_target is a file, it will be handled as a file */
+    if(csr && sceadan_csr_writer_close(csr)){
+        perror(opt_csr);
+        exit(1);
+    }
+    if(opt_stats) print_stats(stderr,&stats);
+    sceadan_dedup_destroy(dedup);
+    if(cache){
+        uint64_t hits,misses;
+        sceadan_cache_counts(cache,&hits,&misses);
+        if(opt_stats) fprintf(stderr,"# cache hits: %" PRIu64 "  misses: %" PRIu64 "\n",hits,misses);
+        sceadan_cache_close(cache);
+    }
     exit(0);
 }
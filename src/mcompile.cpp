@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <dirent.h>
 
 #ifdef HAVE_LINEAR_H
 #include <linear.h>
@@ -38,22 +39,232 @@
 #include "sceadan.h"
 
 /*
- * Compile a liblinear model to C
+ * Compile a liblinear model to C, to a binary model file, or to a C++
+ * header for a scorer specialized to it
  */
 
+/* on stdout for -h; on stderr, failing, for a mistake */
+void usage(int status) __attribute__((noreturn));
+void usage(int status)
+{
+    FILE *out = status ? stderr : stdout;
+    fputs("usage: mcompile [options] model > sceadan_model_precompiled.c\n",out);
+    fputs("       mcompile [-q int8|fp16] -b model.bin model\n",out);
+    fputs("       mcompile -x model > sceadan_model_specialized.h\n",out);
+    fputs("where [options] are:\n",out);
+    fputs("  -q int8|fp16 - emit per-class scaled quantized weights\n",out);
+    fputs("  -r <dir>     - report quantized vs. double accuracy on <dir> (e.g. testdata/good)\n",out);
+    fputs("                 or, with -c, cascade vs. full-model accuracy\n",out);
+    fputs("  -c <spec>    - also bundle a cascade whose stage models are named in <spec>:\n",out);
+    fputs("                   triage <model file>            unigram-only model; labels are family numbers\n",out);
+    fputs("                   family <n> model <model file>  model over family n's classes\n",out);
+    fputs("                   family <n> label <type>        family n is one type, decided by triage\n",out);
+    fputs("                   min_margin <x>                 below this triage margin, use the full model\n",out);
+    fputs("  -b <file>    - write a binary model file, which sceadan_open() maps instead of parsing,\n",out);
+    fputs("                 rather than C\n",out);
+    fputs("  -x           - write the header sceadan_scorer.cpp specializes its scorer for,\n",out);
+    fputs("                 rather than C; use the model the C was made from\n",out);
+    fputs("  -h           - generate help\n",out);
+    exit(status);
+}
+
+/* expected type of a corpus file is its name without the extension */
+static int expected_type(const char *fname)
+{
+    char name[256];
+    strncpy(name,fname,sizeof(name)-1);
+    name[sizeof(name)-1] = 0;
+    char *dot = strchr(name,'.');
+    if(dot) *dot = 0;
+    return sceadan_type_for_name(name);
+}
+
+/* weights and cascade to classify with; 0 for the full double model */
+struct report_config {
+    const char *name;
+    const struct sceadan_qmodel *qm;
+    const struct sceadan_cascade *cascade;
+};
+
+static void report_set(sceadan *s,const struct report_config *c)
+{
+    sceadan_set_qmodel(s,c->qm);
+    sceadan_set_cascade(s,c->cascade);
+}
+
+/*
+ * Classify every file in dir with configurations a and b, both whole-file
+ * and in 4 KiB blocks, and report the accuracy delta of b over a.
+ */
+static void report_accuracy(sceadan *s,const struct report_config *a,const struct report_config *b,
+                            const char *dirname)
+{
+    DIR *dir = opendir(dirname);
+    if(dir==0){
+        perror(dirname);
+        exit(1);
+    }
+    int files = 0,right_a = 0,right_b = 0;
+    int blocks = 0,same_blocks = 0;
+    struct dirent *de;
+    while((de = readdir(dir))!=0){
+        if(de->d_name[0]=='.') continue;
+        char path[PATH_MAX];
+        snprintf(path,sizeof(path),"%s/%s",dirname,de->d_name);
+        const int expected = expected_type(de->d_name);
+
+        report_set(s,a);
+        const int la = sceadan_classify_file(s,path);
+        report_set(s,b);
+        const int lb = sceadan_classify_file(s,path);
+        if(la<0 || lb<0) continue;
+        files++;
+        if(la==expected) right_a++;
+        if(lb==expected) right_b++;
+        if(la!=lb){
+            fprintf(stderr,"  %s: %s %s, %s %s\n",de->d_name,
+                    a->name,sceadan_name_for_type(la),b->name,sceadan_name_for_type(lb));
+        }
+
+        FILE *f = fopen(path,"rb");
+        if(f==0) continue;
+        uint8_t buf[4096];
+        size_t rd;
+        while((rd = fread(buf,1,sizeof(buf),f))>0){
+            report_set(s,a);
+            const int ba = sceadan_classify_buf(s,buf,rd);
+            report_set(s,b);
+            const int bb = sceadan_classify_buf(s,buf,rd);
+            blocks++;
+            if(ba==bb) same_blocks++;
+        }
+        fclose(f);
+    }
+    closedir(dir);
+    sceadan_set_qmodel(s,0);
+    sceadan_set_cascade(s,0);
+
+    if(files==0){
+        fprintf(stderr,"no files in %s\n",dirname);
+        return;
+    }
+    const double acc_a = 100.0 * right_a / files;
+    const double acc_b = 100.0 * right_b / files;
+    fprintf(stderr,"accuracy on %s: %s %d/%d (%.2f%%), %s %d/%d (%.2f%%), delta %+.2f%%\n",
+            dirname,a->name,right_a,files,acc_a,b->name,right_b,files,acc_b,acc_b-acc_a);
+    if(blocks>0){
+        fprintf(stderr,"4 KiB blocks with the same label: %d/%d (%.2f%%)\n",
+                same_blocks,blocks,100.0*same_blocks/blocks);
+    }
+}
+
 int main(int argc,char **argv)
 {
-    const struct model* model = 0;
+    int quant = SCEADAN_QUANT_NONE;
+    const char *report_dir = 0;
+    const char *cascade_spec = 0;
+    const char *binary = 0;
+    bool specialize = false;
+    int ch;
+    while((ch = getopt(argc,argv,"q:r:c:b:xh")) != -1){
+        switch(ch){
+        case 'b':
+            binary = optarg;
+            break;
+        case 'c':
+            cascade_spec = optarg;
+            break;
+        case 'q':
+            if(strcmp(optarg,"int8")==0) quant = SCEADAN_QUANT_INT8;
+            else if(strcmp(optarg,"fp16")==0) quant = SCEADAN_QUANT_FP16;
+            else usage(1);
+            break;
+        case 'r':
+            report_dir = optarg;
+            break;
+        case 'x':
+            specialize = true;
+            break;
+        case 'h':
+            usage(0);
+        default:
+            usage(1);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if(argc!=1) usage(1);
+    if(binary && cascade_spec) usage(1); /* model files hold one model */
+    if(specialize && (binary || cascade_spec || quant!=SCEADAN_QUANT_NONE)) usage(1); /* the scorer uses the doubles */
+
+    fprintf(stderr,"Loading %s\n",argv[0]);
+    sceadan *s = sceadan_open(argv[0]);
+    if(!s){
+        perror(argv[0]);
+        exit(1);
+    }
+    struct sceadan_cascade *cascade = 0;
+    if(cascade_spec){
+        cascade = sceadan_cascade_load(cascade_spec);
+        if(!cascade){
+            fprintf(stderr,"cannot load cascade %s\n",cascade_spec);
+            exit(1);
+        }
+        if(report_dir){
+            const struct report_config full = {"full model",0,0};
+            const struct report_config casc = {"cascade",0,cascade};
+            report_accuracy(s,&full,&casc,report_dir);
+        }
+    }
+    if(specialize){
+        sceadan_scorer_dump(s->model);
+        sceadan_close(s);
+        return(0);
+    }
+    if(quant==SCEADAN_QUANT_NONE && binary){
+        if(sceadan_write_model(s,binary)){
+            perror(binary);
+            exit(1);
+        }
+        sceadan_close(s);
+        return(0);
+    }
+    if(quant==SCEADAN_QUANT_NONE){
+        sceadan_model_dump(s->model);
+        if(cascade) sceadan_cascade_dump(cascade);
+        sceadan_cascade_free(cascade);
+        sceadan_close(s);
+        return(0);
+    }
 
-    if(argc>1){
-        fprintf(stderr,"Loading %s\n",argv[1]);
-        model = load_model(argv[1]);
-        if(!model){
-            perror(argv[1]);
+    struct sceadan_qmodel *qm = sceadan_qmodel_create(s->model,quant);
+    if(!qm){
+        fprintf(stderr,"cannot quantize %s\n",argv[0]);
+        exit(1);
+    }
+    const size_t dsize = sceadan_qmodel_size(qm) * sizeof(double)
+        / ((quant==SCEADAN_QUANT_INT8) ? sizeof(int8_t) : sizeof(uint16_t));
+    fprintf(stderr,"quantized weights: %zu bytes (double: %zu bytes, %.1fx smaller)\n",
+            sceadan_qmodel_size(qm),dsize,(double)dsize/sceadan_qmodel_size(qm));
+    if(report_dir && !cascade){
+        const struct report_config dbl = {"double",0,0};
+        const struct report_config quantized = {(quant==SCEADAN_QUANT_INT8) ? "int8" : "fp16",qm,0};
+        report_accuracy(s,&dbl,&quantized,report_dir);
+    }
+    if(binary){
+        sceadan_set_qmodel(s,qm);
+        if(sceadan_write_model(s,binary)){
+            perror(binary);
             exit(1);
         }
+        sceadan_qmodel_free(qm);
+        sceadan_close(s);
+        return(0);
     }
-    sceadan_model_dump(model);
+    sceadan_qmodel_dump(qm);
+    if(cascade) sceadan_cascade_dump(cascade);
+    sceadan_cascade_free(cascade);
+    sceadan_qmodel_free(qm);
+    sceadan_close(s);
     return(0);
 }
-
@@ -0,0 +1,278 @@
+/*
+ * reader.c: io_uring / pread block reader (see reader.h)
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(HAVE_LIBURING_H) && defined(HAVE_LIBURING)
+#include <liburing.h>
+#define USE_IO_URING
+#endif
+
+#include "reader.h"
+
+struct reader {
+    int       fd;
+    size_t    bufsize;
+    int       depth;
+    uint8_t  *mem;
+    struct reader_buf *bufs;
+
+    pthread_mutex_t lock;               /* guards everything below */
+    pthread_cond_t  cond;
+    struct reader_buf *free;            /* released buffers, to be read into again */
+    struct reader_buf *done_head;       /* pread: completed reads, in completion order */
+    struct reader_buf *done_tail;
+    uint64_t  next_offset;
+    bool      eof;                      /* a read came back short, or failed */
+    int       error;
+    int       reading;                  /* reads issued but not yet returned by reader_next */
+
+    pthread_t *threads;                 /* pread backend */
+#ifdef USE_IO_URING
+    bool      uring;
+    struct io_uring ring;
+#endif
+};
+
+/* claim the next offset for a free buffer; call with the lock held */
+static struct reader_buf *claim(reader *r)
+{
+    struct reader_buf *b = r->free;
+    if(b==0 || r->eof) return 0;
+    r->free       = b->next;
+    b->offset     = r->next_offset;
+    b->seq        = r->next_offset / r->bufsize;
+    b->len        = 0;
+    r->next_offset += r->bufsize;
+    r->reading++;
+    return b;
+}
+
+/* a read has finished with n bytes, or -errno; call with the lock held.
+ * Returns true if the buffer has data for reader_next(). */
+static bool completed(reader *r,struct reader_buf *b,ssize_t n)
+{
+    if(n<0){
+        if(r->error==0) r->error = (int)-n;
+        r->eof = true;
+        n = 0;
+    }
+    b->len = n;
+    if((size_t)n < r->bufsize) r->eof = true;  /* only the end of the input stops a read short */
+    if(n==0){
+        r->reading--;
+        b->next = r->free;
+        r->free = b;
+        return false;
+    }
+    return true;
+}
+
+static void *pread_main(void *arg)
+{
+    reader *r = (reader *)arg;
+    pthread_mutex_lock(&r->lock);
+    while(true){
+        struct reader_buf *b;
+        while((b = claim(r))==0 && !r->eof){
+            pthread_cond_wait(&r->cond,&r->lock);
+        }
+        if(b==0) break;
+        pthread_mutex_unlock(&r->lock);
+
+        ssize_t n = 0;
+        while((size_t)n < r->bufsize){
+            const ssize_t rd = pread(r->fd,b->data+n,r->bufsize-n,b->offset+n);
+            if(rd<0 && errno==EINTR) continue;
+            if(rd<0){ n = -errno; break; }
+            if(rd==0) break;
+            n += rd;
+        }
+
+        pthread_mutex_lock(&r->lock);
+        if(completed(r,b,n)){
+            b->next = 0;
+            if(r->done_tail) r->done_tail->next = b;
+            else r->done_head = b;
+            r->done_tail = b;
+        }
+        pthread_cond_broadcast(&r->cond);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return 0;
+}
+
+#ifdef USE_IO_URING
+/* queue a read of the rest of b, after the b->len bytes it has */
+static void uring_prep(reader *r,struct reader_buf *b)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&r->ring);
+    io_uring_prep_read(sqe,r->fd,b->data+b->len,r->bufsize-b->len,b->offset+b->len);
+    io_uring_sqe_set_data(sqe,b);
+}
+
+/* queue reads into every free buffer; call with the lock held */
+static void uring_submit(reader *r)
+{
+    struct reader_buf *b;
+    int n = 0;
+    while((b = claim(r))!=0){
+        uring_prep(r,b);
+        n++;
+    }
+    if(n) io_uring_submit(&r->ring);
+}
+
+static struct reader_buf *uring_next(reader *r)
+{
+    pthread_mutex_lock(&r->lock);
+    while(true){
+        uring_submit(r);
+        if(r->reading==0){
+            if(r->eof) break;
+            pthread_cond_wait(&r->cond,&r->lock);   /* every buffer is still in use */
+            continue;
+        }
+        pthread_mutex_unlock(&r->lock);
+        struct io_uring_cqe *cqe;
+        const int ret = io_uring_wait_cqe(&r->ring,&cqe);
+        pthread_mutex_lock(&r->lock);
+        if(ret<0){
+            if(ret==-EINTR) continue;
+            r->error = -ret;
+            break;
+        }
+        struct reader_buf *b = (struct reader_buf *)io_uring_cqe_get_data(cqe);
+        const int res = cqe->res;
+        io_uring_cqe_seen(&r->ring,cqe);
+        if(res==-EINTR || res==-EAGAIN || (res>0 && b->len+res < r->bufsize)){
+            if(res>0) b->len += res;    /* short, like pread: read the rest */
+            uring_prep(r,b);
+            io_uring_submit(&r->ring);
+            continue;
+        }
+        const ssize_t n = (res<0) ? res : (ssize_t)(b->len+res); /* a 0 read is the end */
+        if(completed(r,b,n)){
+            r->reading--;
+            pthread_mutex_unlock(&r->lock);
+            return b;
+        }
+    }
+    pthread_mutex_unlock(&r->lock);
+    return 0;
+}
+#endif
+
+reader *reader_open(int fd,size_t block,int depth,bool direct)
+{
+    /* a whole number of blocks (and for O_DIRECT of READER_ALIGN), at least READER_BUF_SIZE */
+    size_t unit = block;
+    while(direct && unit % READER_ALIGN) unit += block;
+    const size_t bufsize = unit * ((READER_BUF_SIZE + unit - 1) / unit);
+
+    reader *r = (reader *)calloc(1,sizeof(reader));
+    if(r==0) return 0;
+    r->fd      = fd;
+    r->bufsize = bufsize;
+    r->depth   = depth;
+    r->bufs    = (struct reader_buf *)calloc(depth,sizeof(struct reader_buf));
+    void *mem  = 0;
+    if(r->bufs==0 || posix_memalign(&mem,READER_ALIGN,bufsize*depth)){
+        free(r->bufs);
+        free(r);
+        return 0;
+    }
+    r->mem = (uint8_t *)mem;
+    for(int i=0;i<depth;i++){
+        r->bufs[i].data = r->mem + bufsize*i;
+        r->bufs[i].next = r->free;
+        r->free = &r->bufs[i];
+    }
+    pthread_mutex_init(&r->lock,0);
+    pthread_cond_init(&r->cond,0);
+
+#ifdef USE_IO_URING
+    if(io_uring_queue_init(depth,&r->ring,0)==0){
+        r->uring = true;
+        return r;
+    }
+#endif
+    r->threads = (pthread_t *)calloc(depth,sizeof(pthread_t));
+    if(r->threads==0){ perror("calloc"); exit(1); }
+    for(int i=0;i<depth;i++){
+        if(pthread_create(&r->threads[i],0,pread_main,r)){
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    return r;
+}
+
+struct reader_buf *reader_next(reader *r)
+{
+#ifdef USE_IO_URING
+    if(r->uring) return uring_next(r);
+#endif
+    pthread_mutex_lock(&r->lock);
+    while(r->done_head==0 && !(r->eof && r->reading==0)){
+        pthread_cond_wait(&r->cond,&r->lock);
+    }
+    struct reader_buf *b = r->done_head;
+    if(b){
+        r->done_head = b->next;
+        if(r->done_head==0) r->done_tail = 0;
+        r->reading--;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return b;
+}
+
+void reader_release(reader *r,struct reader_buf *b)
+{
+    pthread_mutex_lock(&r->lock);
+    b->next = r->free;
+    r->free = b;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+}
+
+int reader_error(const reader *r)
+{
+    return r->error;
+}
+
+void reader_close(reader *r)
+{
+    pthread_mutex_lock(&r->lock);
+    r->eof = true;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+#ifdef USE_IO_URING
+    if(r->uring){
+        while(r->reading>0){            /* drain reads still in flight */
+            struct io_uring_cqe *cqe;
+            if(io_uring_wait_cqe(&r->ring,&cqe)<0) break;
+            io_uring_cqe_seen(&r->ring,cqe);
+            r->reading--;
+        }
+        io_uring_queue_exit(&r->ring);
+    }
+#endif
+    if(r->threads){
+        for(int i=0;i<r->depth;i++) pthread_join(r->threads[i],0);
+        free(r->threads);
+    }
+    pthread_cond_destroy(&r->cond);
+    pthread_mutex_destroy(&r->lock);
+    free(r->mem);
+    free(r->bufs);
+    free(r);
+}
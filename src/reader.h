@@ -0,0 +1,41 @@
+#ifndef READER_H
+#define READER_H
+
+/*
+ * Asynchronous block reader for sceadan_app.
+ *
+ * Keeps up to depth large reads in flight at increasing offsets, so the
+ * device stays busy while the classifier workers are computing. Reads
+ * go through io_uring when sceadan was built with liburing and the
+ * kernel supports it; otherwise depth threads issue pread()s.
+ * Completed buffers may come back out of order; each carries its
+ * offset and sequence number.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define READER_BUF_SIZE (1<<20)         /* minimum bytes per read */
+#define READER_ALIGN    4096            /* buffer, size and offset alignment (for O_DIRECT) */
+
+struct reader_buf {
+    uint8_t  *data;
+    size_t    len;                      /* bytes read; less than the buffer size only at the end */
+    uint64_t  offset;
+    uint64_t  seq;                      /* offset / buffer size */
+    struct reader_buf *next;
+};
+
+struct reader;
+typedef struct reader reader;
+
+/* fd must support pread(). Each buffer holds a whole number of blocks;
+ * with direct, buffer sizes are also a multiple of READER_ALIGN. */
+reader *reader_open(int fd,size_t block,int depth,bool direct);
+struct reader_buf *reader_next(reader *);    // wait for a completed read; 0 at the end
+void reader_release(reader *,struct reader_buf *);  // done with the buffer; any thread
+int reader_error(const reader *);            // errno of a failed read, or 0
+void reader_close(reader *);                 // all buffers must have been released
+
+#endif
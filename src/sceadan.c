@@ -40,14 +40,26 @@
 #include <assert.h>
 #include <ftw.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <math.h>
+#include <pthread.h>
+#include <time.h>
+#ifdef SCEADAN_STATS_PERF
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #ifdef HAVE_LINEAR_H
 #include <linear.h>
@@ -222,6 +234,17 @@ struct sceadan_type_t {
 extern struct sceadan_type_t sceadan_types[];
 const char *sceadan_name_for_type(int i);
 
+/* What prediction and dumping read: the frequencies, kept apart from
+ * the counts they were computed from, and the finalized statistics. */
+struct sceadan_features {
+    const char *file_name;
+    double     ufreq[n_unigram];            /* unigram frequencies */
+    uint32_t   n_bigrams;                   /* bigrams that occur, ascending */
+    bigram_t   bigram[n_bigram];
+    double     bfreq[n_bigram];             /* their frequencies */
+    mfv_t      fv;                          /* finalized statistics (.avg) */
+};
+
 /* FUNCTIONS */
 // TODO full path vs relevant path may matter
 struct sceadan_vectors {
@@ -230,11 +253,56 @@ struct sceadan_vectors {
     mfv_t mfv;
     sum_t last_cnt;                     // for computing runs of characters
     uint8_t last_val;
+    sum_t first_cnt;                    // length of the leading run, for merging
+    uint8_t first_val;
     const char *file_name;                  /* if the vectors came from a file, indicate it here */
+    uint32_t   n_bcv_touched;               /* bigram cells that have been nonzero; sorted by vectors_finalize() */
+    bigram_t   bcv_touched[n_bigram];
+    uint64_t   bcv_listed[n_bigram / 64];   /* bitmap of the cells in bcv_touched */
+    bigram_t   bcv_scratch[n_bigram];       /* for sorting bcv_touched */
+
+    /* Filled in by vectors_finalize(). ucv, bcv and mfv keep their counts
+     * and running sums (.tot) so that they can continue to be updated. */
+    struct sceadan_features f;
 };
 typedef struct sceadan_vectors sceadan_vectors_t;
 
 #include "sceadan.h"
+#include "sceadan_score.h"
+#include "sceadan_input.h"
+#include "sceadan_compact.h"
+#include "sceadan_modelfile.h"
+#include "sceadan_export.h"
+#include "sceadan_cache.h"
+#include "sceadan_dedup.h"
+
+struct sceadan_window;
+struct sceadan_multires;
+struct batch_feature;
+
+/* reusable classification context; see sceadan_ctx_create() */
+struct sceadan_ctx {
+    const sceadan *s;
+    struct sceadan_window *win;         /* sliding-window state, if sceadan_window_begin() was called */
+    struct sceadan_multires *mr;        /* multi-resolution state, if sceadan_multires_begin() was called */
+    struct batch_feature *feat;         /* batch features, and scratch space for sorting them */
+    struct batch_feature *feat_tmp;
+    size_t feat_cap;
+    int reference_update;               /* stream with vectors_update_ref(); see sceadan_ctx_reference_update() */
+    sceadan_compact *compact;           /* bigram counters for bounded blocks */
+    sceadan_dedup *dedup;               /* see sceadan_ctx_set_dedup() */
+    size_t fill_len[256];               /* dedup: the label of a block of fill_len[b] b's, if not 0 */
+    int fill_label[256];
+    struct dedup_miss *miss;            /* dedup: the blocks of a batch that need classifying */
+    const uint8_t **miss_buf;
+    size_t *miss_len;
+    int *miss_label;
+    size_t miss_cap;
+#ifdef SCEADAN_STATS
+    struct sceadan_stats stats;         /* added to s->stats when the context is destroyed */
+#endif
+    sceadan_vectors_t v;
+};
 
 
 #define MODEL ("model")                 /* default model file */
@@ -244,6 +312,148 @@ typedef struct sceadan_vectors sceadan_vectors_t;
 #define BCV_CONST_THRESHOLD  (.5)       /* ignore BCV more than this */
 
 
+/*
+ * Statistics (--enable-stats). Every context, and every call that
+ * classifies without one, counts into its own sceadan_stats and adds
+ * them to the sceadan's totals once, at the end, so the hot path takes
+ * no lock. Time is taken in laps: each stage's lap starts where the
+ * one before it ended. Without --enable-stats the macros expand to
+ * nothing.
+ */
+#ifdef SCEADAN_STATS
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct stats_clock {
+    uint64_t ns;
+#ifdef SCEADAN_STATS_PERF
+    uint64_t perf[3];                   /* cycles, instructions, cache misses */
+#endif
+};
+
+#ifdef SCEADAN_STATS_PERF
+/* The calling thread's counters, opened as one group on first use:
+ * -2 before that, -1 if the kernel refused them. Every counter of the
+ * group is an fd of its own, kept in perf_fds until the thread exits. */
+static __thread int perf_group = -2;
+static __thread int perf_fds[3];        /* cycles (the leader), instructions, cache misses */
+static pthread_key_t perf_key;
+static pthread_once_t perf_once = PTHREAD_ONCE_INIT;
+
+static void perf_close(void *arg)
+{
+    const int *fds = (const int *)arg;
+    for(int i=0;i<3;i++) close(fds[i]);
+}
+
+static void perf_key_create(void)
+{
+    pthread_key_create(&perf_key,perf_close);
+}
+
+static int perf_open(uint64_t config,int group)
+{
+    struct perf_event_attr attr;
+    memset(&attr,0,sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.config         = config;
+    attr.exclude_kernel = 1;            /* allowed at perf_event_paranoid 2 */
+    attr.exclude_hv     = 1;
+    attr.read_format    = PERF_FORMAT_GROUP;
+    return (int)syscall(__NR_perf_event_open,&attr,0,-1,group,0);
+}
+
+static int perf_thread_group(void)
+{
+    if(perf_group!=-2) return perf_group;
+    static const uint64_t config[3] = {PERF_COUNT_HW_CPU_CYCLES,PERF_COUNT_HW_INSTRUCTIONS,PERF_COUNT_HW_CACHE_MISSES};
+    perf_group = -1;
+    for(int i=0;i<3;i++){
+        perf_fds[i] = perf_open(config[i],i ? perf_fds[0] : -1);
+        if(perf_fds[i]<0){              /* each one opened so far is its own fd */
+            while(i--) close(perf_fds[i]);
+            return -1;
+        }
+    }
+    perf_group = perf_fds[0];
+    pthread_once(&perf_once,perf_key_create);     /* closed when the thread exits */
+    pthread_setspecific(perf_key,perf_fds);
+    return perf_group;
+}
+#endif
+
+static void stats_clock_read(struct stats_clock *c)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    c->ns = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#ifdef SCEADAN_STATS_PERF
+    const int fd = perf_thread_group();
+    uint64_t group[4];                  /* nr, then the values */
+    if(fd>=0 && read(fd,group,sizeof(group))==(ssize_t)sizeof(group)){
+        memcpy(c->perf,group+1,sizeof(c->perf));
+    } else {
+        memset(c->perf,0,sizeof(c->perf));
+    }
+#endif
+}
+
+/* charge the time since c to stage, and start the next lap */
+static void stats_lap(struct sceadan_stats *st,struct stats_clock *c,int stage)
+{
+    struct stats_clock now;
+    stats_clock_read(&now);
+    st->ns[stage] += now.ns - c->ns;
+#ifdef SCEADAN_STATS_PERF
+    if(now.perf[0]){
+        st->perf = 1;
+        st->cycles[stage]       += now.perf[0] - c->perf[0];
+        st->instructions[stage] += now.perf[1] - c->perf[1];
+        st->cache_misses[stage] += now.perf[2] - c->perf[2];
+    }
+#endif
+    *c = now;
+}
+
+static void stats_exit(struct sceadan_stats *st,int label)
+{
+    if(label==RAND)      st->rand_exits++;
+    if(label==UCV_CONST) st->ucv_const_exits++;
+    if(label==BCV_CONST) st->bcv_const_exits++;
+}
+
+static void stats_merge(const sceadan *s,struct sceadan_stats *st)
+{
+    pthread_mutex_lock(&stats_lock);
+    sceadan_stats_add(s->stats,st);
+    pthread_mutex_unlock(&stats_lock);
+    memset(st,0,sizeof(*st));
+}
+
+#define STATS_LOCAL(st)         struct sceadan_stats st##_local; \
+                                memset(&st##_local,0,sizeof(st##_local)); \
+                                struct sceadan_stats *const st = &st##_local
+#define CTX_STATS(ctx)          (&(ctx)->stats)
+#define STATS_CLOCK(c)          struct stats_clock c; stats_clock_read(&c)
+#define STATS_CLOCK_MEMBER(c)   struct stats_clock c;
+#define STATS_RESTART(c)        stats_clock_read(&c)
+#define STATS_LAP(st,c,stage)   stats_lap((st),&(c),(stage))
+#define STATS_ADD(st,field,n)   ((st)->field += (n))
+#define STATS_EXIT(st,label)    stats_exit((st),(label))
+#define STATS_MERGE(s,st)       stats_merge((s),(st))
+#else
+#define STATS_LOCAL(st)         struct sceadan_stats *const st = 0
+#define CTX_STATS(ctx)          ((struct sceadan_stats *)0)
+#define STATS_CLOCK(c)
+#define STATS_CLOCK_MEMBER(c)
+#define STATS_RESTART(c)
+#define STATS_LAP(st,c,stage)   ((void)(st))
+#define STATS_ADD(st,field,n)   ((void)(st))
+#define STATS_EXIT(st,label)    ((void)(st))
+#define STATS_MERGE(s,st)       ((void)(st))
+#endif
+
+
 /* one of two master lists of types. This should be auto-generated from a file */
 struct sceadan_type_t sceadan_types[] = {
     {0,"unclassified"},
@@ -318,37 +528,92 @@ const char *sceadan_name_for_type(int code)
     return(0);
 }
 
+int sceadan_type_for_name(const char *name)
+{
+    for(int i=0;sceadan_types[i].name[0];i++){
+        if(strcasecmp(sceadan_types[i].name,name)==0) return sceadan_types[i].code;
+    }
+    return(-1);
+}
+
 static sum_t max ( const sum_t a, const sum_t b ) {
     return a > b ? a : b;
 }
 
 
 /* FUNCTIONS FOR VECTORS */
-static void vectors_update (const uint8_t buf[], const size_t sz, sceadan_vectors_t *v)
+
+/* count a bigram n times, remembering the cell the first time it is used */
+static inline void bcv_add_n(sceadan_vectors_t *v,const unigram_t prev,const unigram_t next,const sum_t n)
+{
+    const sum_t old = v->bcv[prev][next].tot;
+    v->bcv[prev][next].tot = old + n;
+    if(old==0){
+        const bigram_t b = (bigram_t)(prev << nbit_unigram | next);
+        if((v->bcv_listed[b/64] & (1ULL << (b%64)))==0){
+            v->bcv_listed[b / 64] |= 1ULL << (b % 64);
+            v->bcv_touched[v->n_bcv_touched++] = b;
+        }
+    }
+}
+
+static inline void bcv_add(sceadan_vectors_t *v,const unigram_t prev,const unigram_t next)
+{
+    bcv_add_n(v,prev,next,1);
+}
+
+/* Zero the vectors for re-use. Only the bigram cells that were touched
+ * are cleared, so the cost is O(distinct bigrams) rather than O(64K). */
+static void vectors_reset(sceadan_vectors_t *v)
+{
+    for(uint32_t i=0;i<v->n_bcv_touched;i++){
+        const bigram_t b = v->bcv_touched[i];
+        v->bcv[b >> nbit_unigram][b & (n_unigram - 1)].tot = 0;
+        v->bcv_listed[b / 64] = 0;
+    }
+    v->n_bcv_touched = 0;
+    memset(v->ucv,0,sizeof(v->ucv));
+    memset(&v->mfv,0,sizeof(v->mfv));
+    v->last_cnt  = 0;
+    v->last_val  = 0;
+    v->first_cnt = 0;
+    v->first_val = 0;
+    v->file_name = 0;
+}
+
+/* The byte-at-a-time feature loop. It is the reference that
+ * vectors_update() must match exactly, and is faster than it for
+ * inputs too short to pay for its per-call histogram merge. */
+static void vectors_update_ref (const uint8_t buf[], const size_t sz, sceadan_vectors_t *v)
 {
     const int sz_mod = v->mfv.uni_sz % 2;
+
+    /* The pair that straddles the previous buffer and this one, so that
+     * the vectors do not depend on how the input was split up. */
+    if (sz > 0 && v->mfv.uni_sz > 0) {
+        v->mfv.contiguity.tot += abs (buf[0] - v->last_val);
+        if (sz_mod != 0) bcv_add(v, v->last_val, buf[0]);
+    }
+
+    /* extend the leading run while it still covers everything */
+    if (sz > 0 && v->first_cnt == v->mfv.uni_sz) {
+        if (v->mfv.uni_sz == 0) v->first_val = buf[0];
+        size_t n = 0;
+        while (n < sz && buf[n] == v->first_val) n++;
+        v->first_cnt += n;
+    }
+
     for (int ndx = 0; ndx < sz; ndx++) {
 
         /* Compute the unigrams */
         const unigram_t unigram = buf[ndx];
         v->ucv[unigram].tot++;
 
-        {
-            unigram_t prev;
-            unigram_t next;
-
-            if (ndx == 0 && sz_mod != 0) { 
-                prev = v->last_val;
-                next = unigram;
-
-                v->bcv[prev][next].tot++;
-                v->mfv.contiguity.tot += abs (next - prev);
-            } else if (ndx + 1 < sz) {
-                prev = unigram;
-                next = buf[ndx + 1];
-                v->mfv.contiguity.tot += abs (next - prev);
-                if (ndx % 2 == sz_mod) v->bcv[prev][next].tot++;
-            }
+        if (ndx + 1 < sz) {
+            const unigram_t prev = unigram;
+            const unigram_t next = buf[ndx + 1];
+            v->mfv.contiguity.tot += abs (next - prev);
+            if (ndx % 2 == sz_mod) bcv_add(v, prev, next);
         }
 
         // total count of set bits (for hamming weight)
@@ -384,160 +649,538 @@ static void vectors_update (const uint8_t buf[], const size_t sz, sceadan_vector
     v->mfv.uni_sz += sz;
 }
 
-static void vectors_finalize ( sceadan_vectors_t *v)
+/* Σ |buf[i+1] - buf[i]| over the pairs inside buf */
+static sum_t contiguity_sum(const uint8_t buf[],const size_t sz)
+{
+    sum_t  sum = 0;
+    size_t i   = 0;
+#ifdef __SSE2__
+    __m128i acc = _mm_setzero_si128();
+    for(;i+17<=sz;i+=16){
+        const __m128i a = _mm_loadu_si128((const __m128i *)(buf + i));
+        const __m128i b = _mm_loadu_si128((const __m128i *)(buf + i + 1));
+        acc = _mm_add_epi64(acc,_mm_sad_epu8(a,b));
+    }
+    sum = (sum_t)_mm_cvtsi128_si64(acc) + (sum_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(acc,acc));
+#endif
+    for(;i+1<sz;i++) sum += abs(buf[i + 1] - buf[i]);
+    return sum;
+}
+
+/* bit k is set if p[k] == p[k-1]; p[-1] must be readable */
+static inline uint64_t repeat_mask64(const uint8_t *p)
+{
+    uint64_t m = 0;
+#ifdef __SSE2__
+    for(int q=0;q<4;q++){
+        const __m128i a = _mm_loadu_si128((const __m128i *)(p + 16 * q));
+        const __m128i b = _mm_loadu_si128((const __m128i *)(p + 16 * q - 1));
+        m |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a,b)) << (16 * q);
+    }
+#else
+    for(int k=0;k<64;k++) m |= (uint64_t)(p[k] == p[k - 1]) << k;
+#endif
+    return m;
+}
+
+/* Track runs of repeated bytes 64 bytes at a time. A run continues
+ * across a set bit of the repeat mask and ends at a clear one, so the
+ * runs in a chunk can be read off the mask instead of byte by byte. */
+static void update_streak(sceadan_vectors_t *v,const uint8_t buf[],const size_t sz)
+{
+    sum_t run  = (v->last_cnt != 0 && v->last_val == buf[0]) ? v->last_cnt + 1 : 1;
+    sum_t best = v->mfv.max_byte_streak.tot;
+    size_t i = 1;
+    for(;i+64<=sz;i+=64){
+        const uint64_t eq = repeat_mask64(buf + i);
+        if(eq==~0ULL){
+            run += 64;
+            continue;
+        }
+        const int lead = __builtin_ctzll(~eq);          /* the current run's last bytes */
+        best = max(best,run + lead);
+        uint64_t inner = eq >> lead;                    /* runs that start in this chunk */
+        if(inner!=0 && (sum_t)__builtin_popcountll(inner)+1>best){
+            sum_t longest = 0;
+            while(inner){
+                inner &= inner << 1;
+                longest++;
+            }
+            best = max(best,longest + 1);
+        }
+        run = (sum_t)__builtin_clzll(~eq) + 1;          /* the run still open at the end */
+    }
+    for(;i<sz;i++){
+        if(buf[i]==buf[i-1]){
+            run++;
+        } else {
+            best = max(best,run);
+            run  = 1;
+        }
+    }
+    v->mfv.max_byte_streak.tot = max(best,run);
+    v->last_cnt = run;
+    v->last_val = buf[sz - 1];
+}
+
+#define UPDATE_MIN_BYTES 256            /* shorter inputs use vectors_update_ref() */
+#define UPDATE_MAX_BYTES (1 << 30)      /* keeps the sub-histogram counts in 32 bits */
+
+/* Everything vectors_update() does except count the bigrams: the
+ * histogram, kept in four interleaved copies (so a run of one value
+ * does not serialize on one counter), sums derived from the histogram,
+ * and SIMD passes for contiguity and repeated bytes. sz is at least 1
+ * and at most UPDATE_MAX_BYTES. */
+static void vectors_update_unigrams(const uint8_t buf[],const size_t sz,sceadan_vectors_t *v)
+{
+    /* the pair that straddles the previous buffer and this one */
+    if(v->mfv.uni_sz>0) v->mfv.contiguity.tot += abs(buf[0] - v->last_val);
+
+    /* extend the leading run while it still covers everything */
+    if(v->first_cnt==v->mfv.uni_sz){
+        if(v->mfv.uni_sz==0) v->first_val = buf[0];
+        size_t n = 0;
+        while(n<sz && buf[n]==v->first_val) n++;
+        v->first_cnt += n;
+    }
+
+    uint32_t hist[4][n_unigram];
+    memset(hist,0,sizeof(hist));
+    size_t i = 0;
+    for(;i+4<=sz;i+=4){
+        hist[0][buf[i]]++;
+        hist[1][buf[i + 1]]++;
+        hist[2][buf[i + 2]]++;
+        hist[3][buf[i + 3]]++;
+    }
+    for(;i<sz;i++) hist[0][buf[i]]++;
+
+    /* everything that depends only on the byte values comes from the histogram */
+    sum_t zero_bits = 0, byte_sum = 0, square_sum = 0, lo = 0, med = 0, hi = 0;
+    for(int b=0;b<n_unigram;b++){
+        const sum_t c = (sum_t)hist[0][b] + hist[1][b] + hist[2][b] + hist[3][b];
+        if(c==0) continue;
+        v->ucv[b].tot += c;
+        zero_bits  += c * (nbit_unigram - __builtin_popcount(b));
+        byte_sum   += c * b;
+        square_sum += c * b * b;
+        if      (b < ASCII_LO_VAL) lo  += c;
+        else if(b<ASCII_HI_VAL) med += c;
+        else                       hi  += c;
+    }
+    v->mfv.hamming_weight.tot  += zero_bits;
+    v->mfv.byte_value.tot      += byte_sum;
+    v->mfv.stddev_byte_val.tot += square_sum;
+    v->mfv.lo_ascii_freq.tot   += lo;
+    v->mfv.med_ascii_freq.tot  += med;
+    v->mfv.hi_ascii_freq.tot   += hi;
+
+    v->mfv.contiguity.tot += contiguity_sum(buf,sz);
+
+    update_streak(v,buf,sz);
+    v->mfv.uni_sz += sz;
+}
+
+/* Add buf to the vectors. The result is identical to
+ * vectors_update_ref(), but the work is split into passes that do
+ * not depend on each other byte to byte: a strided bigram pass, then
+ * vectors_update_unigrams(). */
+static void vectors_update(const uint8_t buf[],const size_t sz,sceadan_vectors_t *v)
+{
+    if(sz<UPDATE_MIN_BYTES){
+        vectors_update_ref(buf,sz,v);
+        return;
+    }
+    if(sz>UPDATE_MAX_BYTES){
+        vectors_update(buf,UPDATE_MAX_BYTES,v);
+        vectors_update(buf + UPDATE_MAX_BYTES,sz - UPDATE_MAX_BYTES,v);
+        return;
+    }
+    const int sz_mod = v->mfv.uni_sz % 2;
+
+    /* the pair that straddles the previous buffer and this one */
+    if(v->mfv.uni_sz>0 && sz_mod!=0) bcv_add(v,v->last_val,buf[0]);
+
+    for(size_t k=sz_mod;k+1<sz;k+=2) bcv_add(v,buf[k],buf[k + 1]);
+
+    vectors_update_unigrams(buf,sz,v);
+}
+
+/* Add the counts of src, which covers the bytes just after those of
+ * dst, to dst. dst must hold an even number of bytes so that src's
+ * bigram pairs line up with dst's. Only the bigram cells src touched
+ * are visited. */
+static void vectors_merge(sceadan_vectors_t *dst,const sceadan_vectors_t *src)
+{
+    if(src->mfv.uni_sz==0) return;
+    assert(dst->mfv.uni_sz % 2 == 0);
+
+    for(int i=0;i<n_unigram;i++) dst->ucv[i].tot += src->ucv[i].tot;
+    for(uint32_t i=0;i<src->n_bcv_touched;i++){
+        const bigram_t  b    = src->bcv_touched[i];
+        const unigram_t prev = b >> nbit_unigram;
+        const unigram_t next = b & (n_unigram - 1);
+        if(src->bcv[prev][next].tot) bcv_add_n(dst,prev,next,src->bcv[prev][next].tot);
+    }
+
+    mfv_t *d = &dst->mfv;
+    const mfv_t *m = &src->mfv;
+    d->hamming_weight.tot  += m->hamming_weight.tot;
+    d->byte_value.tot      += m->byte_value.tot;
+    d->stddev_byte_val.tot += m->stddev_byte_val.tot;
+    d->contiguity.tot      += m->contiguity.tot;
+    d->lo_ascii_freq.tot   += m->lo_ascii_freq.tot;
+    d->med_ascii_freq.tot  += m->med_ascii_freq.tot;
+    d->hi_ascii_freq.tot   += m->hi_ascii_freq.tot;
+
+    /* runs: dst's trailing run may continue into src's leading run */
+    sum_t streak = max(d->max_byte_streak.tot,m->max_byte_streak.tot);
+    if(d->uni_sz==0){
+        dst->first_cnt = src->first_cnt;
+        dst->first_val = src->first_val;
+        dst->last_cnt  = src->last_cnt;
+        dst->last_val  = src->last_val;
+    } else {
+        d->contiguity.tot += abs(src->first_val - dst->last_val);
+        if(dst->last_val==src->first_val){
+            streak = max(streak,dst->last_cnt + src->first_cnt);
+            if(dst->first_cnt==d->uni_sz) dst->first_cnt += src->first_cnt;
+            if(src->last_cnt==m->uni_sz){
+                dst->last_cnt += src->last_cnt;
+            } else {
+                dst->last_cnt = src->last_cnt;
+                dst->last_val = src->last_val;
+            }
+        } else {
+            dst->last_cnt = src->last_cnt;
+            dst->last_val = src->last_val;
+        }
+    }
+    d->max_byte_streak.tot = streak;
+    d->uni_sz += m->uni_sz;
+}
+
+/* c * log2(c) for the small counts that dominate block classification */
+#define CLOG2C_TABLE_SIZE 4096
+static double clog2c_table[CLOG2C_TABLE_SIZE];
+static pthread_once_t clog2c_once = PTHREAD_ONCE_INIT;
+
+static void clog2c_init(void)
+{
+    for(int c=1;c<CLOG2C_TABLE_SIZE;c++) clog2c_table[c] = c * log2(c);
+}
+
+static inline double clog2c(const sum_t c)
+{
+    return (c < CLOG2C_TABLE_SIZE) ? clog2c_table[c] : c * log2((double)c);
+}
+
+/* Drop the cells that have gone back to zero (a sliding window can do
+ * that) and sort the rest, so that the bigrams can be visited in
+ * ascending order in O(distinct bigrams). */
+static void bcv_sort_touched(sceadan_vectors_t *v)
 {
+    uint32_t n = 0;
+    for(uint32_t i=0;i<v->n_bcv_touched;i++){
+        const bigram_t b = v->bcv_touched[i];
+        if(v->bcv[b >> nbit_unigram][b & (n_unigram-1)].tot){
+            v->bcv_touched[n++] = b;
+        } else {
+            v->bcv_listed[b / 64] &= ~(1ULL << (b % 64));
+        }
+    }
+    v->n_bcv_touched = n;
+
+    bigram_t *a = v->bcv_touched;
+    if(n<64){                           /* insertion sort */
+        for(uint32_t i=1;i<n;i++){
+            const bigram_t b = a[i];
+            uint32_t j = i;
+            for(;j>0 && a[j-1]>b;j--) a[j] = a[j - 1];
+            a[j] = b;
+        }
+        return;
+    }
+    bigram_t *tmp = v->bcv_scratch;    /* LSD radix sort, low byte then high byte */
+    for(int shift=0;shift<nbit_bigram;shift+=8){
+        uint32_t count[257];
+        memset(count,0,sizeof(count));
+        for(uint32_t i=0;i<n;i++) count[((a[i] >> shift) & 0xff) + 1]++;
+        for(int k=0;k<256;k++) count[k + 1] += count[k];
+        for(uint32_t i=0;i<n;i++) tmp[count[(a[i] >> shift) & 0xff]++] = a[i];
+        bigram_t *t = a; a = tmp; tmp = t;
+    }
+}
+
+/* Σ p log2(1/p) / 16 over the bigram frequencies p = c/D, computed as
+ * (C log2 D - Σ c log2 c) / 16D so that each cell costs a table lookup.
+ * f->bfreq still holds the counts. */
+static double bigram_entropy(const struct sceadan_features *f,const double bdenom)
+{
+    if(bdenom<=0) return 0;
+    pthread_once(&clog2c_once,clog2c_init);
+    sum_t  total = 0;
+    double sum_clog2c = 0;
+    for(uint32_t i=0;i<f->n_bigrams;i++){
+        const sum_t c = (sum_t)f->bfreq[i];
+        total      += c;
+        sum_clog2c += clog2c(c);
+    }
+    return (total * log2(bdenom) - sum_clog2c) / (bdenom * nbit_bigram);
+}
+
+/* Compute f from the unigram counts, the running sums and the bigram
+ * counts, which the caller has put in f->bigram (ascending) and
+ * f->bfreq; they are turned into frequencies in place. */
+static void features_finalize (struct sceadan_features *f, const cv_e ucv[n_unigram], const mfv_t *mfv)
+{
+    mfv_t *fv = &f->fv;
+    *fv = *mfv;
+    const double bdenom = (double)(mfv->uni_sz / 2); // rounds down
+
+    // bigram entropy, over the bigrams that occur
+    fv->bigram_entropy = bigram_entropy(f, bdenom);
+    for (uint32_t i = 0; i < f->n_bigrams; i++) f->bfreq[i] /= bdenom;
+
     // hamming weight
-    v->mfv.hamming_weight.avg = (double) v->mfv.hamming_weight.tot / (v->mfv.uni_sz * nbit_unigram);
+    fv->hamming_weight.avg = (double) fv->hamming_weight.tot / (fv->uni_sz * nbit_unigram);
 
     // mean byte value
-    v->mfv.byte_value.avg = (double) v->mfv.byte_value.tot / v->mfv.uni_sz;
+    fv->byte_value.avg = (double) fv->byte_value.tot / fv->uni_sz;
 
     // average contiguity between bytes
-    v->mfv.contiguity.avg = (double) v->mfv.contiguity.tot / v->mfv.uni_sz;
+    fv->contiguity.avg = (double) fv->contiguity.tot / fv->uni_sz;
 
     // max byte streak
-    //v->mfv.max_byte_streak = max_cnt;
-    v->mfv.max_byte_streak.avg = (double) v->mfv.max_byte_streak.tot / v->mfv.uni_sz;
+    //fv->max_byte_streak = max_cnt;
+    fv->max_byte_streak.avg = (double) fv->max_byte_streak.tot / fv->uni_sz;
 
     // TODO skewness ?
     double expectancy_x3 = 0;
     double expectancy_x4 = 0;
 
-    const double central_tendency = v->mfv.byte_value.avg;
+    const double central_tendency = fv->byte_value.avg;
     for (int i = 0; i < n_unigram; i++) {
 
-        v->mfv.abs_dev += v->ucv[i].tot * fabs (i - central_tendency);
+        fv->abs_dev += ucv[i].tot * fabs (i - central_tendency);
 
         // unigram frequency
-        v->ucv[i].avg = (double) v->ucv[i].tot / v->mfv.uni_sz;
+        f->ufreq[i] = (double) ucv[i].tot / fv->uni_sz;
 
         // item entropy
-        double pv = v->ucv[i].avg;
+        double pv = f->ufreq[i];
         if (fabs(pv)>0) // TODO floating point mumbo jumbo
-            v->mfv.item_entropy += pv * log2 (1 / pv) / nbit_unigram; // more divisions for accuracy
-
-        for (int j = 0; j < n_unigram; j++) {
-
-            v->bcv[i][j].avg = (double) v->bcv[i][j].tot / (v->mfv.uni_sz / 2); // rounds down
+            fv->item_entropy += pv * log2 (1 / pv) / nbit_unigram; // more divisions for accuracy
 
-            // bigram entropy
-            pv = v->bcv[i][j].avg;
-            if (fabs(pv)>0) // TODO
-                v->mfv.bigram_entropy  += pv * log2 (1 / pv) / nbit_bigram;
-        }
 
-        const double extmp = __builtin_powi ((double) i, 3) * v->ucv[i].avg;
+        const double extmp = __builtin_powi ((double) i, 3) * f->ufreq[i];
 
         expectancy_x3 += extmp;        // for skewness
         expectancy_x4 += extmp * i;     // for kurtosis
     }
 
-    const double variance  = (double) v->mfv.stddev_byte_val.tot / v->mfv.uni_sz
-        - __builtin_powi (v->mfv.byte_value.avg, 2);
+    const double variance  = (double) fv->stddev_byte_val.tot / fv->uni_sz
+        - __builtin_powi (fv->byte_value.avg, 2);
 
-    v->mfv.stddev_byte_val.avg = sqrt (variance);
+    fv->stddev_byte_val.avg = sqrt (variance);
 
-    const double sigma3    = variance * v->mfv.stddev_byte_val.avg;
+    const double sigma3    = variance * fv->stddev_byte_val.avg;
     const double variance2 = __builtin_powi (variance, 2);
 
     // average absolute deviation
-    v->mfv.abs_dev /= v->mfv.uni_sz;
-    v->mfv.abs_dev /= n_unigram;
+    fv->abs_dev /= fv->uni_sz;
+    fv->abs_dev /= n_unigram;
 
     // skewness
-    v->mfv.skewness = (expectancy_x3
-                     - v->mfv.byte_value.avg * (3 * variance
-	                                      + __builtin_powi (v->mfv.byte_value.avg,
+    fv->skewness = (expectancy_x3
+                     - fv->byte_value.avg * (3 * variance
+	                                      + __builtin_powi (fv->byte_value.avg,
 	                                                        2))) / sigma3;
 
     // kurtosis
     assert(isinf(expectancy_x4)==0);
     assert(isinf(variance2)==0);
 
-    v->mfv.kurtosis = (expectancy_x4 / variance2);
-    v->mfv.byte_value.avg      /= n_unigram;
-    v->mfv.stddev_byte_val.avg /= n_unigram;
-    v->mfv.kurtosis            /= n_unigram;
-    v->mfv.contiguity.avg      /= n_unigram;
-    //v->mfv.bzip2_len.avg        = 1;
-    //v->mfv.lzw_len.avg          = 1;
-    v->mfv.lo_ascii_freq.avg  = (double) v->mfv.lo_ascii_freq.tot  / v->mfv.uni_sz;
-    v->mfv.med_ascii_freq.avg = (double) v->mfv.med_ascii_freq.tot / v->mfv.uni_sz;
-    v->mfv.hi_ascii_freq.avg  = (double) v->mfv.hi_ascii_freq.tot  / v->mfv.uni_sz;
+    fv->kurtosis = (expectancy_x4 / variance2);
+    fv->byte_value.avg      /= n_unigram;
+    fv->stddev_byte_val.avg /= n_unigram;
+    fv->kurtosis            /= n_unigram;
+    fv->contiguity.avg      /= n_unigram;
+    //fv->bzip2_len.avg        = 1;
+    //fv->lzw_len.avg          = 1;
+    fv->lo_ascii_freq.avg  = (double) fv->lo_ascii_freq.tot  / fv->uni_sz;
+    fv->med_ascii_freq.avg = (double) fv->med_ascii_freq.tot / fv->uni_sz;
+    fv->hi_ascii_freq.avg  = (double) fv->hi_ascii_freq.tot  / fv->uni_sz;
 }
 
 
-static int do_predict ( const struct model* model_ , const sceadan_vectors_t *v, struct feature_node *x )
+/* Compute v->f. The counts and running sums are left intact, so the
+ * vectors can keep being updated (or have bytes removed) after finalizing. */
+static void vectors_finalize(sceadan_vectors_t *v)
 {
-    int n;
-    int nr_feature=get_nr_feature(model_);
-    if(model_->bias>=0){
-        n=nr_feature+1;
-    } else {
-        n=nr_feature;
+    struct sceadan_features *f = &v->f;
+    bcv_sort_touched(v);
+    f->file_name = v->file_name;
+    f->n_bigrams = v->n_bcv_touched;
+    for(uint32_t i=0;i<v->n_bcv_touched;i++){
+        const bigram_t b = v->bcv_touched[i];
+        f->bigram[i] = b;
+        f->bfreq[i]  = (double)v->bcv[b >> nbit_unigram][b & (n_unigram - 1)].tot;
     }
-    
-    int i = 0;
-    
-    /* Add the unigrams to the vector */
-    for (int k = 0 ; k < n_unigram; k++, i++) {
-        x[i].index = i + 1;
-        x[i].value = v->ucv[k].avg;
+    features_finalize(f,v->ucv,&v->mfv);
+}
+
+
+/* number of weight columns per feature row; mirrors liblinear's predict_values() */
+static int model_nr_w(const struct model *model_)
+{
+    if(model_->nr_class==2 && model_->param.solver_type!=MCSVM_CS) return 1;
+    return model_->nr_class;
+}
+
+/* accumulate one feature row of model_'s weight matrix into the decision
+ * values; s->model may have quantized weights, cascade stages do not */
+static inline void score_row(const sceadan *s,const struct model *model_,int nr_w,int index,double value,double *dec_values)
+{
+    const size_t row = (size_t)(index-1) * nr_w;
+    if(s->qmodel && model_==s->model){
+        const size_t esize = (s->qmodel->quant==SCEADAN_QUANT_INT8) ? sizeof(int8_t) : sizeof(uint16_t);
+        (*s->score_row_q)((const uint8_t *)s->qmodel->q + row * esize,nr_w,value,dec_values);
+        return;
     }
-    
-    /* Add the bigrams to the vector */
-    for (int k = 0; k < n_unigram; k++)
-        for (int j = 0; j < n_unigram; j++) {
-            x[i].index = i + 1;
-            x[i].value = v->bcv[k][j].avg;
-            i++;
+    (*s->score_row)(model_->w + row,nr_w,value,dec_values);
+}
+
+/* turn the decision values into a label, the same way liblinear's predict() does */
+static int label_for_dec_values(const struct model *model_,const double *dec_values)
+{
+    if(model_->nr_class==2){
+        switch(model_->param.solver_type){
+        case L2R_L2LOSS_SVR:
+        case L2R_L2LOSS_SVR_DUAL:
+        case L2R_L1LOSS_SVR_DUAL:
+            return dec_values[0];
+        default:
+            return (dec_values[0]>0) ? model_->label[0] : model_->label[1];
         }
-    
+    }
+    int dec_max_idx = 0;
+    for(int i=1;i<model_->nr_class;i++){
+        if(dec_values[i]>dec_values[dec_max_idx]) dec_max_idx = i;
+    }
+    return model_->label[dec_max_idx];
+}
+
+/* Score the vectors against a linear model.
+ *
+ * Only nonzero unigram and bigram frequencies are visited, so the
+ * cost is O(nonzero features * classes) rather than O(65,792 * classes).
+ * Features are visited in ascending index order (unigrams 1..256,
+ * then bigrams 257..65792, then the bias), which is the order
+ * liblinear's predict() sums them in, so the decision values and
+ * the label are identical to the dense call. Features past the
+ * model's nr_feature (all the bigrams, for a unigram-only cascade
+ * stage) are skipped. dec_values has model_nr_w() entries.
+ */
+static void decision_values(const sceadan *s,const struct model *model_,const struct sceadan_features *f,double *dec_values)
+{
+    if(s->scorer_fn && model_==s->model && s->qmodel==0){
+        (*s->scorer_fn)(f->ufreq,f->n_bigrams,f->bigram,f->bfreq,dec_values);
+        return;
+    }
+
+    const int nr_feature = get_nr_feature(model_);
+    const int n  = (model_->bias>=0) ? nr_feature+1 : nr_feature;
+    const int nr_w = model_nr_w(model_);
+
+    for(int j=0;j<nr_w;j++) dec_values[j] = 0;
+
+    int i = 1;                          /* liblinear feature index */
+
+    /* Add the unigrams (then the bigrams start at feature 257) */
+    for(int k=0;k<n_unigram && i<=nr_feature;k++,i++){
+        if(f->ufreq[k]>0) score_row(s,model_,nr_w,i,f->ufreq[k],dec_values);
+    }
+
+    /* Add the bigrams, from the sorted list of those that occur */
+    for(uint32_t k=0;k<f->n_bigrams;k++){
+        const bigram_t b = f->bigram[k];
+        if(1+n_unigram+b>nr_feature) break;
+        score_row(s,model_,nr_w,1 + n_unigram + b,f->bfreq[k],dec_values);
+    }
+
     /* Add the Bias */
-    if(model_->bias>=0)    {
-        x[i].index = n;
-        x[i].value = model_->bias;
-        i++;
+    if(model_->bias>=0){
+        score_row(s,model_,nr_w,n,model_->bias,dec_values);
+    }
+
+    /* Dequantize the sums */
+    if(s->qmodel && model_==s->model){
+        for(int j=0;j<nr_w;j++) dec_values[j] *= s->qmodel->scale[j];
+    }
+}
+
+/* how far the winning class's decision value is ahead of the runner-up's */
+static double decision_margin(const struct model *model_,const double *dec_values)
+{
+    const int nr_w = model_nr_w(model_);
+    if(nr_w==1) return fabs(dec_values[0]);
+    double first = -INFINITY, second = -INFINITY;
+    for(int j=0;j<nr_w;j++){
+        if(dec_values[j]>first){
+            second = first;
+            first  = dec_values[j];
+        } else if(dec_values[j]>second){
+            second = dec_values[j];
+        }
     }
-    x[i].index = -1;                    /* end of vectors? */
-    return predict(model_,x);           /* run the predictor */
+    return first - second;
+}
+
+/* the label model_ gives f, and, if margin is not 0, by how much */
+static int model_predict(const sceadan *s,const struct model *model_,const struct sceadan_features *f,double *margin)
+{
+    double dec_values[model_nr_w(model_)];
+    decision_values(s,model_,f,dec_values);
+    if(margin) *margin = decision_margin(model_,dec_values);
+    return label_for_dec_values(model_,dec_values);
 }
 
+static int do_predict(const sceadan *s,const struct sceadan_features *f)
+{
+    return model_predict(s,s->model,f,0);
+}
 
-static void dump_vectors_as_json(const sceadan *s,const sceadan_vectors_t *v)
+
+static void dump_vectors_as_json(const sceadan *s,const struct sceadan_features *f)
 {
-    printf("{ \"file_type\": %d,\n",s->file_type);
-    if(v->file_name) printf("  \"file_name\": \"%s\",\n",v->file_name);
-    printf("  \"unigrams\": { \n");
+    fprintf(s->dump,"{ \"file_type\": %d,\n",s->file_type);
+    if(f->file_name) fprintf(s->dump,"  \"file_name\": \"%s\",\n",f->file_name);
+    fprintf(s->dump,"  \"unigrams\": { \n");
     int first = 1;
     for(int i=0;i<n_unigram;i++){
-        if(v->ucv[i].avg>0){
+        if(f->ufreq[i]>0){
             if(first) {
                 first = 0;
             } else {
-                printf(",\n");
+                fprintf(s->dump,",\n");
             }
-            printf("    \"%d\" : %.16lg",i,v->ucv[i].avg);
+            fprintf(s->dump,"    \"%d\" : %.16lg",i,f->ufreq[i]);
         }
     }
-    printf("  },\n");
-    printf("  \"bigrams:\": { \n");
+    fprintf(s->dump,"  },\n");
+    fprintf(s->dump,"  \"bigrams:\": { \n");
     first = 1;
-    for(int i=0;i<n_unigram;i++){
-        for(int j=0;j<n_unigram;j++){
-            if(v->bcv[i][j].avg>0){
-                if(first){
-                    first = 0;
-                } else {
-                    printf(",\n");
-                    first = 0;
-                }
-                printf("    \"%d\" : %.16lg",i<<8|j,v->bcv[i][j].avg);
-            }
+    for(uint32_t k=0;k<f->n_bigrams;k++){
+        if(first){
+            first = 0;
+        } else {
+            fprintf(s->dump,",\n");
         }
+        fprintf(s->dump,"    \"%d\" : %.16lg",f->bigram[k],f->bfreq[k]);
     }
-    printf("  }\n");
-#define OUTPUT(XXX) printf("  \"%s\": %.16lg,\n",#XXX,v->mfv.XXX)
+    fprintf(s->dump,"  }\n");
+#define OUTPUT(XXX) fprintf(s->dump,"  \"%s\": %.16lg,\n",#XXX,f->fv.XXX)
     OUTPUT(bigram_entropy);
     OUTPUT(item_entropy);
     OUTPUT(hamming_weight.avg);
@@ -554,9 +1197,23 @@ static void dump_vectors_as_json(const sceadan *s,const sceadan_vectors_t *v)
     OUTPUT(byte_val_correlation);
     OUTPUT(byte_val_freq_correlation);
     OUTPUT(uni_chi_sq);
-    printf("  \"version\":1.0\n");
+    fprintf(s->dump,"  \"version\":1.0\n");
+
+    fprintf(s->dump,"}\n");
+}
 
-    printf("}\n");
+/* the vectors as JSON, a libsvm line or a CSR row; write errors are
+ * the caller's to find, with ferror() or sceadan_csr_writer_close() */
+static void dump_vectors(const sceadan *s,const struct sceadan_features *f)
+{
+    const struct sceadan_export_vector v = {s->file_type,f->ufreq,f->n_bigrams,f->bigram,f->bfreq};
+    if(s->dump_csr){
+        sceadan_csr_writer_add(s->dump_csr,&v);
+    } else if(s->dump_format==SCEADAN_DUMP_LIBSVM){
+        sceadan_export_libsvm(s->dump,&v);
+    } else {
+        dump_vectors_as_json(s,f);
+    }
 }
 
 /* predict the vectors with a model and return the predicted type.
@@ -567,187 +1224,1599 @@ static void dump_vectors_as_json(const sceadan *s,const sceadan_vectors_t *v)
  * RANDOM. We consider those vectors abnormal and taken special care
  * of, instead of predicting. 
  */
-static int predict_liblin(const sceadan *s,const sceadan_vectors_t *v)
+/* the label for random or constant data, which is not scored against the model, or -1 */
+static int predict_by_rule(const struct sceadan_features *f)
 {
-    if(s->dump){                        /* dumping, not predicting */
-        dump_vectors_as_json(s,v);
-        return 0;
-    }
-
-    if (v->mfv.item_entropy > RANDOMNESS_THRESHOLD) {
+    if(f->fv.item_entropy>RANDOMNESS_THRESHOLD){
         return RAND;
     }
     
-    for (int i = 0; i < n_unigram; i++) {
+    /* The first constant bigram, in the sorted list. Row by row, the
+     * unigram is checked before the row's bigrams, so a constant
+     * unigram at or before that row wins. */
+    int bcv_row = n_unigram;
+    for(uint32_t k=0;k<f->n_bigrams;k++){
+        if(f->bfreq[k]>BCV_CONST_THRESHOLD){
+            bcv_row = f->bigram[k] >> nbit_unigram;
+            break;
+        }
+    }
+    for(int i=0;i<n_unigram && i<=bcv_row;i++){
         // TODO floating point comparison
-        if (v->ucv[i].avg > UCV_CONST_THRESHOLD) {
+        if(f->ufreq[i]>UCV_CONST_THRESHOLD){
             // previous programmer had an assignment here.
             // but there is no need, and that makes v non-const
             // slg
             //v->mfv.const_chr[0] = i;       
             return UCV_CONST;
         }
-        for (int j = 0; j < n_unigram; j++)
-            // previous programmer had an assignment here.
-            // but there is no need, and that makes v non-const
-            // slg
-            //v->mfv.const_chr[0] = i;       
-            if (v->bcv[i][j].avg > BCV_CONST_THRESHOLD) {
-                //v->mfv.const_chr[0] = i;
-                //v->mfv.const_chr[1] = j;
-                return BCV_CONST;
-            }
     }
-    
-    const int max_nr_attr = n_bigram + n_unigram + 3;//+ /*20*/ 17 /*6 + 2 + 9*/;
-    struct feature_node *x = (struct feature_node *) malloc(max_nr_attr*sizeof(struct feature_node));
-    int ret = do_predict(s->model,v, x);
-    free(x);
-    return ret;
+    if(bcv_row<n_unigram) return BCV_CONST;
+    return -1;
 }
 
+/* the label for data that is not scored against the model
+ * (dumped, random or constant), or -1 */
+static int predict_shortcut(const sceadan *s,struct sceadan_stats *st,const struct sceadan_features *f)
+{
+    if(s->dump || s->dump_csr){         /* dumping, not predicting */
+        dump_vectors(s,f);
+        return 0;
+    }
+    const int label = predict_by_rule(f);
+    STATS_EXIT(st,label);
+    return label;
+}
 
-struct model *model_ = 0;
-const struct model *sceadan_model_default()
+/* Classify with s->cascade: triage picks the family, and the family's
+ * model (if it has one) the label. Triage scores only the 256 unigram
+ * rows, and a family model has only its own classes' columns. If margin
+ * is not 0 it gets the margin of the model that decided. */
+static int cascade_predict(const sceadan *s,const struct sceadan_features *f,double *margin)
 {
-    if(model_==0){
-        model_=load_model(MODEL);
-        if(model_==0){
-            fprintf(stderr,"can't open model file %s\n","");
-            return 0;
-        }
+    const struct sceadan_cascade *c = s->cascade;
+    double tdec[model_nr_w(c->triage)];
+    decision_values(s,c->triage,f,tdec);
+    const int family = label_for_dec_values(c->triage,tdec);
+    const double tmargin = decision_margin(c->triage,tdec);
+    if(family<0 || family>=c->nfamilies || tmargin<c->min_margin){
+        return model_predict(s,s->model,f,margin);    /* triage is not sure */
     }
-    return model_;
+    const struct sceadan_cascade_family *fam = &c->family[family];
+    if(fam->model==0){
+        if(fam->label<0) return model_predict(s,s->model,f,margin);
+        if(margin) *margin = tmargin;
+        return fam->label;
+    }
+    return model_predict(s,fam->model,f,margin);
 }
 
-void sceadan_model_dump(const struct model *model)
+static int predict_liblin(const sceadan *s,struct sceadan_stats *st,const struct sceadan_features *f)
 {
-    puts("#include \"config.h\"");
-    puts("#ifdef HAVE_LINEAR_H");
-    puts("#include <linear.h>");
-    puts("#endif");
-    puts("#ifdef HAVE_LIBLINEAR_LINEAR_H");
-    puts("#include <liblinear/linear.h>");
-    puts("#endif");
-    puts("#include \"sceadan.h\"");
+    const int label = predict_shortcut(s,st,f);
+    if(label>=0) return label;
+    return s->cascade ? cascade_predict(s,f,0) : do_predict(s,f);
+}
 
-    if(model->param.nr_weight){
-        printf("static int weight_label[]={");
-        for(int i=0;i<model->param.nr_weight;i++){
-            if(i>0) putchar(',');
-            printf("%d",model->param.weight_label[i]);
-            if(i%10==9) printf("\n\t");
-        }
-        printf("};\n\n");
+
+/* Extract one block's features into ctx->v.f. A block small enough for
+ * the compact counters has its bigrams counted there rather than in
+ * ctx->v.bcv, whose 64-bit cells are sized for unbounded streams. */
+static void ctx_update(sceadan_ctx *ctx,const uint8_t *buf,size_t len)
+{
+    if(ctx->reference_update) vectors_update_ref(buf,len,&ctx->v);
+    else vectors_update(buf,len,&ctx->v);
+}
+
+static void ctx_extract(sceadan_ctx *ctx,const uint8_t *buf,size_t len)
+{
+    sceadan_vectors_t *v = &ctx->v;
+    STATS_CLOCK(c);
+    STATS_ADD(CTX_STATS(ctx),bytes,len);
+    vectors_reset(v);
+    if(len==0 || len>SCEADAN_COMPACT_MAX_BLOCK || ctx->reference_update){
+        ctx_update(ctx,buf,len);
+        STATS_LAP(CTX_STATS(ctx),c,SCEADAN_STAGE_UPDATE);
+        vectors_finalize(v);
+        STATS_LAP(CTX_STATS(ctx),c,SCEADAN_STAGE_FINALIZE);
+        return;
     }
-    if(model->param.nr_weight){
-        printf("static double weight[] = {");
-        for(int i=0;i<model->param.nr_weight;i++){
-            if(i>0) putchar(',');
-            printf("%g",model->param.weight[i]);
-            if(i%10==9) printf("\n\t");
-        }
-        printf("};\n\n");
+    const uint16_t *pairs;
+    const uint32_t *counts;
+    const int n = sceadan_compact_bigrams(ctx->compact,buf,len,&pairs,&counts);
+    vectors_update_unigrams(buf,len,v);
+
+    struct sceadan_features *f = &v->f;
+    f->file_name = 0;
+    f->n_bigrams = n;
+    for(int i=0;i<n;i++){
+        f->bigram[i] = pairs[i];
+        f->bfreq[i]  = counts[i];
     }
+    STATS_LAP(CTX_STATS(ctx),c,SCEADAN_STAGE_UPDATE);
+    features_finalize(f,v->ucv,&v->mfv);
+    STATS_LAP(CTX_STATS(ctx),c,SCEADAN_STAGE_FINALIZE);
+}
 
-    printf("static int label[] = {");
-    for(int i=0;i<model->nr_class;i++){
-        printf("%d",model->label[i]);
-        if(i<model->nr_class-1) putchar(',');
-        if(i%20==19) printf("\n\t");
+/*
+ * Batched scoring.
+ *
+ * Each block's nonzero features are listed as (feature, block, value)
+ * and the lists of the whole batch are sorted by feature with a
+ * stable radix sort. Scoring then walks the weight matrix once, in
+ * row order, applying each row to every block that has that feature
+ * while the row is still in cache. Every block still sums its rows in
+ * ascending feature order, exactly as do_predict() does, so the
+ * decision values are bit-identical.
+ */
+struct batch_feature {
+    uint32_t index;                     /* liblinear feature index */
+    uint32_t block;                     /* position in the tile */
+    double   value;
+};
+
+/* the most features a block of len bytes can have */
+static size_t batch_features_max(size_t len)
+{
+    const size_t uni = len < n_unigram ? len : n_unigram;
+    const size_t bi  = len/2 < n_bigram ? len/2 : n_bigram;
+    return uni + bi + 1;
+}
+
+/* list f's nonzero features in ascending order, as do_predict() visits them */
+static size_t batch_emit(const struct model *model_,const struct sceadan_features *f,
+                         uint32_t block,struct batch_feature *out)
+{
+    const int nr_feature = get_nr_feature(model_);
+    const int n = (model_->bias>=0) ? nr_feature+1 : nr_feature;
+    size_t nf = 0;
+    int i = 1;
+    for(int k=0;k<n_unigram && i<=nr_feature;k++,i++){
+        if(f->ufreq[k]>0) out[nf++] = (struct batch_feature){ i,block,f->ufreq[k] };
     }
-    printf("};\n");
+    for(uint32_t k=0;k<f->n_bigrams;k++){
+        const bigram_t b = f->bigram[k];
+        if(1+n_unigram+b>nr_feature) break;
+        out[nf++] = (struct batch_feature){ 1 + n_unigram + b,block,f->bfreq[k] };
+    }
+    if(model_->bias>=0) out[nf++] = (struct batch_feature){ n,block,model_->bias };
+    return nf;
+}
 
-    printf("static double w[] = {");
-    int n;
-    if(model->bias>=0){
-        n = model->nr_feature+1;
-    } else {
-        n = model->nr_feature;
+/* stable LSD radix sort by feature index, 9 then 9 bits */
+static void batch_sort(struct batch_feature *f,struct batch_feature *tmp,size_t nf)
+{
+    for(int shift=0;shift<18;shift+=9){
+        size_t count[513];
+        memset(count,0,sizeof(count));
+        for(size_t i=0;i<nf;i++) count[((f[i].index >> shift) & 511) + 1]++;
+        for(int b=0;b<512;b++) count[b+1] += count[b];
+        for(size_t i=0;i<nf;i++) tmp[count[(f[i].index >> shift) & 511]++] = f[i];
+        struct batch_feature *t = f; f = tmp; tmp = t;
     }
-    int w_size = n;
-    int nr_w;
-    if(model->nr_class==2 && model->param.solver_type != 4){
-        nr_w = 1;
-    } else {
-        nr_w = model->nr_class;
+    /* two passes: the sorted list is back in the caller's f */
+}
+
+static int classify_batch(sceadan_ctx *ctx,const uint8_t *const *bufs,const size_t *lens,size_t n,int *labels)
+{
+    const sceadan *s = ctx->s;
+    const int nr_w = model_nr_w(s->model);
+    for(size_t t=0;t<n;t+=SCEADAN_BATCH_TILE){
+        const size_t nt = (n-t < SCEADAN_BATCH_TILE) ? n-t : SCEADAN_BATCH_TILE;
+        size_t need = 0;
+        for(size_t b=0;b<nt;b++) need += batch_features_max(lens[t+b]);
+        if(need>ctx->feat_cap){
+            free(ctx->feat);
+            free(ctx->feat_tmp);
+            ctx->feat     = (struct batch_feature *)malloc(need * sizeof(struct batch_feature));
+            ctx->feat_tmp = (struct batch_feature *)malloc(need * sizeof(struct batch_feature));
+            ctx->feat_cap = need;
+            if(ctx->feat==0 || ctx->feat_tmp==0){
+                free(ctx->feat);
+                free(ctx->feat_tmp);
+                ctx->feat = ctx->feat_tmp = 0;
+                ctx->feat_cap = 0;
+                return -1;
+            }
+        }
+
+        /* extract the features of every block that needs scoring */
+        size_t nf = 0;
+        STATS_ADD(CTX_STATS(ctx),blocks,nt);
+        STATS_CLOCK(c);
+        for(size_t b=0;b<nt;b++){
+            ctx_extract(ctx,bufs[t+b],lens[t+b]);
+            STATS_RESTART(c);
+            labels[t+b] = predict_shortcut(s,CTX_STATS(ctx),&ctx->v.f);
+            if(labels[t+b]<0 && s->cascade) labels[t+b] = cascade_predict(s,&ctx->v.f,0);
+            if(labels[t+b]<0) nf += batch_emit(s->model,&ctx->v.f,(uint32_t)b,ctx->feat + nf);
+            STATS_LAP(CTX_STATS(ctx),c,SCEADAN_STAGE_PREDICT);
+        }
+        if(nf==0) continue;
+
+        /* score them row by row */
+        STATS_RESTART(c);
+        batch_sort(ctx->feat,ctx->feat_tmp,nf);
+        double dec_values[nt * nr_w];
+        memset(dec_values,0,sizeof(dec_values));
+        for(size_t i=0;i<nf;i++){
+            const struct batch_feature *f = &ctx->feat[i];
+            score_row(s,s->model,nr_w,f->index,f->value,dec_values + (size_t)f->block * nr_w);
+        }
+        for(size_t b=0;b<nt;b++){
+            if(labels[t+b]>=0) continue;
+            double *dec = dec_values + b * nr_w;
+            if(s->qmodel){
+                for(int j=0;j<nr_w;j++) dec[j] *= s->qmodel->scale[j];
+            }
+            labels[t+b] = label_for_dec_values(s->model,dec);
+        }
+        STATS_LAP(CTX_STATS(ctx),c,SCEADAN_STAGE_PREDICT);
     }
+    return 0;
+}
 
-    for(int i=0;i<w_size;i++){
-        for(int j=0;j<nr_w;j++){
-            printf("%.16lg",model->w[i*nr_w+j]);
-            if(i!=w_size-1 || j!=nr_w-1) putchar(',');
+/*
+ * The dedup stage. A block that is one byte repeated is labelled from
+ * the context's memo of such blocks; any other block is hashed and
+ * looked up in the dedup's LRU. Blocks that are dumped are never
+ * skipped.
+ */
+struct dedup_miss {
+    size_t   block;                     /* in the caller's batch */
+    bool     remember;                  /* whether dedup_put() is to be called */
+    int      fill;                      /* the byte, or -1 */
+    uint64_t hash;                      /* if not a fill */
+};
+
+static bool dedup_active(const sceadan_ctx *ctx,size_t len)
+{
+    return ctx->dedup && len > 0 && len <= UINT32_MAX && ctx->s->dump==0 && ctx->s->dump_csr==0;
+}
+
+/* the label of a block seen before, or -1 with m set up for dedup_put() */
+static int dedup_get(sceadan_ctx *ctx,const uint8_t *buf,size_t len,struct dedup_miss *m)
+{
+    STATS_ADD(CTX_STATS(ctx),dedup_blocks,1);
+    m->fill = sceadan_fill_byte(buf,len);
+    if(m->fill>=0){
+        if(ctx->fill_len[m->fill]!=len) return -1;
+        STATS_ADD(CTX_STATS(ctx),dedup_fill,1);
+        return ctx->fill_label[m->fill];
+    }
+    m->hash = sceadan_dedup_hash(ctx->dedup,buf,len);
+    const int label = sceadan_dedup_get(ctx->dedup,m->hash,len);
+    if(label>=0) STATS_ADD(CTX_STATS(ctx),dedup_hits,1);
+    return label;
+}
+
+static void dedup_put(sceadan_ctx *ctx,size_t len,const struct dedup_miss *m,int label)
+{
+    if(m->fill>=0){
+        ctx->fill_len[m->fill]   = len;
+        ctx->fill_label[m->fill] = label;
+        return;
+    }
+    sceadan_dedup_put(ctx->dedup,m->hash,len,label);
+}
+
+void sceadan_ctx_set_dedup(sceadan_ctx *ctx,sceadan_dedup *d)
+{
+    ctx->dedup = d;
+    memset(ctx->fill_len,0,sizeof(ctx->fill_len));
+}
+
+/* the blocks the dedup stage does not know are classified as one batch */
+int sceadan_ctx_classify_batch(sceadan_ctx *ctx,const uint8_t *const *bufs,const size_t *lens,size_t n,int *labels)
+{
+    if(ctx->dedup==0) return classify_batch(ctx,bufs,lens,n,labels);
+    if(n>ctx->miss_cap){
+        free(ctx->miss);
+        free(ctx->miss_buf);
+        free(ctx->miss_len);
+        free(ctx->miss_label);
+        ctx->miss       = (struct dedup_miss *)malloc(n * sizeof(*ctx->miss));
+        ctx->miss_buf   = (const uint8_t **)malloc(n * sizeof(*ctx->miss_buf));
+        ctx->miss_len   = (size_t *)malloc(n * sizeof(*ctx->miss_len));
+        ctx->miss_label = (int *)malloc(n * sizeof(*ctx->miss_label));
+        ctx->miss_cap   = n;
+        if(ctx->miss==0 || ctx->miss_buf==0 || ctx->miss_len==0 || ctx->miss_label==0){
+            ctx->miss_cap = 0;
+            return -1;
         }
-        printf("\n\t");
+    }
+    size_t nm = 0;
+    for(size_t i=0;i<n;i++){
+        struct dedup_miss *m = &ctx->miss[nm];
+        m->remember = dedup_active(ctx,lens[i]);
+        labels[i] = m->remember ? dedup_get(ctx,bufs[i],lens[i],m) : -1;
+        if(labels[i]>=0) continue;
+        m->block = i;
+        ctx->miss_buf[nm] = bufs[i];
+        ctx->miss_len[nm] = lens[i];
+        nm++;
+    }
+    if(nm && classify_batch(ctx,ctx->miss_buf,ctx->miss_len,nm,ctx->miss_label)) return -1;
+    for(size_t j=0;j<nm;j++){
+        const struct dedup_miss *m = &ctx->miss[j];
+        labels[m->block] = ctx->miss_label[j];
+        if(m->remember) dedup_put(ctx,lens[m->block],m,ctx->miss_label[j]);
+    }
+    return 0;
+}
+
+int sceadan_classify_batch(const sceadan *s,const uint8_t *const *bufs,const size_t *lens,size_t n,int *labels)
+{
+    sceadan_ctx *ctx = sceadan_ctx_create(s);
+    if(ctx==0) return -1;
+    const int r = sceadan_ctx_classify_batch(ctx,bufs,lens,n,labels);
+    sceadan_ctx_destroy(ctx);
+    return r;
+}
+
+
+struct model *model_ = 0;
+const struct model *sceadan_model_default()
+{
+    if(model_==0){
+        model_=load_model(MODEL);
+        if(model_==0){
+            fprintf(stderr,"can't open model file %s\n","");
+            return 0;
+        }
+    }
+    return model_;
+}
+
+/* includes shared by every precompiled model */
+static void model_dump_includes(void)
+{
+    puts("#include \"config.h\"");
+    puts("#include <stdint.h>");
+    puts("#ifdef HAVE_LINEAR_H");
+    puts("#include <linear.h>");
+    puts("#endif");
+    puts("#ifdef HAVE_LIBLINEAR_LINEAR_H");
+    puts("#include <liblinear/linear.h>");
+    puts("#endif");
+    puts("#include \"sceadan.h\"");
+}
+
+/* class weights and labels; the arrays' names start with prefix */
+static void model_dump_labels(const struct model *model,const char *prefix)
+{
+    if(model->param.nr_weight){
+        printf("static int %sweight_label[]={",prefix);
+        for(int i=0;i<model->param.nr_weight;i++){
+            if(i>0) putchar(',');
+            printf("%d",model->param.weight_label[i]);
+            if(i%10==9) printf("\n\t");
+        }
+        printf("};\n\n");
+    }
+    if(model->param.nr_weight){
+        printf("static double %sweight[] = {",prefix);
+        for(int i=0;i<model->param.nr_weight;i++){
+            if(i>0) putchar(',');
+            printf("%g",model->param.weight[i]);
+            if(i%10==9) printf("\n\t");
+        }
+        printf("};\n\n");
+    }
+
+    printf("static int %slabel[] = {",prefix);
+    for(int i=0;i<model->nr_class;i++){
+        printf("%d",model->label[i]);
+        if(i<model->nr_class-1) putchar(',');
+        if(i%20==19) printf("\n\t");
     }
     printf("};\n");
-        
-    printf("static struct model m = {\n");
+}
+
+/* the struct model itself, <prefix>m; w_name is the weight array, or "0" */
+static void model_dump_struct(const struct model *model,const char *prefix,const char *w_name)
+{
+    printf("static struct model %sm = {\n",prefix);
     printf("\t.param = {\n");
     printf("\t\t.solver_type=%d,\n",model->param.solver_type);
     printf("\t\t.eps = %g,\n",model->param.eps);
     printf("\t\t.C = %g,\n",model->param.C);
     printf("\t\t.nr_weight = %d,\n",model->param.nr_weight);
-    printf("\t\t.weight_label = %s,\n",model->param.nr_weight ? "weight_label" : "0");
-    printf("\t\t.weight = %s,\n",model->param.nr_weight ? "weight" : "0");
+    if(model->param.nr_weight){
+        printf("\t\t.weight_label = %sweight_label,\n",prefix);
+        printf("\t\t.weight = %sweight,\n",prefix);
+    } else {
+        printf("\t\t.weight_label = 0,\n");
+        printf("\t\t.weight = 0,\n");
+    }
     printf("\t\t.p = %g},\n",model->param.p);
 
     printf("\t.nr_class=%d,\n",model->nr_class);
     printf("\t.nr_feature=%d,\n",model->nr_feature);
-    printf("\t.w=w,\n");
-    printf("\t.label=label,\n");
+    printf("\t.w=%s,\n",w_name);
+    printf("\t.label=%slabel,\n",prefix);
     printf("\t.bias=%g};\n",model->bias);
+}
+
+/* number of rows in the weight matrix (features plus the bias) */
+static int model_w_size(const struct model *model)
+{
+    return (model->bias>=0) ? model->nr_feature+1 : model->nr_feature;
+}
+
+/* labels, weights <prefix>w and the struct <prefix>m */
+static void model_dump_model(const struct model *model,const char *prefix)
+{
+    model_dump_labels(model,prefix);
+
+    printf("static double %sw[] = {",prefix);
+    const int w_size = model_w_size(model);
+    const int nr_w   = model_nr_w(model);
+
+    for(int i=0;i<w_size;i++){
+        for(int j=0;j<nr_w;j++){
+            printf("%.16lg",model->w[i*nr_w+j]);
+            if(i!=w_size-1 || j!=nr_w-1) putchar(',');
+        }
+        printf("\n\t");
+    }
+    printf("};\n");
+
+    char w_name[64];
+    snprintf(w_name,sizeof(w_name),"%sw",prefix);
+    model_dump_struct(model,prefix,w_name);
+}
+
+static uint64_t model_fingerprint(const struct model *m,uint64_t h)
+{
+    const int dims[3] = {m->nr_class,m->nr_feature,m->param.solver_type};
+    h = sceadan_hash64(dims,sizeof(dims),h);
+    h = sceadan_hash64(&m->bias,sizeof(m->bias),h);
+    h = sceadan_hash64(m->label,m->nr_class*sizeof(int),h);
+    if(m->w) h = sceadan_hash64(m->w,(size_t)model_w_size(m)*model_nr_w(m)*sizeof(double),h);
+    return h;
+}
+
+/* model_fingerprint() of the model that compiling model_dump_model()'s
+ * output gives: the bias and every weight as printed and read back */
+static uint64_t model_printed_fingerprint(const struct model *model)
+{
+    const size_t count = (size_t)model_w_size(model)*model_nr_w(model);
+    double *w = (double *)malloc(count*sizeof(double));
+    if(w==0){ perror("malloc"); exit(1); }
+    char buf[64];
+    for(size_t i=0;i<count;i++){
+        snprintf(buf,sizeof(buf),"%.16lg",model->w[i]);
+        w[i] = strtod(buf,0);
+    }
+    struct model m = *model;
+    snprintf(buf,sizeof(buf),"%g",model->bias);
+    m.bias = strtod(buf,0);
+    m.w = w;
+    const uint64_t h = model_fingerprint(&m,0);
+    free(w);
+    return h;
+}
+
+void sceadan_model_dump(const struct model *model)
+{
+    model_dump_includes();
+    model_dump_model(model,"");
+    printf("const struct model *sceadan_model_precompiled(){return &m;}\n");
+    printf("uint64_t sceadan_model_precompiled_fingerprint(){return 0x%016" PRIx64 "ull;}\n",
+           model_printed_fingerprint(model));
+}
+
+/*
+ * Quantized models.
+ *
+ * Each class (weight column) j gets its own scale, chosen so that the
+ * largest |w| in the column maps to the top of the quantized range:
+ * 127 for int8, 32768 for fp16 (which keeps small weights clear of the
+ * half-precision subnormals). Scoring sums value * q and multiplies
+ * each decision value by its scale once at the end.
+ */
+struct sceadan_qmodel *sceadan_qmodel_create(const struct model *model,int quant)
+{
+    if(quant!=SCEADAN_QUANT_INT8 && quant!=SCEADAN_QUANT_FP16) return 0;
+    if(model==0 || model->w==0) return 0;
+
+    const int    w_size = model_w_size(model);
+    const int    nr_w   = model_nr_w(model);
+    const size_t count  = (size_t)w_size * nr_w;
+    const double top    = (quant==SCEADAN_QUANT_INT8) ? 127 : 32768;
+
+    /* one allocation: the struct, then the scales, then the weights */
+    const size_t esize   = (quant==SCEADAN_QUANT_INT8) ? sizeof(int8_t) : sizeof(uint16_t);
+    const size_t q_start = (sizeof(struct sceadan_qmodel) + nr_w * sizeof(float) + 63) & ~(size_t)63;
+    uint8_t *mem = (uint8_t *)calloc(q_start + count * esize,1);
+    if(mem==0) return 0;
+    struct sceadan_qmodel *qm = (struct sceadan_qmodel *)mem;
+    float *scale = (float *)(mem + sizeof(struct sceadan_qmodel));
+    void  *q     = mem + q_start;
+
+    for(int j=0;j<nr_w;j++){
+        double maxabs = 0;
+        for(size_t i=0;i<(size_t)w_size;i++){
+            maxabs = fmax(maxabs,fabs(model->w[i*nr_w+j]));
+        }
+        scale[j] = (maxabs>0) ? (float)(maxabs / top) : 1;
+        for(size_t i=0;i<(size_t)w_size;i++){
+            const double x = model->w[i*nr_w+j] / scale[j];
+            if(quant==SCEADAN_QUANT_INT8){
+                long r = lrint(x);
+                if(r >  127) r =  127;
+                if(r<-127) r = -127;
+                ((int8_t *)q)[i*nr_w+j] = (int8_t)r;
+            } else {
+                ((uint16_t *)q)[i*nr_w+j] = sceadan_half_from_float((float)x);
+            }
+        }
+    }
+    qm->model = model;
+    qm->quant = quant;
+    qm->scale = scale;
+    qm->q     = q;
+    return qm;
+}
+
+void sceadan_qmodel_free(struct sceadan_qmodel *qm)
+{
+    free(qm);
+}
+
+size_t sceadan_qmodel_size(const struct sceadan_qmodel *qm)
+{
+    const size_t esize = (qm->quant==SCEADAN_QUANT_INT8) ? sizeof(int8_t) : sizeof(uint16_t);
+    return (size_t)model_w_size(qm->model) * model_nr_w(qm->model) * esize;
+}
+
+void sceadan_qmodel_dump(const struct sceadan_qmodel *qm)
+{
+    const struct model *model = qm->model;
+    model_dump_includes();
+    model_dump_labels(model,"");
+
+    const int w_size = model_w_size(model);
+    const int nr_w   = model_nr_w(model);
+
+    printf("static const float scale[] = {");
+    for(int j=0;j<nr_w;j++){
+        printf("%.9g",qm->scale[j]);
+        if(j<nr_w-1) putchar(',');
+        if(j%10==9) printf("\n\t");
+    }
+    printf("};\n");
+
+    printf("static const %s q[] = {",(qm->quant==SCEADAN_QUANT_INT8) ? "int8_t" : "uint16_t");
+    for(int i=0;i<w_size;i++){
+        for(int j=0;j<nr_w;j++){
+            if(qm->quant==SCEADAN_QUANT_INT8){
+                printf("%d",((const int8_t *)qm->q)[i*nr_w+j]);
+            } else {
+                printf("0x%04x",((const uint16_t *)qm->q)[i*nr_w+j]);
+            }
+            if(i!=w_size-1 || j!=nr_w-1) putchar(',');
+        }
+        printf("\n\t");
+    }
+    printf("};\n");
 
+    model_dump_struct(model,"","0");    /* the double weights are not kept */
     printf("const struct model *sceadan_model_precompiled(){return &m;}\n");
+    printf("static struct sceadan_qmodel qm = {\n");
+    printf("\t.model=&m,\n");
+    printf("\t.quant=%d,\n",qm->quant);
+    printf("\t.scale=scale,\n");
+    printf("\t.q=q};\n");
+    printf("const struct sceadan_qmodel *sceadan_qmodel_precompiled(){return &qm;}\n");
+}
+
+/* overridden by a precompiled model that was written with mcompile -q */
+__attribute__((weak)) const struct sceadan_qmodel *sceadan_qmodel_precompiled(void)
+{
+    return 0;
+}
+
+/*
+ * Cascades.
+ *
+ * A spec file names the stage models, one per line:
+ *
+ *   triage <model file>               unigram-only model; its labels are family numbers
+ *   family <n> model <model file>     model over family n's classes
+ *   family <n> label <type>           family n is a single type, decided by triage alone
+ *   min_margin <x>                    below this triage margin, use the full model
+ *
+ * Blank lines and lines starting with # are ignored.
+ */
+/* what sceadan_cascade_load() returns: the cascade and the models it owns */
+struct cascade_owned {
+    struct sceadan_cascade c;           /* first, so a pointer to it is a pointer to this */
+    struct sceadan_cascade_family *family;
+    struct model *triage;
+    struct model **models;              /* per family, or 0 */
+};
+
+/* make room for family n */
+static bool cascade_grow(struct cascade_owned *o,int n)
+{
+    if(n<o->c.nfamilies) return true;
+    struct sceadan_cascade_family *family = (struct sceadan_cascade_family *)
+        realloc(o->family,(n+1)*sizeof(*family));
+    if(family) o->family = family;
+    struct model **models = (struct model **)realloc(o->models,(n+1)*sizeof(*models));
+    if(models) o->models = models;
+    if(family==0 || models==0) return false;
+    for(int i=o->c.nfamilies;i<=n;i++){
+        family[i] = (struct sceadan_cascade_family){0,-1};
+        models[i] = 0;
+    }
+    o->c.nfamilies = n+1;
+    o->c.family = family;
+    return true;
+}
+
+struct sceadan_cascade *sceadan_cascade_load(const char *spec)
+{
+    FILE *f = fopen(spec,"r");
+    if(f==0) return 0;
+    struct cascade_owned *o = (struct cascade_owned *)calloc(1,sizeof(struct cascade_owned));
+    char line[4096];
+    int lineno = 0;
+    bool ok = (o!=0);
+    while(ok && fgets(line,sizeof(line),f)){
+        lineno++;
+        char word[32],kind[32],arg[4000];
+        int n;
+        double x;
+        if(line[0]=='#' || sscanf(line,"%31s",word)!=1) continue;
+        if(sscanf(line,"triage %3999s",arg)==1 && o->triage==0){
+            o->triage = load_model(arg);
+            o->c.triage = o->triage;
+            ok = (o->triage!=0);
+        } else if(sscanf(line,"min_margin %lf",&x)==1){
+            o->c.min_margin = x;
+        } else if(sscanf(line,"family %d %31s %3999s",&n,kind,arg)==3 && n>=0 && n<1024 && cascade_grow(o,n)){
+            if(strcmp(kind,"model")==0 && o->models[n]==0){
+                o->models[n] = load_model(arg);
+                o->family[n].model = o->models[n];
+                ok = (o->models[n]!=0);
+            } else if(strcmp(kind,"label")==0){
+                o->family[n].label = sceadan_type_for_name(arg);
+                if(o->family[n].label<0){   /* or a type number */
+                    char *end;
+                    const long v = strtol(arg,&end,10);
+                    ok = (*end==0 && v>=0 && v<INT32_MAX);
+                    o->family[n].label = (int)v;
+                }
+            } else {
+                ok = false;
+            }
+        } else {
+            ok = false;
+        }
+        if(!ok) fprintf(stderr,"%s:%d: cannot use: %s",spec,lineno,line);
+    }
+    fclose(f);
+    if(ok && o->triage==0){
+        fprintf(stderr,"%s: no triage model\n",spec);
+        ok = false;
+    }
+    if(!ok){
+        sceadan_cascade_free(o ? &o->c : 0);
+        return 0;
+    }
+    return &o->c;
+}
+
+void sceadan_cascade_free(struct sceadan_cascade *c)
+{
+    struct cascade_owned *o = (struct cascade_owned *)c;
+    if(o==0) return;
+    if(o->triage) free_and_destroy_model(&o->triage);
+    for(int i=0;i<o->c.nfamilies;i++){
+        if(o->models[i]) free_and_destroy_model(&o->models[i]);
+    }
+    free(o->family);
+    free(o->models);
+    free(o);
+}
+
+/* The stage models, then the cascade and sceadan_cascade_precompiled().
+ * Written after a model dump, so that the two make one source file. */
+void sceadan_cascade_dump(const struct sceadan_cascade *c)
+{
+    model_dump_model(c->triage,"triage_");
+    for(int i=0;i<c->nfamilies;i++){
+        if(c->family[i].model==0) continue;
+        char prefix[32];
+        snprintf(prefix,sizeof(prefix),"family%d_",i);
+        model_dump_model(c->family[i].model,prefix);
+    }
+    printf("static const struct sceadan_cascade_family cascade_family[] = {\n");
+    for(int i=0;i<c->nfamilies;i++){
+        if(c->family[i].model) printf("\t{&family%d_m,%d},\n",i,c->family[i].label);
+        else printf("\t{0,%d},\n",c->family[i].label);
+    }
+    printf("};\n");
+    printf("static const struct sceadan_cascade cascade = {\n");
+    printf("\t.triage=&triage_m,\n");
+    printf("\t.nfamilies=%d,\n",c->nfamilies);
+    printf("\t.family=cascade_family,\n");
+    if(isinf(c->min_margin)) printf("\t.min_margin=__builtin_inf()};\n");
+    else printf("\t.min_margin=%.17g};\n",c->min_margin);
+    printf("const struct sceadan_cascade *sceadan_cascade_precompiled(){return &cascade;}\n");
+}
+
+/* The header sceadan_scorer.cpp specializes its scorer for: the model's
+ * dimensions as constants, and its weights with each row padded to
+ * whole 64-byte lines. The numbers are printed as model_dump_model()
+ * prints them, so they match the precompiled model's. */
+void sceadan_scorer_dump(const struct model *model)
+{
+    const int w_size   = model_w_size(model);
+    const int nr_w     = model_nr_w(model);
+    const int padded_w = (nr_w + 7) & ~7;
+
+    puts("// generated by mcompile -x; see sceadan_scorer.cpp");
+    puts("namespace specialized {");
+    printf("constexpr int nr_class = %d;\n",model->nr_class);
+    printf("constexpr int nr_feature = %d;\n",model->nr_feature);
+    printf("constexpr int nr_w = %d;\n",nr_w);
+    printf("constexpr int padded_w = %d;\n",padded_w);
+    printf("constexpr int w_size = %d;\n",w_size);
+    printf("constexpr double bias = %g;\n",model->bias);
+    printf("constexpr uint64_t fingerprint = 0x%016" PRIx64 "ull;\n",model_printed_fingerprint(model));
+    printf("constexpr int label[nr_class] = {");
+    for(int i=0;i<model->nr_class;i++){
+        printf("%d",model->label[i]);
+        if(i<model->nr_class-1) putchar(',');
+        if(i%20==19) printf("\n\t");
+    }
+    printf("};\n");
+    printf("alignas(64) const double w[w_size][padded_w] = {\n");
+    for(int i=0;i<w_size;i++){
+        putchar('{');
+        for(int j=0;j<padded_w;j++){
+            if(j>0) putchar(',');
+            if(j<nr_w) printf("%.16lg",model->w[(size_t)i*nr_w+j]);
+            else putchar('0');
+        }
+        printf("},\n");
+    }
+    printf("};\n");
+    puts("}");
+}
+
+/* overridden by a precompiled model that was written with mcompile -c */
+__attribute__((weak)) const struct sceadan_cascade *sceadan_cascade_precompiled(void)
+{
+    return 0;
+}
+
+/* overridden by a precompiled model that was written with mcompile */
+__attribute__((weak)) uint64_t sceadan_model_precompiled_fingerprint(void)
+{
+    return 0;
+}
+
+/* likewise the scorer, from sceadan_scorer.cpp when mcompile -x made its header */
+__attribute__((weak)) const struct sceadan_scorer *sceadan_scorer_precompiled(void)
+{
+    return 0;
+}
+
+void sceadan_set_cascade(sceadan *s,const struct sceadan_cascade *c)
+{
+    s->cascade = c;
+}
+
+/* The scorer must have been generated from this very model: the same
+ * dimensions, labels and (unpadded) weights, which mcompile -x records
+ * as a fingerprint. The precompiled model's fingerprint was recorded
+ * when it was written, so opening it hashes nothing. */
+int sceadan_set_scorer(sceadan *s,const struct sceadan_scorer *sc)
+{
+    if(sc==0){
+        s->scorer = 0;
+        s->scorer_fn = 0;
+        return 0;
+    }
+    const struct model *m = s->model;
+    if(m->w==0 || sc->nr_class!=m->nr_class || sc->nr_feature!=m->nr_feature) return -1;
+    uint64_t h = 0;
+    if(m==sceadan_model_precompiled()) h = sceadan_model_precompiled_fingerprint();
+    if(h==0) h = model_fingerprint(m,0);
+    if(h!=sc->fingerprint) return -1;
+    s->scorer = sc;
+    s->scorer_fn = sc->fn[s->isa] ? sc->fn[s->isa] : sc->fn[SCEADAN_ISA_SCALAR];
+    return 0;
 }
 
 
 sceadan *sceadan_open(const char *model_name) // use 0 for default model
 {
     sceadan *s = (sceadan *)calloc(sizeof(sceadan),1);
+#ifdef SCEADAN_STATS
+    s->stats = (struct sceadan_stats *)calloc(1,sizeof(struct sceadan_stats));
+    if(s->stats==0){
+        free(s);
+        return 0;
+    }
+#endif
+    sceadan_set_isa(s,sceadan_isa_best());
+    if(model_name && sceadan_modelfile_is(model_name)){ /* mapped, not parsed */
+        s->file = sceadan_modelfile_open(model_name);
+        const struct sceadan_qmodel *qm = s->file ? sceadan_modelfile_qmodel(s->file) : 0;
+        if(s->file==0 || (qm && sceadan_set_qmodel(s,qm))){
+            sceadan_modelfile_close(s->file);
+            free(s->stats);
+            free(s);
+            return 0;
+        }
+        if(qm==0) s->model = sceadan_modelfile_model(s->file);
+        return s;
+    }
     if(model_name){
         s->model = load_model(model_name);
         if(s->model==0){
+            free(s->stats);
             free(s);
             return 0;
         }
         return s;
     }
     s->model = sceadan_model_precompiled();
+    if(sceadan_qmodel_precompiled()){
+        sceadan_set_qmodel(s,sceadan_qmodel_precompiled());
+    }
+    s->cascade = sceadan_cascade_precompiled();
+    if(sceadan_scorer_precompiled()){
+        sceadan_set_scorer(s,sceadan_scorer_precompiled()); /* unless it is stale */
+    }
     return s;
 }
 
+int sceadan_set_qmodel(sceadan *s,const struct sceadan_qmodel *qm)
+{
+    if(qm==0){
+        if(s->model->w==0) return -1;   /* precompiled quantized: nothing to go back to */
+        s->qmodel = 0;
+        s->score_row_q = 0;
+        return 0;
+    }
+    sceadan_score_row_q_t fn = sceadan_score_row_q_kernel(s->isa,qm->quant);
+    if(fn==0) return -1;
+    s->model = qm->model;
+    s->qmodel = qm;
+    s->score_row_q = fn;
+    return 0;
+}
+
+int sceadan_set_isa(sceadan *s,int isa)
+{
+    sceadan_score_row_t fn = sceadan_score_row_kernel(isa);
+    if(fn==0) return -1;
+    s->isa = isa;
+    s->score_row = fn;
+    if(s->scorer){
+        s->scorer_fn = s->scorer->fn[isa] ? s->scorer->fn[isa] : s->scorer->fn[SCEADAN_ISA_SCALAR];
+    }
+    if(s->qmodel){
+        s->score_row_q = sceadan_score_row_q_kernel(isa,s->qmodel->quant);
+    }
+    return 0;
+}
+
+int sceadan_write_model(const sceadan *s,const char *fname)
+{
+    return sceadan_modelfile_write(fname,s->model,s->qmodel);
+}
+
+/* Everything that decides a label: the model, whichever weights score
+ * it, the cascade, the rules' thresholds and the version of the code. */
+uint64_t sceadan_fingerprint(const sceadan *s)
+{
+    static const double thresholds[3] = {RANDOMNESS_THRESHOLD,UCV_CONST_THRESHOLD,BCV_CONST_THRESHOLD};
+    uint64_t h = sceadan_hash64(PACKAGE_VERSION,strlen(PACKAGE_VERSION),0);
+    h = sceadan_hash64(thresholds,sizeof(thresholds),h);
+    h = model_fingerprint(s->model,h);
+    if(s->qmodel){
+        const int quant = s->qmodel->quant;
+        h = sceadan_hash64(&quant,sizeof(quant),h);
+        h = sceadan_hash64(s->qmodel->scale,model_nr_w(s->model)*sizeof(float),h);
+        h = sceadan_hash64(s->qmodel->q,sceadan_qmodel_size(s->qmodel),h);
+    }
+    const struct sceadan_cascade *c = s->cascade;
+    if(c){
+        h = model_fingerprint(c->triage,h);
+        h = sceadan_hash64(&c->min_margin,sizeof(c->min_margin),h);
+        for(int i=0;i<c->nfamilies;i++){
+            if(c->family[i].model) h = model_fingerprint(c->family[i].model,h);
+            else h = sceadan_hash64(&c->family[i].label,sizeof(int),h);
+        }
+    }
+    return h;
+}
+
 void sceadan_close(sceadan *s)
 {
+    sceadan_modelfile_close(s->file);
+    free(s->stats);
     memset(s,0,sizeof(*s));             /* clean object re-use */
     free(s);
 }
 
+void sceadan_stats_add(struct sceadan_stats *dst,const struct sceadan_stats *src)
+{
+    dst->bytes           += src->bytes;
+    dst->blocks          += src->blocks;
+    dst->rand_exits      += src->rand_exits;
+    dst->ucv_const_exits += src->ucv_const_exits;
+    dst->bcv_const_exits += src->bcv_const_exits;
+    dst->dedup_blocks    += src->dedup_blocks;
+    dst->dedup_fill      += src->dedup_fill;
+    dst->dedup_hits      += src->dedup_hits;
+    dst->perf            |= src->perf;
+    for(int i=0;i<SCEADAN_NSTAGES;i++){
+        dst->ns[i]           += src->ns[i];
+        dst->cycles[i]       += src->cycles[i];
+        dst->instructions[i] += src->instructions[i];
+        dst->cache_misses[i] += src->cache_misses[i];
+    }
+}
+
+int sceadan_get_stats(const sceadan *s,struct sceadan_stats *out)
+{
+    memset(out,0,sizeof(*out));
+#ifdef SCEADAN_STATS
+    pthread_mutex_lock(&stats_lock);
+    *out = *s->stats;
+    pthread_mutex_unlock(&stats_lock);
+    return 0;
+#else
+    (void)s;
+    return -1;
+#endif
+}
+
+int sceadan_ctx_get_stats(const sceadan_ctx *ctx,struct sceadan_stats *out)
+{
+#ifdef SCEADAN_STATS
+    *out = ctx->stats;
+    return 0;
+#else
+    (void)ctx;
+    memset(out,0,sizeof(*out));
+    return -1;
+#endif
+}
+
+/* The vectors of the one-shot classifiers, which are too big for the
+ * stack: one set per thread, allocated on first use, cleared like a
+ * context's between uses and freed when the thread exits. */
+static __thread sceadan_vectors_t *thread_v = 0;
+static pthread_key_t thread_v_key;
+static pthread_once_t thread_v_once = PTHREAD_ONCE_INIT;
+
+static void thread_v_key_create(void)
+{
+    pthread_key_create(&thread_v_key,free);
+}
+
+static sceadan_vectors_t *thread_vectors(void)
+{
+    if(thread_v){
+        vectors_reset(thread_v);
+        return thread_v;
+    }
+    sceadan_vectors_t *v = (sceadan_vectors_t *)calloc(1,sizeof(sceadan_vectors_t));
+    if(v==0) return 0;
+    pthread_once(&thread_v_once,thread_v_key_create);
+    pthread_setspecific(thread_v_key,v);
+    return thread_v = v;
+}
+
 int sceadan_classify_buf(const sceadan *s,const uint8_t *buf,size_t bufsize)
 {
-    sceadan_vectors_t v;
-    memset(&v,0,sizeof(v));
-    vectors_update (buf, bufsize, &v);
-    vectors_finalize(&v);
-    return predict_liblin(s,&v);
+    STATS_LOCAL(st);
+    STATS_CLOCK(c);
+    sceadan_vectors_t *v = thread_vectors();
+    if(v==0) return -1;
+    vectors_update(buf,bufsize,v);
+    STATS_LAP(st,c,SCEADAN_STAGE_UPDATE);
+    vectors_finalize(v);
+    STATS_LAP(st,c,SCEADAN_STAGE_FINALIZE);
+    const int label = predict_liblin(s,st,&v->f);
+    STATS_LAP(st,c,SCEADAN_STAGE_PREDICT);
+    STATS_ADD(st,bytes,bufsize);
+    STATS_ADD(st,blocks,1);
+    STATS_MERGE(s,st);
+    return label;
+}
+
+/*
+ * Reusable classification context.
+ *
+ * The context owns its vectors, allocated once. Each classification
+ * clears only the counters the previous one touched, so classifying a
+ * stream of blocks does no heap allocation and clears O(block) memory.
+ */
+sceadan_ctx *sceadan_ctx_create(const sceadan *s)
+{
+    sceadan_ctx *ctx = (sceadan_ctx *)calloc(1,sizeof(sceadan_ctx));
+    if(ctx==0) return 0;
+    ctx->s = s;
+    ctx->compact = sceadan_compact_create();
+    if(ctx->compact==0){
+        free(ctx);
+        return 0;
+    }
+    return ctx;
+}
+
+void sceadan_ctx_reset(sceadan_ctx *ctx)
+{
+    vectors_reset(&ctx->v);
+}
+
+int sceadan_ctx_classify(sceadan_ctx *ctx,const uint8_t *buf,size_t bufsize)
+{
+    struct dedup_miss m;
+    const bool dedup = dedup_active(ctx,bufsize);
+    if(dedup){
+        const int label = dedup_get(ctx,buf,bufsize,&m);
+        if(label>=0) return label;
+    }
+    ctx_extract(ctx,buf,bufsize);
+    STATS_CLOCK(c);
+    const int label = predict_liblin(ctx->s,CTX_STATS(ctx),&ctx->v.f);
+    STATS_LAP(CTX_STATS(ctx),c,SCEADAN_STAGE_PREDICT);
+    STATS_ADD(CTX_STATS(ctx),blocks,1);
+    if(dedup) dedup_put(ctx,bufsize,&m,label);
+    return label;
+}
+
+/*
+ * Streaming classification. The vectors carry the state that spans
+ * buffers (the last byte, the current run and the bigram parity), so
+ * an object can be fed in pieces of any size and produces the same
+ * features as if it had been classified in one buffer.
+ */
+void sceadan_stream_begin(sceadan_ctx *ctx)
+{
+    vectors_reset(&ctx->v);
+}
+
+void sceadan_stream_update(sceadan_ctx *ctx,const uint8_t *buf,size_t bufsize)
+{
+    STATS_CLOCK(c);
+    ctx_update(ctx,buf,bufsize);
+    STATS_LAP(CTX_STATS(ctx),c,SCEADAN_STAGE_UPDATE);
+    STATS_ADD(CTX_STATS(ctx),bytes,bufsize);
+}
+
+void sceadan_ctx_reference_update(sceadan_ctx *ctx,int on)
+{
+    ctx->reference_update = on;
+}
+
+int sceadan_stream_finalize(sceadan_ctx *ctx)
+{
+    STATS_CLOCK(c);
+    vectors_finalize(&ctx->v);
+    STATS_LAP(CTX_STATS(ctx),c,SCEADAN_STAGE_FINALIZE);
+    const int label = predict_liblin(ctx->s,CTX_STATS(ctx),&ctx->v.f);
+    STATS_LAP(CTX_STATS(ctx),c,SCEADAN_STAGE_PREDICT);
+    STATS_ADD(CTX_STATS(ctx),blocks,1);
+    return label;
+}
+
+void sceadan_stream_features(sceadan_ctx *ctx)
+{
+    vectors_finalize(&ctx->v);
+}
+
+int sceadan_stream_rules(sceadan_ctx *ctx)
+{
+    return predict_by_rule(&ctx->v.f);
+}
+
+int sceadan_stream_score(sceadan_ctx *ctx)
+{
+    return do_predict(ctx->s,&ctx->v.f);
+}
+
+static void window_free(struct sceadan_window *w);
+static void multires_free(struct sceadan_multires *mr);
+
+void sceadan_ctx_destroy(sceadan_ctx *ctx)
+{
+    STATS_MERGE(ctx->s,CTX_STATS(ctx));
+    window_free(ctx->win);
+    multires_free(ctx->mr);
+    free(ctx->feat);
+    free(ctx->feat_tmp);
+    free(ctx->miss);
+    free(ctx->miss_buf);
+    free(ctx->miss_len);
+    free(ctx->miss_label);
+    sceadan_compact_destroy(ctx->compact);
+    free(ctx);
+}
+
+/*
+ * Sliding-window classification.
+ *
+ * The window's vectors are kept up to date incrementally: when the
+ * window advances by step bytes, the step oldest bytes are taken out
+ * of the unigram and bigram counts and the running sums, and the step
+ * new bytes are added, so each window costs O(step) to update rather
+ * than O(window). Bigrams are the non-overlapping pairs at even
+ * offsets, so window and step must be even to keep the pairing fixed.
+ *
+ * The longest run of repeated bytes is not additive. It is tracked
+ * with a queue of the runs in the window and a monotonic deque of the
+ * runs that could still be the longest, which is amortized O(1) per
+ * byte.
+ */
+struct sceadan_window {
+    size_t   window;
+    size_t   step;
+    uint8_t *ring;                      /* the bytes in the window, oldest at ring_head */
+    size_t   ring_head;
+    size_t   fill;                      /* bytes in the ring */
+    uint8_t *pending;                   /* the next step's bytes, while the window is full */
+    size_t   npending;
+    size_t   skip;                      /* bytes to discard before the next window (step > window) */
+    uint64_t offset;                    /* stream offset of the first byte in the window */
+    uint64_t pos;                       /* stream offset of the next byte to arrive */
+    bool     emitted;                   /* at least one window has been classified */
+
+    /* runs of repeated bytes, by sequence number; index is seq % nruns */
+    size_t    nruns;
+    uint64_t *run_start;
+    uint64_t *run_len;
+    uint64_t  run_first;                /* oldest run still in the window */
+    uint64_t  run_end;                  /* one past the newest run */
+    uint8_t   run_byte;                 /* byte value of the newest run */
+    uint64_t *dq;                       /* runs in order, with strictly decreasing lengths */
+    uint64_t  dq_first;
+    uint64_t  dq_end;
+};
+
+static void window_free(struct sceadan_window *w)
+{
+    if(w==0) return;
+    free(w->ring);
+    free(w->pending);
+    free(w->run_start);
+    free(w->run_len);
+    free(w->dq);
+    free(w);
+}
+
+#define RUN_LEN(w,seq) ((w)->run_len[(seq) % (w)->nruns])
+
+static void runs_add(struct sceadan_window *w,uint64_t pos,uint8_t b)
+{
+    uint64_t r;
+    if(w->run_end>w->run_first && b==w->run_byte){
+        r = w->run_end - 1;
+        RUN_LEN(w,r)++;
+        if(w->dq_end>w->dq_first && w->dq[(w->dq_end-1)%w->nruns]==r) w->dq_end--;
+    } else {
+        r = w->run_end++;
+        w->run_start[r % w->nruns] = pos;
+        RUN_LEN(w,r) = 1;
+        w->run_byte = b;
+    }
+    while(w->dq_end>w->dq_first && RUN_LEN(w,w->dq[(w->dq_end-1)%w->nruns])<=RUN_LEN(w,r)){
+        w->dq_end--;
+    }
+    w->dq[w->dq_end++ % w->nruns] = r;
+}
+
+/* forget the runs that end before the window starts */
+static void runs_drop(struct sceadan_window *w)
+{
+    while(w->run_end>w->run_first
+           && w->run_start[w->run_first%w->nruns]+RUN_LEN(w,w->run_first)<=w->offset){
+        if(w->dq_end>w->dq_first && w->dq[w->dq_first%w->nruns]==w->run_first) w->dq_first++;
+        w->run_first++;
+    }
+}
+
+/* longest run inside the window; the oldest run may be cut off by the window start */
+static sum_t runs_max(const struct sceadan_window *w)
+{
+    if(w->dq_end==w->dq_first) return 0;
+    const uint64_t front = w->dq[w->dq_first % w->nruns];
+    if(front!=w->run_first) return RUN_LEN(w,front);
+    const sum_t clipped = w->run_start[front % w->nruns] + RUN_LEN(w,front) - w->offset;
+    const sum_t next = (w->dq_end - w->dq_first > 1) ? RUN_LEN(w,w->dq[(w->dq_first + 1) % w->nruns]) : 0;
+    return max(clipped,next);
+}
+
+/* append bytes to the window's vectors, ring and runs */
+static void window_add(sceadan_vectors_t *v,struct sceadan_window *w,const uint8_t *buf,size_t n)
+{
+    vectors_update(buf,n,v);
+    for(size_t i=0;i<n;i++){
+        w->ring[(w->ring_head + w->fill + i) % w->window] = buf[i];
+        runs_add(w,w->pos + i,buf[i]);
+    }
+    w->fill += n;
+    w->pos  += n;
+}
+
+/* take the n oldest bytes (n even, n < fill) out of the window's vectors */
+static void window_remove(sceadan_vectors_t *v,struct sceadan_window *w,size_t n)
+{
+    size_t i = w->ring_head;
+    for(size_t k=0;k<n;k++){
+        const unigram_t b    = w->ring[i];
+        const size_t    inext = (i + 1 == w->window) ? 0 : i + 1;
+        const unigram_t next = w->ring[inext];    /* still in the window, since n < fill */
+
+        v->ucv[b].tot--;
+        v->mfv.contiguity.tot -= abs(next - b);
+        if(k%2==0) v->bcv[b][next].tot--;
+        v->mfv.hamming_weight.tot  -= (nbit_unigram - __builtin_popcount(b));
+        v->mfv.byte_value.tot      -= b;
+        v->mfv.stddev_byte_val.tot -= (sum_t)b * b;
+        if      (b < ASCII_LO_VAL) v->mfv.lo_ascii_freq.tot--;
+        else if(b<ASCII_HI_VAL) v->mfv.med_ascii_freq.tot--;
+        else                       v->mfv.hi_ascii_freq.tot--;
+        i = inext;
+    }
+    w->ring_head = i;
+    w->fill     -= n;
+    w->offset   += n;
+    v->mfv.uni_sz -= n;
+    runs_drop(w);
+}
+
+static void window_classify(sceadan_ctx *ctx,sceadan_window_cb cb,void *arg)
+{
+    struct sceadan_window *w = ctx->win;
+    STATS_CLOCK(c);
+    ctx->v.mfv.max_byte_streak.tot = runs_max(w);
+    vectors_finalize(&ctx->v);
+    STATS_LAP(CTX_STATS(ctx),c,SCEADAN_STAGE_FINALIZE);
+    const int label = predict_liblin(ctx->s,CTX_STATS(ctx),&ctx->v.f);
+    STATS_LAP(CTX_STATS(ctx),c,SCEADAN_STAGE_PREDICT);
+    STATS_ADD(CTX_STATS(ctx),blocks,1);
+    (*cb)(arg,w->offset,label);
+    w->emitted = true;
+}
+
+/* start over with an empty window at the current stream position */
+static void window_clear(sceadan_ctx *ctx)
+{
+    struct sceadan_window *w = ctx->win;
+    vectors_reset(&ctx->v);
+    w->ring_head = 0;
+    w->fill      = 0;
+    w->npending  = 0;
+    w->offset    = w->pos;
+    w->run_first = w->run_end;
+    w->dq_first  = w->dq_end;
+}
+
+int sceadan_window_begin(sceadan_ctx *ctx,size_t window,size_t step)
+{
+    if(window==0 || step==0 || window%2 || step%2) return -1;
+    window_free(ctx->win);
+    struct sceadan_window *w = (struct sceadan_window *)calloc(1,sizeof(*w));
+    if(w==0) return -1;
+    w->window    = window;
+    w->step      = step;
+    w->nruns     = window + 1;
+    w->ring      = (uint8_t *)malloc(window);
+    w->pending   = (uint8_t *)malloc(step < window ? step : 1);
+    w->run_start = (uint64_t *)malloc(w->nruns * sizeof(uint64_t));
+    w->run_len   = (uint64_t *)malloc(w->nruns * sizeof(uint64_t));
+    w->dq        = (uint64_t *)malloc(w->nruns * sizeof(uint64_t));
+    ctx->win = w;
+    if(w->ring==0 || w->pending==0 || w->run_start==0 || w->run_len==0 || w->dq==0){
+        window_free(w);
+        ctx->win = 0;
+        return -1;
+    }
+    window_clear(ctx);
+    return 0;
+}
+
+void sceadan_window_update(sceadan_ctx *ctx,const uint8_t *buf,size_t bufsize,
+                           sceadan_window_cb cb,void *arg)
+{
+    struct sceadan_window *w = ctx->win;
+    STATS_ADD(CTX_STATS(ctx),bytes,bufsize);
+    STATS_CLOCK(c);
+    while(bufsize>0){
+        if(w->skip){                    /* the gap between windows when step > window */
+            const size_t n = (bufsize < w->skip) ? bufsize : w->skip;
+            w->skip -= n;
+            w->pos  += n;
+            buf     += n;
+            bufsize -= n;
+            if(w->skip==0) window_clear(ctx);
+            continue;
+        }
+        if(w->fill<w->window){          /* filling the first window */
+            size_t n = w->window - w->fill;
+            if(n>bufsize) n = bufsize;
+            STATS_RESTART(c);
+            window_add(&ctx->v,w,buf,n);
+            STATS_LAP(CTX_STATS(ctx),c,SCEADAN_STAGE_UPDATE);
+            buf     += n;
+            bufsize -= n;
+            if(w->fill==w->window){
+                window_classify(ctx,cb,arg);
+                if(w->step>=w->window){
+                    w->skip = w->step - w->window;
+                    if(w->skip==0) window_clear(ctx);
+                }
+            }
+            continue;
+        }
+        /* full window, step < window: collect a step, then slide */
+        size_t n = w->step - w->npending;
+        if(n>bufsize) n = bufsize;
+        memcpy(w->pending + w->npending,buf,n);
+        w->npending += n;
+        buf         += n;
+        bufsize     -= n;
+        if(w->npending==w->step){
+            STATS_RESTART(c);
+            window_remove(&ctx->v,w,w->step);
+            window_add(&ctx->v,w,w->pending,w->step);
+            STATS_LAP(CTX_STATS(ctx),c,SCEADAN_STAGE_UPDATE);
+            w->npending = 0;
+            window_classify(ctx,cb,arg);
+        }
+    }
+}
+
+void sceadan_window_finish(sceadan_ctx *ctx,sceadan_window_cb cb,void *arg)
+{
+    struct sceadan_window *w = ctx->win;
+    if(!w->emitted && w->fill>0){       /* the input was shorter than one window */
+        window_classify(ctx,cb,arg);
+    }
+    window_free(w);
+    ctx->win = 0;
+}
+
+/*
+ * Multi-resolution classification.
+ *
+ * The input is counted once, into blocks of the smallest size. Each
+ * finished block is classified and its counts merged into the block
+ * of the next size up, which is classified and merged in turn when it
+ * fills, so every size is classified from a single pass over the data.
+ * Every size is a multiple of the one before, so blocks nest exactly.
+ */
+struct sceadan_multires {
+    int                nlevels;
+    size_t             block_size[SCEADAN_MULTIRES_MAX_LEVELS];
+    uint64_t           offset[SCEADAN_MULTIRES_MAX_LEVELS];    /* start of each level's current block */
+    sceadan_vectors_t *acc[SCEADAN_MULTIRES_MAX_LEVELS];       /* level 0 uses the context's own vectors */
+};
+
+static void multires_free(struct sceadan_multires *mr)
+{
+    if(mr==0) return;
+    for(int i=1;i<mr->nlevels;i++) free(mr->acc[i]);
+    free(mr);
+}
+
+/* classify level i's current block and pass its counts up to level i+1 */
+static void multires_emit(sceadan_ctx *ctx,int i,sceadan_multires_cb cb,void *arg)
+{
+    struct sceadan_multires *mr = ctx->mr;
+    sceadan_vectors_t *v = mr->acc[i];
+    STATS_CLOCK(c);
+    vectors_finalize(v);
+    STATS_LAP(CTX_STATS(ctx),c,SCEADAN_STAGE_FINALIZE);
+    const int label = predict_liblin(ctx->s,CTX_STATS(ctx),&v->f);
+    STATS_LAP(CTX_STATS(ctx),c,SCEADAN_STAGE_PREDICT);
+    STATS_ADD(CTX_STATS(ctx),blocks,1);
+    (*cb)(arg,mr->block_size[i],mr->offset[i],label);
+    mr->offset[i] += v->mfv.uni_sz;
+    STATS_RESTART(c);
+    if(i+1<mr->nlevels) vectors_merge(mr->acc[i+1],v);
+    vectors_reset(v);
+    STATS_LAP(CTX_STATS(ctx),c,SCEADAN_STAGE_UPDATE);
+}
+
+int sceadan_multires_begin(sceadan_ctx *ctx,const size_t *block_sizes,int nlevels)
+{
+    if(nlevels<1 || nlevels>SCEADAN_MULTIRES_MAX_LEVELS) return -1;
+    if(block_sizes[0]==0 || block_sizes[0]%2) return -1;
+    for(int i=1;i<nlevels;i++){
+        if(block_sizes[i]<=block_sizes[i-1] || block_sizes[i]%block_sizes[i-1]) return -1;
+    }
+    multires_free(ctx->mr);
+    struct sceadan_multires *mr = (struct sceadan_multires *)calloc(1,sizeof(*mr));
+    if(mr==0) return -1;
+    ctx->mr = mr;
+    mr->nlevels = nlevels;
+    mr->acc[0] = &ctx->v;
+    for(int i=0;i<nlevels;i++){
+        mr->block_size[i] = block_sizes[i];
+        if(i>0 && (mr->acc[i] = (sceadan_vectors_t *)calloc(1,sizeof(sceadan_vectors_t)))==0){
+            mr->nlevels = i;
+            multires_free(mr);
+            ctx->mr = 0;
+            return -1;
+        }
+    }
+    vectors_reset(&ctx->v);
+    return 0;
+}
+
+void sceadan_multires_update(sceadan_ctx *ctx,const uint8_t *buf,size_t bufsize,
+                             sceadan_multires_cb cb,void *arg)
+{
+    struct sceadan_multires *mr = ctx->mr;
+    STATS_ADD(CTX_STATS(ctx),bytes,bufsize);
+    STATS_CLOCK(c);
+    while(bufsize>0){
+        size_t n = mr->block_size[0] - ctx->v.mfv.uni_sz;
+        if(n>bufsize) n = bufsize;
+        STATS_RESTART(c);
+        vectors_update(buf,n,&ctx->v);
+        STATS_LAP(CTX_STATS(ctx),c,SCEADAN_STAGE_UPDATE);
+        buf     += n;
+        bufsize -= n;
+        for(int i=0;i<mr->nlevels && mr->acc[i]->mfv.uni_sz==mr->block_size[i];i++){
+            multires_emit(ctx,i,cb,arg);
+        }
+    }
+}
+
+void sceadan_multires_finish(sceadan_ctx *ctx,sceadan_multires_cb cb,void *arg)
+{
+    struct sceadan_multires *mr = ctx->mr;
+    for(int i=0;i<mr->nlevels;i++){
+        if(mr->acc[i]->mfv.uni_sz>0) multires_emit(ctx,i,cb,arg);
+    }
+    multires_free(mr);
+    ctx->mr = 0;
+}
+
+/* a whole file being read into one set of vectors */
+struct file_vectors {
+    struct sceadan_stats *st;
+    STATS_CLOCK_MEMBER(clock)           /* the time between pieces is I/O */
+    sceadan_vectors_t *v;
+};
+
+static int classify_file_piece(void *arg,const uint8_t *buf,size_t len)
+{
+    struct file_vectors *fv = (struct file_vectors *)arg;
+    STATS_LAP(fv->st,fv->clock,SCEADAN_STAGE_IO);
+    vectors_update(buf,len,fv->v);
+    STATS_LAP(fv->st,fv->clock,SCEADAN_STAGE_UPDATE);
+    STATS_ADD(fv->st,bytes,len);
+    return 0;
 }
 
 int sceadan_classify_file(const sceadan *s,const char *file_name)
 {
-    struct sceadan_vectors v;
-    memset(&v,0,sizeof(v));
-    v.file_name = file_name;
+    STATS_LOCAL(st);
+    struct file_vectors fv;
+    fv.st = st;
+    fv.v = thread_vectors();
+    if(fv.v==0) return -1;
+    fv.v->file_name = file_name;
+    STATS_RESTART(fv.clock);
     const int fd = open(file_name, O_RDONLY|O_BINARY);
-    if (fd<0) return -1;                /* error condition */
-    while (true) {
-        uint8_t    buf[BUFSIZ];
-        const ssize_t rd = read (fd, buf, sizeof (buf));
-        if(rd<=0) break;
-        vectors_update (buf, rd, &v);
-    }
+    if(fd<0) return -1;                 /* error condition */
+    sceadan_input_each(fd,0,classify_file_piece,&fv);
     if(close(fd)<0) return -1;
-    vectors_finalize(&v);
-    return predict_liblin(s,&v);
+    STATS_LAP(st,fv.clock,SCEADAN_STAGE_IO);
+    vectors_finalize(fv.v);
+    STATS_LAP(st,fv.clock,SCEADAN_STAGE_FINALIZE);
+    const int label = predict_liblin(s,st,&fv.v->f);
+    STATS_LAP(st,fv.clock,SCEADAN_STAGE_PREDICT);
+    STATS_ADD(st,blocks,1);
+    STATS_MERGE(s,st);
+    return label;
+}
+
+/*
+ * Progressive container mode. The file is read once, front to back,
+ * into one set of running vectors; at each checkpoint the vectors are
+ * finalized (which leaves the counts intact) and scored, and reading
+ * stops as soon as the model's choice is clear enough. Random and
+ * constant data are decided by rule, with no margin; they are settled
+ * once the same rule has held at two checkpoints in a row, so a large
+ * encrypted or zero-filled file is not read to the end.
+ */
+struct progressive {
+    const sceadan *s;
+    double    margin;
+    uint64_t  checkpoint;               /* bytes at the next check */
+    int       rule;                     /* the rule's label at the last check, or -1 */
+    struct sceadan_stats *st;
+    STATS_CLOCK_MEMBER(clock)
+    sceadan_vectors_t *v;
+};
+
+/* whether the top two classes are at least p->margin apart, or the
+ * same rule decided this check and the last */
+static bool progressive_settled(struct progressive *p)
+{
+    vectors_finalize(p->v);
+    STATS_LAP(p->st,p->clock,SCEADAN_STAGE_FINALIZE);
+    const int rule = predict_by_rule(&p->v->f);
+    const bool again = rule>=0 && rule==p->rule;
+    p->rule = rule;
+    if(rule>=0){
+        STATS_LAP(p->st,p->clock,SCEADAN_STAGE_PREDICT);
+        return again && p->margin<INFINITY;
+    }
+    double margin;
+    if(p->s->cascade) cascade_predict(p->s,&p->v->f,&margin);
+    else model_predict(p->s,p->s->model,&p->v->f,&margin);
+    STATS_LAP(p->st,p->clock,SCEADAN_STAGE_PREDICT);
+    return margin >= p->margin;
+}
+
+static int progressive_piece(void *arg,const uint8_t *buf,size_t len)
+{
+    struct progressive *p = (struct progressive *)arg;
+    STATS_LAP(p->st,p->clock,SCEADAN_STAGE_IO);
+    STATS_ADD(p->st,bytes,len);
+    while(len>0){
+        const uint64_t to_check = p->checkpoint - p->v->mfv.uni_sz;
+        const size_t n = (len < to_check) ? len : (size_t)to_check;
+        vectors_update(buf,n,p->v);
+        STATS_LAP(p->st,p->clock,SCEADAN_STAGE_UPDATE);
+        buf += n;
+        len -= n;
+        if(p->v->mfv.uni_sz==p->checkpoint){
+            p->checkpoint = (p->checkpoint < SCEADAN_PROGRESSIVE_SECOND) ?
+                SCEADAN_PROGRESSIVE_SECOND : p->checkpoint * SCEADAN_PROGRESSIVE_GROWTH;
+            if(progressive_settled(p)) return 1;
+        }
+    }
+    return 0;
+}
+
+int sceadan_classify_file_progressive(const sceadan *s,const char *file_name,double margin,uint64_t *bytes_read)
+{
+    struct progressive p;
+    p.v = thread_vectors();
+    if(p.v==0) return -1;
+    p.s = s;
+    p.margin = margin;
+    p.checkpoint = SCEADAN_PROGRESSIVE_FIRST;
+    p.rule = -1;
+    p.v->file_name = file_name;
+    STATS_LOCAL(st);
+    p.st = st;
+    STATS_RESTART(p.clock);
+    const int fd = open(file_name,O_RDONLY|O_BINARY);
+    if(fd<0) return -1;
+    const int r = sceadan_input_each_partial(fd,0,progressive_piece,&p);
+    close(fd);
+    STATS_LAP(st,p.clock,SCEADAN_STAGE_IO);
+    int label = -1;
+    if(r>=0){
+        vectors_finalize(p.v);
+        STATS_LAP(st,p.clock,SCEADAN_STAGE_FINALIZE);
+        label = predict_liblin(s,st,&p.v->f);
+        STATS_LAP(st,p.clock,SCEADAN_STAGE_PREDICT);
+        STATS_ADD(st,blocks,1);
+        if(bytes_read) *bytes_read = p.v->mfv.uni_sz;
+    }
+    STATS_MERGE(s,st);
+    return label;
 }
 
 void sceadan_dump_vectors_on_classify(sceadan *s,int file_type,FILE *out)
@@ -755,3 +2824,14 @@ void sceadan_dump_vectors_on_classify(sceadan *s,int file_type,FILE *out)
     s->dump = out;
     s->file_type = file_type;
 }
+
+void sceadan_dump_vectors_format(sceadan *s,int format)
+{
+    s->dump_format = format;
+}
+
+void sceadan_dump_vectors_to_csr(sceadan *s,int file_type,struct sceadan_csr_writer *w)
+{
+    s->dump_csr = w;
+    s->file_type = file_type;
+}
@@ -19,24 +19,210 @@
 
 __BEGIN_DECLS
 
+/* instruction sets for the class-score kernel, narrowest first */
+#define SCEADAN_ISA_SCALAR 0
+#define SCEADAN_ISA_SSE42  1
+#define SCEADAN_ISA_AVX2   2
+#define SCEADAN_ISA_AVX512 3
+#define SCEADAN_ISA_MAX    SCEADAN_ISA_AVX512
+
+/* quantized weight formats */
+#define SCEADAN_QUANT_NONE 0
+#define SCEADAN_QUANT_INT8 1
+#define SCEADAN_QUANT_FP16 2
+
+/* A linear model whose weights are stored per-class scaled:
+ * w[i*nr_w+j] ~= q[i*nr_w+j] * scale[j], with q int8_t or IEEE half (uint16_t).
+ * Labels, dimensions and bias come from model; model->w may be 0.
+ */
+struct sceadan_qmodel {
+    const struct model *model;
+    int quant;                        // SCEADAN_QUANT_*
+    const float *scale;               // one per class
+    const void *q;                    // feature-major, like model->w
+};
+
+/* Two-stage cascade. A unigram-only triage model picks a family (its
+ * labels index family[]) and that family's model, trained on just the
+ * family's classes, picks the label. A family without a model is
+ * decided by triage alone. When the triage margin is below min_margin
+ * the full model decides instead. */
+struct sceadan_cascade_family {
+    const struct model *model;        // 0: the family is the one label below
+    int label;
+};
+
+struct sceadan_cascade {
+    const struct model *triage;
+    int nfamilies;
+    const struct sceadan_cascade_family *family; // indexed by triage label
+    double min_margin;                // between the top two triage decision values
+};
+
+/* Statistics, when built with --enable-stats (otherwise they are not
+ * collected and cost nothing). Time is split between the stages below;
+ * with --enable-stats=perf, and where the kernel allows it, the
+ * calling thread's hardware counters are split the same way. */
+#define SCEADAN_STAGE_IO       0          // reading input (sceadan_classify_file and the like)
+#define SCEADAN_STAGE_UPDATE   1          // counting unigrams and bigrams
+#define SCEADAN_STAGE_FINALIZE 2          // frequencies and statistics from the counts
+#define SCEADAN_STAGE_PREDICT  3          // random/constant rules and the model
+#define SCEADAN_NSTAGES        4
+
+struct sceadan_stats {
+    uint64_t bytes;                   // counted
+    uint64_t blocks;                  // classified
+    uint64_t rand_exits;              // decided by the rules, without the model
+    uint64_t ucv_const_exits;
+    uint64_t bcv_const_exits;
+    uint64_t dedup_blocks;            // seen by the dedup stage (sceadan_ctx_set_dedup)
+    uint64_t dedup_fill;              // of them, one byte repeated, with a remembered label
+    uint64_t dedup_hits;              // of them, found in the dedup's LRU
+    uint64_t ns[SCEADAN_NSTAGES];
+    int      perf;                    // whether the counters below were read
+    uint64_t cycles[SCEADAN_NSTAGES];
+    uint64_t instructions[SCEADAN_NSTAGES];
+    uint64_t cache_misses[SCEADAN_NSTAGES];
+};
+
+/* A scorer generated for one model by mcompile -x (see sceadan_scorer.cpp):
+ * the model's dimensions are compile-time constants, so it keeps the
+ * decision values in registers across the whole feature walk. fn fills
+ * in the decision values from the nonzero unigram frequencies and the
+ * ascending bigrams. */
+typedef void (*sceadan_scorer_fn)(const double *ufreq,uint32_t n_bigrams,const uint16_t *bigram,
+                                  const double *bfreq,double *dec_values);
+struct sceadan_scorer {
+    int nr_class;                     // the model it was generated for
+    int nr_feature;
+    double bias;
+    const int *label;
+    int padded_w;                     // w's rows, nr_w rounded up to 64 bytes
+    const double *w;
+    uint64_t fingerprint;             // of the model, as sceadan_set_scorer() checks it
+    sceadan_scorer_fn fn[SCEADAN_ISA_MAX+1]; // by SCEADAN_ISA_*; 0 where not built
+};
+
 struct sceadan_t {
     const struct model *model;
     FILE *dump;
     int file_type;                    // when dumping
+    int dump_format;                  // SCEADAN_DUMP_*, for dump
+    struct sceadan_csr_writer *dump_csr; // if set, dump to CSR shards instead
+    int isa;                          // SCEADAN_ISA_* used for scoring
+    void (*score_row)(const double *w,int nr_w,double value,double *dec_values);
+    const struct sceadan_qmodel *qmodel; // if set, score with the quantized weights
+    void (*score_row_q)(const void *q,int nr_w,double value,double *dec_values);
+    const struct sceadan_cascade *cascade; // if set, classify with the cascade
+    struct sceadan_stats *stats;      // totals, with --enable-stats
+    struct sceadan_modelfile *file;   // if the model is mapped from a binary model file
+    const struct sceadan_scorer *scorer; // if set, scores the double weights of model
+    sceadan_scorer_fn scorer_fn;      // scorer's function for isa
 };
 typedef struct sceadan_t sceadan;
 
+/* per-thread classification state that is reused from call to call */
+typedef struct sceadan_ctx sceadan_ctx;
+
 
 void sceadan_model_dump(const struct model *); // to stdout
 
-sceadan *sceadan_open(const char *moden_name); // use 0 for default model precompiled
+sceadan *sceadan_open(const char *moden_name); // use 0 for default model precompiled; a binary model file (mcompile -b) is mapped
+int sceadan_write_model(const sceadan *,const char *fname); // as a binary model file, quantized if a qmodel is set; -1 on error
+uint64_t sceadan_fingerprint(const sceadan *); // changes whenever the labels could; for caching results
 const struct model *sceadan_model_precompiled(void);
+uint64_t sceadan_model_precompiled_fingerprint(void); // for sceadan_set_scorer(); 0 if mcompile did not record it
 const struct model *sceadan_model_default(void); // from a file
 int sceadan_classify_file(const sceadan *,const char *fname);    // classify a file
 int sceadan_classify_buf(const sceadan *,const uint8_t *buf,size_t bufsize);
+
+/* Progressive container mode: classify the data read so far at 64 KiB,
+ * 1 MiB, and every 8x after that, and stop reading once the top two
+ * classes' decision values are at least margin apart (with a cascade,
+ * those of the model that decides the label), or once the same
+ * random or constant rule has decided two checks in a row. Each byte
+ * is read once. *bytes_read is how much of the file was used; a
+ * margin of INFINITY reads it all, like sceadan_classify_file(). */
+#define SCEADAN_PROGRESSIVE_FIRST  (64*1024)
+#define SCEADAN_PROGRESSIVE_SECOND (1024*1024)
+#define SCEADAN_PROGRESSIVE_GROWTH 8
+int sceadan_classify_file_progressive(const sceadan *,const char *fname,double margin,uint64_t *bytes_read);
+sceadan_ctx *sceadan_ctx_create(const sceadan *); // preallocates everything classification needs
+int sceadan_ctx_classify(sceadan_ctx *,const uint8_t *buf,size_t bufsize); // no allocation
+void sceadan_ctx_reset(sceadan_ctx *);      // clear only what the last classification touched
+void sceadan_ctx_destroy(sceadan_ctx *);
+struct sceadan_dedup;
+void sceadan_ctx_set_dedup(sceadan_ctx *,struct sceadan_dedup *); // label repeated blocks from memory (see sceadan_dedup.h); 0 to stop
+
+/* Batches: classify n blocks at once, scoring them together so that each
+ * row of weights is loaded once per batch instead of once per block.
+ * The labels are the same as classifying each block alone. Returns -1 on allocation failure. */
+#define SCEADAN_BATCH_TILE 64           // blocks scored together
+int sceadan_classify_batch(const sceadan *,const uint8_t *const *bufs,const size_t *lens,size_t n,int *labels);
+int sceadan_ctx_classify_batch(sceadan_ctx *,const uint8_t *const *bufs,const size_t *lens,size_t n,int *labels);
+
+/* Streaming: classify an object fed in pieces of any size from the caller's own I/O.
+ * The features are identical however the object is split. */
+void sceadan_stream_begin(sceadan_ctx *);
+void sceadan_stream_update(sceadan_ctx *,const uint8_t *buf,size_t bufsize);
+void sceadan_ctx_reference_update(sceadan_ctx *,int on); // byte-at-a-time feature loop, for tests and benchmarks
+int  sceadan_stream_finalize(sceadan_ctx *); // classify everything since begin
+
+/* The steps of sceadan_stream_finalize(), one at a time, for benchmarks */
+void sceadan_stream_features(sceadan_ctx *); // frequencies and statistics from the counts
+int  sceadan_stream_rules(sceadan_ctx *);    // the type if the random/constant rules decide, else -1
+int  sceadan_stream_score(sceadan_ctx *);    // the model's label, whatever the rules say
+
+/* Sliding windows: classify every window of `window' bytes, advancing by `step'.
+ * Counts are updated incrementally, so each window costs O(step).
+ * window and step must be even; begin returns -1 otherwise.
+ * cb is called with the stream offset of each window as it completes. */
+typedef void (*sceadan_window_cb)(void *arg,uint64_t offset,int file_type);
+int  sceadan_window_begin(sceadan_ctx *,size_t window,size_t step);
+void sceadan_window_update(sceadan_ctx *,const uint8_t *buf,size_t bufsize,sceadan_window_cb cb,void *arg);
+void sceadan_window_finish(sceadan_ctx *,sceadan_window_cb cb,void *arg); // a short input still gets one window
+
+/* Multi-resolution: classify blocks of several sizes from one pass.
+ * The smallest blocks are counted and their counts merged upward.
+ * block_sizes ascend, the first is even and each is a multiple of the one before.
+ * cb is called for each block as it completes, smallest first; finish classifies the partial blocks at the end. */
+#define SCEADAN_MULTIRES_MAX_LEVELS 8
+typedef void (*sceadan_multires_cb)(void *arg,size_t block_size,uint64_t offset,int file_type);
+int  sceadan_multires_begin(sceadan_ctx *,const size_t *block_sizes,int nlevels);
+void sceadan_multires_update(sceadan_ctx *,const uint8_t *buf,size_t bufsize,sceadan_multires_cb cb,void *arg);
+void sceadan_multires_finish(sceadan_ctx *,sceadan_multires_cb cb,void *arg);
 const char *sceadan_name_for_type(int);
+int sceadan_type_for_name(const char *);     // -1 if unknown
 void sceadan_close(sceadan *);
 void sceadan_dump_vectors_on_classify(sceadan *,int file_type,FILE *out); // dump vectors instead of classifying
+#define SCEADAN_DUMP_JSON   0           // one object per vector, with the statistics
+#define SCEADAN_DUMP_LIBSVM 1           // liblinear/libsvm sparse text (see sceadan_export.h)
+void sceadan_dump_vectors_format(sceadan *,int format); // SCEADAN_DUMP_*
+void sceadan_dump_vectors_to_csr(sceadan *,int file_type,struct sceadan_csr_writer *); // rows of CSR shards instead
+int sceadan_isa_best(void);                 // widest SCEADAN_ISA_* this CPU supports (via cpuid)
+int sceadan_set_isa(sceadan *,int isa);     // force a scoring kernel; -1 if the CPU lacks it
+const char *sceadan_isa_name(int isa);
+
+int  sceadan_get_stats(const sceadan *,struct sceadan_stats *); // totals so far, including destroyed contexts; -1 without --enable-stats
+int  sceadan_ctx_get_stats(const sceadan_ctx *,struct sceadan_stats *); // what a context has not yet added to its sceadan's totals
+void sceadan_stats_add(struct sceadan_stats *dst,const struct sceadan_stats *src);
+
+const struct sceadan_qmodel *sceadan_qmodel_precompiled(void); // 0 unless built with mcompile -q
+struct sceadan_qmodel *sceadan_qmodel_create(const struct model *,int quant); // quantize a model
+size_t sceadan_qmodel_size(const struct sceadan_qmodel *); // bytes of quantized weights
+void sceadan_qmodel_free(struct sceadan_qmodel *);
+void sceadan_qmodel_dump(const struct sceadan_qmodel *); // to stdout
+int sceadan_set_qmodel(sceadan *,const struct sceadan_qmodel *); // 0 goes back to the double weights
+
+const struct sceadan_cascade *sceadan_cascade_precompiled(void); // 0 unless built with mcompile -c
+struct sceadan_cascade *sceadan_cascade_load(const char *spec); // see mcompile -h for the spec format
+void sceadan_cascade_free(struct sceadan_cascade *); // only for a loaded cascade
+void sceadan_cascade_dump(const struct sceadan_cascade *); // to stdout, after a model dump
+void sceadan_set_cascade(sceadan *,const struct sceadan_cascade *); // 0 goes back to the full model
+
+const struct sceadan_scorer *sceadan_scorer_precompiled(void); // 0 unless built with mcompile -x
+int sceadan_set_scorer(sceadan *,const struct sceadan_scorer *); // -1 if made for another model; 0 goes back to the kernels
+void sceadan_scorer_dump(const struct model *); // sceadan_scorer.cpp's header, to stdout
 
 __END_DECLS
 
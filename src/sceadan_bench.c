@@ -0,0 +1,362 @@
+/*
+ * sceadan_bench.c:
+ * Throughput and latency of each stage of the classifier, as JSON.
+ *
+ * Every block is timed through the stages of sceadan_stream_finalize()
+ * one at a time:
+ *   update      counting (vectors_update)
+ *   update_ref  the same with the byte-at-a-time reference loop
+ *   finalize    frequencies and statistics (vectors_finalize)
+ *   rules       the random and constant checks
+ *   score       the model (do_predict)
+ * and then end to end:
+ *   classify    sceadan_ctx_classify(), compact counters and all
+ *   batch       sceadan_ctx_classify_batch(), a batch tile at a time
+ *
+ * For each input, block size and thread count there is one result,
+ * with each stage's MB/s and blocks/s (over the time spent in that
+ * stage, per thread) and p50/p99 latency per block. With -c, the
+ * results are compared with a stored run and the exit status is 1 if
+ * any stage got slower by more than the tolerance.
+ */
+
+#include "config.h"
+#include <dirent.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sceadan.h"
+
+enum { UPDATE, UPDATE_REF, FINALIZE, RULES, SCORE, CLASSIFY, BATCH, NSTAGES };
+static const char *stage_names[NSTAGES] = {"update","update_ref","finalize","rules","score","classify","batch"};
+
+static const char *input_names[] = {"zeros","random","ascii","corpus"};
+#define NINPUTS (sizeof(input_names)/sizeof(input_names[0]))
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/* len bytes of one kind of input; the corpus is the files of dir, repeated */
+static uint8_t *make_input(const char *name,size_t len,const char *dir)
+{
+    uint8_t *buf = (uint8_t *)malloc(len);
+    if(buf==0){ perror("malloc"); exit(1); }
+    uint32_t state = 1;
+    if(strcmp(name,"zeros")==0){
+        memset(buf,0,len);
+    } else if(strcmp(name,"random")==0){
+        for(size_t i=0;i<len;i++){
+            state = state*1103515245 + 12345;
+            buf[i] = state>>16;
+        }
+    } else if(strcmp(name,"ascii")==0){
+        for(size_t i=0;i<len;i++){
+            state = state*1103515245 + 12345;
+            buf[i] = 0x20 + (state>>16)%0x5f;
+        }
+    } else {
+        size_t fill = 0;
+        DIR *d = opendir(dir);
+        if(d==0){ perror(dir); exit(1); }
+        struct dirent *de;
+        while(fill<len && (de = readdir(d))!=0){
+            if(de->d_name[0]=='.') continue;
+            char path[8192];
+            snprintf(path,sizeof(path),"%s/%s",dir,de->d_name);
+            FILE *f = fopen(path,"rb");
+            if(f==0) continue;
+            fill += fread(buf+fill,1,len-fill,f);
+            fclose(f);
+        }
+        closedir(d);
+        if(fill==0){ fprintf(stderr,"no corpus files in %s\n",dir); exit(1); }
+        for(size_t i=fill;i<len;i++) buf[i] = buf[i-fill];
+    }
+    return buf;
+}
+
+/* one benchmark case, shared by its threads */
+struct bench_case {
+    const sceadan *s;
+    const uint8_t *buf;
+    size_t len;
+    size_t block;
+    size_t nblocks;
+    int    nthreads;
+    double *lat[NSTAGES];               /* seconds, per block */
+};
+
+struct bench_thread {
+    struct bench_case *bc;
+    int t;
+};
+
+/* thread t takes blocks t, t+nthreads, ... */
+static void *bench_thread_main(void *arg)
+{
+    const struct bench_thread *bt = (const struct bench_thread *)arg;
+    struct bench_case *bc = bt->bc;
+    sceadan_ctx *ctx = sceadan_ctx_create(bc->s);
+    if(ctx==0){ perror("sceadan_ctx_create"); exit(1); }
+
+    for(size_t i=bt->t;i<bc->nblocks;i+=bc->nthreads){
+        const uint8_t *p = bc->buf + i*bc->block;
+        const size_t n = (bc->len - i*bc->block < bc->block) ? bc->len - i*bc->block : bc->block;
+        double t[7];
+        t[0] = now();
+        sceadan_ctx_reference_update(ctx,1);
+        sceadan_stream_begin(ctx);
+        sceadan_stream_update(ctx,p,n);
+        t[1] = now();
+        sceadan_ctx_reference_update(ctx,0);
+        sceadan_stream_begin(ctx);
+        sceadan_stream_update(ctx,p,n);
+        t[2] = now();
+        sceadan_stream_features(ctx);
+        t[3] = now();
+        sceadan_stream_rules(ctx);
+        t[4] = now();
+        sceadan_stream_score(ctx);
+        t[5] = now();
+        sceadan_ctx_classify(ctx,p,n);
+        t[6] = now();
+        bc->lat[UPDATE_REF][i] = t[1]-t[0];
+        bc->lat[UPDATE][i]     = t[2]-t[1];
+        bc->lat[FINALIZE][i]   = t[3]-t[2];
+        bc->lat[RULES][i]      = t[4]-t[3];
+        bc->lat[SCORE][i]      = t[5]-t[4];
+        bc->lat[CLASSIFY][i]   = t[6]-t[5];
+    }
+
+    /* batches of one tile; each block is charged its share of the tile */
+    const size_t tile = (size_t)SCEADAN_BATCH_TILE * bc->nthreads;
+    for(size_t first=(size_t)bt->t*SCEADAN_BATCH_TILE;first<bc->nblocks;first+=tile){
+        const uint8_t *bufs[SCEADAN_BATCH_TILE];
+        size_t lens[SCEADAN_BATCH_TILE];
+        int labels[SCEADAN_BATCH_TILE];
+        size_t nb = 0;
+        for(;nb<SCEADAN_BATCH_TILE && first+nb<bc->nblocks;nb++){
+            const size_t off = (first+nb)*bc->block;
+            bufs[nb] = bc->buf + off;
+            lens[nb] = (bc->len-off < bc->block) ? bc->len-off : bc->block;
+        }
+        const double t0 = now();
+        if(sceadan_ctx_classify_batch(ctx,bufs,lens,nb,labels)){ perror("sceadan_ctx_classify_batch"); exit(1); }
+        const double each = (now()-t0)/nb;
+        for(size_t b=0;b<nb;b++) bc->lat[BATCH][first+b] = each;
+    }
+    sceadan_ctx_destroy(ctx);
+    return 0;
+}
+
+static int cmp_double(const void *a,const void *b)
+{
+    const double x = *(const double *)a, y = *(const double *)b;
+    return (x>y) - (x<y);
+}
+
+/* run one case and print its result as one line of JSON */
+static void run_case(FILE *out,const sceadan *s,const char *input,const uint8_t *buf,size_t len,
+                     size_t block,int nthreads,bool first)
+{
+    struct bench_case bc = {s,buf,len,block,(len+block-1)/block,nthreads,{0}};
+    for(int k=0;k<NSTAGES;k++){
+        bc.lat[k] = (double *)calloc(bc.nblocks,sizeof(double));
+        if(bc.lat[k]==0){ perror("calloc"); exit(1); }
+    }
+    pthread_t tid[nthreads];
+    struct bench_thread bt[nthreads];
+    const double t0 = now();
+    for(int t=0;t<nthreads;t++){
+        bt[t] = (struct bench_thread){&bc,t};
+        if(pthread_create(&tid[t],0,bench_thread_main,&bt[t])){ perror("pthread_create"); exit(1); }
+    }
+    for(int t=0;t<nthreads;t++) pthread_join(tid[t],0);
+    const double wall = now()-t0;
+
+    fprintf(out,"%s    {\"input\":\"%s\",\"block\":%zu,\"threads\":%d,\"blocks\":%zu,\"bytes\":%zu,\"wall_s\":%.6f,\"stages\":{",
+            first ? "" : ",\n",input,block,nthreads,bc.nblocks,len,wall);
+    for(int k=0;k<NSTAGES;k++){
+        double total = 0;
+        for(size_t i=0;i<bc.nblocks;i++) total += bc.lat[k][i];
+        qsort(bc.lat[k],bc.nblocks,sizeof(double),cmp_double);
+        const double per_thread = total/nthreads;
+        fprintf(out,"%s\"%s\":{\"mb_s\":%.2f,\"blocks_s\":%.1f,\"p50_us\":%.3f,\"p99_us\":%.3f}",
+                k ? "," : "",stage_names[k],
+                per_thread>0 ? len/per_thread/1e6 : 0,
+                per_thread>0 ? bc.nblocks/per_thread : 0,
+                bc.lat[k][bc.nblocks/2]*1e6,
+                bc.lat[k][(bc.nblocks*99)/100 < bc.nblocks ? (bc.nblocks*99)/100 : bc.nblocks-1]*1e6);
+        free(bc.lat[k]);
+    }
+    fprintf(out,"}}");
+    fflush(out);
+}
+
+/* parse a comma-separated list of sizes into v; returns how many, or
+ * -1 if one is not a positive number */
+static int parse_list(const char *arg,size_t *v,int max)
+{
+    int n = 0;
+    for(const char *p=arg;*p && n<max;){
+        char *end;
+        v[n] = strtoul(p,&end,10);
+        if(v[n++]==0) return -1;
+        if(*end==',') end++;
+        else if(*end) return -1;
+        p = end;
+    }
+    return n;
+}
+
+/* stage mb_s for one case in a stored run, or -1 */
+static double baseline_mb_s(const char *run,const char *input,size_t block,int nthreads,const char *stage)
+{
+    char key[256];
+    snprintf(key,sizeof(key),"{\"input\":\"%s\",\"block\":%zu,\"threads\":%d,",input,block,nthreads);
+    const char *line = strstr(run,key);
+    if(line==0) return -1;
+    const char *end = strchr(line,'\n');
+    char skey[64];
+    snprintf(skey,sizeof(skey),"\"%s\":{\"mb_s\":",stage);
+    const char *p = strstr(line,skey);
+    if(p==0 || (end && p>end)) return -1;
+    return strtod(p+strlen(skey),0);
+}
+
+/* compare the run in out_text with the stored run; 1 if any stage slowed down too much */
+static int compare_runs(const char *current,const char *stored,double tolerance)
+{
+    int regressions = 0;
+    for(const char *line=strstr(current,"{\"input\":\"");line;line=strstr(line+1,"{\"input\":\"")){
+        char input[64];
+        size_t block;
+        int nthreads;
+        if(sscanf(line,"{\"input\":\"%63[^\"]\",\"block\":%zu,\"threads\":%d,",input,&block,&nthreads)!=3) continue;
+        for(int k=0;k<NSTAGES;k++){
+            const double was = baseline_mb_s(stored,input,block,nthreads,stage_names[k]);
+            const double is  = baseline_mb_s(line,input,block,nthreads,stage_names[k]);
+            if(was<=0 || is<0) continue;
+            if(is < was*(1-tolerance/100)){
+                fprintf(stderr,"%s %zu bytes %d threads: %s %.2f MB/s, was %.2f (%+.1f%%)\n",
+                        input,block,nthreads,stage_names[k],is,was,100*(is-was)/was);
+                regressions++;
+            }
+        }
+    }
+    fprintf(stderr,"%d regressions over %.0f%%\n",regressions,tolerance);
+    return regressions ? 1 : 0;
+}
+
+static char *read_file(const char *fname)
+{
+    FILE *f = fopen(fname,"rb");
+    if(f==0){ perror(fname); exit(1); }
+    fseek(f,0,SEEK_END);
+    const long len = ftell(f);
+    fseek(f,0,SEEK_SET);
+    char *buf = (char *)malloc(len+1);
+    if(buf==0 || fread(buf,1,len,f)!=(size_t)len){ perror(fname); exit(1); }
+    buf[len] = 0;
+    fclose(f);
+    return buf;
+}
+
+static void usage(void) __attribute__((noreturn));
+static void usage(void)
+{
+    puts("usage: sceadan_bench [options] > run.json");
+    puts("  -b <a,b,...> - block sizes (default 512,4096,65536,1048576,16777216)");
+    puts("  -t <a,b,...> - thread counts (default 1 and the number of CPUs)");
+    puts("  -i <name>    - only this input: zeros, random, ascii or corpus (default all)");
+    puts("  -n <MiB>     - bytes of each input (default 64, and at least 4 of the largest block)");
+    puts("  -d <dir>     - corpus directory (default $srcdir/../testdata/good)");
+    puts("  -c <file>    - compare with a stored run; exit 1 on a regression");
+    puts("  -T <pct>     - with -c, the slowdown that counts as a regression (default 10)");
+    exit(1);
+}
+
+int main(int argc,char **argv)
+{
+    size_t blocks[16] = {512,4096,65536,1<<20,16<<20};
+    int    nblock_sizes = 5;
+    size_t threads[16];
+    int    nthread_counts = 0;
+    const char *only_input = 0;
+    size_t mib = 64;
+    const char *compare = 0;
+    double tolerance = 10;
+    char corpus[4096];
+    const char *srcdir = getenv("srcdir");
+    snprintf(corpus,sizeof(corpus),"%s/../testdata/good",srcdir ? srcdir : ".");
+
+    int ch;
+    while((ch = getopt(argc,argv,"b:t:i:n:d:c:T:h")) != -1){
+        switch(ch){
+        case 'b': if((nblock_sizes = parse_list(optarg,blocks,16))<=0) usage(); break;
+        case 't': if((nthread_counts = parse_list(optarg,threads,16))<=0) usage(); break;
+        case 'i': only_input = optarg; break;
+        case 'n': mib = strtoul(optarg,0,10); break;
+        case 'd': snprintf(corpus,sizeof(corpus),"%s",optarg); break;
+        case 'c': compare = optarg; break;
+        case 'T': tolerance = strtod(optarg,0); break;
+        default: usage();
+        }
+    }
+    if(nthread_counts==0){
+        const long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        threads[nthread_counts++] = 1;
+        if(ncpu>1) threads[nthread_counts++] = ncpu;
+    }
+    size_t largest = 0;
+    for(int b=0;b<nblock_sizes;b++){
+        if(blocks[b]>largest) largest = blocks[b];
+    }
+    size_t len = mib<<20;
+    if(len<4*largest) len = 4*largest;
+
+    sceadan *s = sceadan_open(0);
+    if(s==0){ fprintf(stderr,"cannot open default model\n"); exit(1); }
+
+    /* the run is kept in memory too, for -c */
+    char  *run = 0;
+    size_t run_len = 0;
+    FILE *out = open_memstream(&run,&run_len);
+    fprintf(out,"{ \"isa\": \"%s\", \"results\": [\n",sceadan_isa_name(s->isa));
+    bool first = true;
+    for(size_t in=0;in<NINPUTS;in++){
+        if(only_input && strcmp(only_input,input_names[in])!=0) continue;
+        uint8_t *buf = make_input(input_names[in],len,corpus);
+        for(int b=0;b<nblock_sizes;b++){
+            for(int t=0;t<nthread_counts;t++){
+                run_case(out,s,input_names[in],buf,len,blocks[b],(int)threads[t],first);
+                first = false;
+            }
+        }
+        free(buf);
+    }
+    fprintf(out,"\n] }\n");
+    fclose(out);
+    fputs(run,stdout);
+
+    int r = 0;
+    if(compare){
+        char *stored = read_file(compare);
+        r = compare_runs(run,stored,tolerance);
+        free(stored);
+    }
+    free(run);
+    sceadan_close(s);
+    return r;
+}
@@ -0,0 +1,320 @@
+/*
+ * sceadan_cache.c: the persistent result cache (see sceadan_cache.h)
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sceadan_cache.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define TEXT_MAX     (1 << 24)          /* longer records are taken for damage */
+#define HASH_CHUNK   (1 << 20)          /* strict mode reads the file this much at a time */
+
+/* wyhash's mixing: the 128-bit product of a and b, folded */
+static inline uint64_t mix(uint64_t a,uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+    const __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    const uint64_t ha = a >> 32, la = (uint32_t)a, hb = b >> 32, lb = (uint32_t)b;
+    const uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    const uint64_t t = rl + (rm0 << 32), lo = t + (rm1 << 32);
+    const uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (lo < t);
+    return lo ^ hi;
+#endif
+}
+
+static inline uint64_t rd64(const uint8_t *p) { uint64_t v; memcpy(&v,p,8); return v; }
+static inline uint64_t rd32(const uint8_t *p) { uint32_t v; memcpy(&v,p,4); return v; }
+
+uint64_t sceadan_hash64(const void *buf,size_t len,uint64_t seed)
+{
+    static const uint64_t k0 = 0xa0761d6478bd642fULL, k1 = 0xe7037ed1a0b428dbULL,
+                          k2 = 0x8ebc6af09c88c6e3ULL, k3 = 0x589965cc75374cc3ULL;
+    const uint8_t *p = (const uint8_t *)buf;
+    uint64_t a, b;
+    seed ^= mix(seed ^ k0,k1);
+    if(len<=16){
+        if(len>=4){
+            a = (rd32(p) << 32) | rd32(p + ((len >> 3) << 2));
+            b = (rd32(p + len - 4) << 32) | rd32(p + len - 4 - ((len >> 3) << 2));
+        } else if(len>0){
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if(i>48){
+            uint64_t s1 = seed, s2 = seed;
+            do {
+                seed = mix(rd64(p) ^ k1,rd64(p + 8) ^ seed);
+                s1   = mix(rd64(p + 16) ^ k2,rd64(p + 24) ^ s1);
+                s2   = mix(rd64(p + 32) ^ k3,rd64(p + 40) ^ s2);
+                p += 48;
+                i -= 48;
+            } while(i>48);
+            seed ^= s1 ^ s2;
+        }
+        while(i>16){
+            seed = mix(rd64(p) ^ k1,rd64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = rd64(p + i - 16);
+        b = rd64(p + i - 8);
+    }
+    return mix(k1 ^ len,mix(a ^ k1,b ^ seed));
+}
+
+/* Loaded and added results, by (dev, ino, fingerprint), in an
+ * open-addressed table that is never shrunk. */
+struct entry {
+    struct sceadan_cache_key key;
+    char    *text;                      /* 0: an empty slot */
+    uint32_t len;
+};
+
+struct sceadan_cache {
+    int              fd;                /* O_APPEND */
+    int              strict;
+    pthread_mutex_t  lock;
+    struct entry    *table;
+    size_t           cap;               /* a power of 2 */
+    size_t           used;
+    uint64_t         hits;
+    uint64_t         misses;
+};
+
+static size_t slot_of(const struct sceadan_cache_key *k,size_t cap)
+{
+    const uint64_t id[3] = {k->dev,k->ino,k->fingerprint};
+    return sceadan_hash64(id,sizeof(id),0) & (cap - 1);
+}
+
+static int same_file(const struct sceadan_cache_key *a,const struct sceadan_cache_key *b)
+{
+    return a->dev == b->dev && a->ino == b->ino && a->fingerprint == b->fingerprint;
+}
+
+static struct entry *find(const struct sceadan_cache *c,const struct sceadan_cache_key *k)
+{
+    for(size_t i=slot_of(k,c->cap);;i=(i+1) & (c->cap-1)){
+        struct entry *e = &c->table[i];
+        if(e->text==0 || same_file(&e->key,k)) return e;
+    }
+}
+
+static int grow(struct sceadan_cache *c)
+{
+    const size_t ncap = c->cap ? c->cap * 2 : 4096;
+    struct entry *old = c->table;
+    const size_t ocap = c->cap;
+    c->table = (struct entry *)calloc(ncap,sizeof(*c->table));
+    if(c->table==0){
+        c->table = old;
+        return -1;
+    }
+    c->cap = ncap;
+    for(size_t i=0;i<ocap;i++){
+        if(old[i].text) *find(c,&old[i].key) = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+/* keeps a copy of text as the result for k's file */
+static int insert(struct sceadan_cache *c,const struct sceadan_cache_key *k,const char *text,size_t len)
+{
+    if((c->used+1)*4>c->cap*3 && grow(c)) return -1;
+    char *copy = (char *)malloc(len + 1);
+    if(copy==0) return -1;
+    memcpy(copy,text,len);
+    copy[len] = 0;
+    struct entry *e = find(c,k);
+    if(e->text) free(e->text);
+    else c->used++;
+    e->key  = *k;
+    e->text = copy;
+    e->len  = (uint32_t)len;
+    return 0;
+}
+
+static uint64_t record_check(const struct sceadan_cache_record *r,const char *text)
+{
+    const uint64_t h = sceadan_hash64(r,offsetof(struct sceadan_cache_record,check),0);
+    return sceadan_hash64(text,r->text_len,h);
+}
+
+/* Every intact record, oldest first; past a damaged one, the next record
+ * is found by its magic number and checksum. */
+static int load(struct sceadan_cache *c,const uint8_t *p,size_t size)
+{
+    size_t off = 0;
+    while(off+sizeof(struct sceadan_cache_record)<=size){
+        struct sceadan_cache_record r;
+        memcpy(&r,p + off,sizeof(r));
+        const size_t avail = size - off - sizeof(r);
+        const char *text = (const char *)(p + off + sizeof(r));
+        if(r.magic!=SCEADAN_CACHE_MAGIC || r.text_len>TEXT_MAX || r.text_len>avail ||
+            record_check(&r,text)!=r.check){
+            off++;
+            continue;
+        }
+        if(insert(c,&r.key,text,r.text_len)) return -1;
+        off += sizeof(r) + r.text_len;
+    }
+    return 0;
+}
+
+sceadan_cache *sceadan_cache_open(const char *fname,int strict)
+{
+    sceadan_cache *c = (sceadan_cache *)calloc(1,sizeof(*c));
+    if(c==0) return 0;
+    c->strict = strict;
+    pthread_mutex_init(&c->lock,0);
+    c->fd = open(fname,O_RDWR | O_CREAT | O_APPEND | O_BINARY,0666);
+    struct stat st;
+    if(c->fd<0 || fstat(c->fd,&st) || grow(c)) goto fail;
+    if(st.st_size>0){
+        void *map = mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,c->fd,0);
+        if(map==MAP_FAILED) goto fail;
+        const int r = load(c,(const uint8_t *)map,st.st_size);
+        munmap(map,st.st_size);
+        if(r) goto fail;
+    }
+    return c;
+
+fail:;
+    const int err = errno;
+    sceadan_cache_close(c);
+    errno = err;
+    return 0;
+}
+
+static int hash_contents(const char *path,uint64_t *h)
+{
+    const int fd = open(path,O_RDONLY | O_BINARY);
+    if(fd<0) return -1;
+    uint8_t *buf = (uint8_t *)malloc(HASH_CHUNK);
+    if(buf==0){
+        close(fd);
+        return -1;
+    }
+    uint64_t seed = 0;
+    ssize_t n;
+    while((n = read(fd,buf,HASH_CHUNK))>0) seed = sceadan_hash64(buf,n,seed);
+    free(buf);
+    close(fd);
+    if(n<0) return -1;
+    *h = seed;
+    return 0;
+}
+
+int sceadan_cache_key(const sceadan_cache *c,const char *path,uint64_t fingerprint,struct sceadan_cache_key *k)
+{
+    struct stat st;
+    if(stat(path,&st)) return -1;
+    memset(k,0,sizeof(*k));
+    k->dev  = st.st_dev;
+    k->ino  = st.st_ino;
+    k->size = st.st_size;
+#ifdef __APPLE__
+    k->mtime_sec  = st.st_mtimespec.tv_sec;
+    k->mtime_nsec = st.st_mtimespec.tv_nsec;
+#else
+    k->mtime_sec  = st.st_mtim.tv_sec;
+    k->mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+    k->fingerprint = fingerprint;
+    if(c->strict){
+        k->strict = 1;
+        if(hash_contents(path,&k->content)) return -1;
+    }
+    return 0;
+}
+
+/* A strict result also serves a lookup that is not strict, but not the
+ * other way round. */
+static int matches(const struct sceadan_cache_key *have,const struct sceadan_cache_key *want)
+{
+    if(have->size!=want->size || have->mtime_sec!=want->mtime_sec || have->mtime_nsec!=want->mtime_nsec){
+        return 0;
+    }
+    return !want->strict || (have->strict && have->content == want->content);
+}
+
+int sceadan_cache_get(sceadan_cache *c,const struct sceadan_cache_key *k,char **text,size_t *len)
+{
+    int hit = 0;
+    pthread_mutex_lock(&c->lock);
+    const struct entry *e = find(c,k);
+    if(e->text && matches(&e->key,k) && (*text = strdup(e->text))!=0){
+        *len = e->len;
+        hit = 1;
+    }
+    if(hit) c->hits++;
+    else c->misses++;
+    pthread_mutex_unlock(&c->lock);
+    return hit;
+}
+
+int sceadan_cache_put(sceadan_cache *c,const struct sceadan_cache_key *k,const char *text,size_t len)
+{
+    if(len>TEXT_MAX){
+        errno = EFBIG;
+        return -1;
+    }
+    const size_t size = sizeof(struct sceadan_cache_record) + len;
+    uint8_t *buf = (uint8_t *)malloc(size);
+    if(buf==0) return -1;
+    struct sceadan_cache_record r;
+    memset(&r,0,sizeof(r));
+    r.magic    = SCEADAN_CACHE_MAGIC;
+    r.text_len = (uint32_t)len;
+    r.key      = *k;
+    r.check    = record_check(&r,text);
+    memcpy(buf,&r,sizeof(r));
+    memcpy(buf + sizeof(r),text,len);
+
+    /* one write, so that appends from other threads and processes land
+     * whole, each after the last */
+    pthread_mutex_lock(&c->lock);
+    const ssize_t n = write(c->fd,buf,size);
+    int ret = (n == (ssize_t)size) ? 0 : -1;
+    if(n>=0 && ret) errno = ENOSPC;
+    if(ret==0) ret = insert(c,k,text,len);
+    pthread_mutex_unlock(&c->lock);
+    free(buf);
+    return ret;
+}
+
+void sceadan_cache_counts(const sceadan_cache *c,uint64_t *hits,uint64_t *misses)
+{
+    *hits   = c->hits;
+    *misses = c->misses;
+}
+
+void sceadan_cache_close(sceadan_cache *c)
+{
+    if(c==0) return;
+    if(c->fd>=0) close(c->fd);
+    for(size_t i=0;i<c->cap;i++) free(c->table[i].text);
+    free(c->table);
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+}
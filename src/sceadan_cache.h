@@ -0,0 +1,60 @@
+#ifndef SCEADAN_CACHE_H
+#define SCEADAN_CACHE_H
+
+/*
+ * A persistent cache of per-file results, so that a rescan classifies
+ * only the files that changed.
+ *
+ * A file is known by its device, inode, size and modification time, and
+ * a result also records the fingerprint of the model and options that
+ * produced it; in strict mode, a hash of the file's contents as well.
+ * Looking a file up costs a stat(), not an open(), except in strict mode.
+ *
+ * The cache file is a log of records, each appended with a single
+ * write() to an O_APPEND descriptor, so workers in several threads or
+ * processes can share one file; the newest record for a file wins. Each
+ * record carries a checksum, and a damaged record (say, the tail of a
+ * crashed run) is skipped when the file is loaded.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+#define SCEADAN_CACHE_MAGIC 0x31524353  /* "SCR1" in the writer's byte order */
+
+struct sceadan_cache_key {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t  mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t strict;                    /* whether content is set */
+    uint64_t fingerprint;               /* of the model and options */
+    uint64_t content;                   /* sceadan_hash64 of the file, in strict mode */
+};
+
+/* a record is this, then text_len bytes of text */
+struct sceadan_cache_record {
+    uint32_t magic;                     /* SCEADAN_CACHE_MAGIC */
+    uint32_t text_len;
+    struct sceadan_cache_key key;
+    uint64_t check;                     /* sceadan_hash64 of the record before this, and the text */
+};
+
+typedef struct sceadan_cache sceadan_cache;
+
+sceadan_cache *sceadan_cache_open(const char *fname,int strict); // creates fname if need be; 0 with errno set on failure
+int  sceadan_cache_key(const sceadan_cache *,const char *path,uint64_t fingerprint,struct sceadan_cache_key *); // -1 if path cannot be read
+int  sceadan_cache_get(sceadan_cache *,const struct sceadan_cache_key *,char **text,size_t *len); // 1 with a malloc'd copy on a hit
+int  sceadan_cache_put(sceadan_cache *,const struct sceadan_cache_key *,const char *text,size_t len); // -1 with errno set on failure
+void sceadan_cache_counts(const sceadan_cache *,uint64_t *hits,uint64_t *misses);
+void sceadan_cache_close(sceadan_cache *);
+
+uint64_t sceadan_hash64(const void *buf,size_t len,uint64_t seed); // fast, not cryptographic
+
+__END_DECLS
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ * sceadan_compact.cpp: bigram counters sized to the block (see sceadan_compact.h)
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <limits>
+#include <new>
+
+#include "sceadan_compact.h"
+
+namespace {
+
+const size_t n_bigram = 1 << 16;
+
+/*
+ * Bigram counts for blocks of up to max_block bytes, in counters of
+ * type Count. A cell's count going from 0 to 1 is what puts it on the
+ * list, so no separate bitmap is needed, and the table is left zeroed
+ * by collecting the counts after every block.
+ */
+template <typename Count>
+class bigram_counter {
+public:
+    static const size_t max_block = 2 * (size_t) std::numeric_limits<Count>::max() + 1;
+    static const size_t max_pairs = (max_block / 2 < n_bigram) ? max_block / 2 : n_bigram;
+
+    int count(const uint8_t *buf, size_t len) {
+        assert(len <= max_block);
+        uint32_t n = 0;
+        for (size_t k = 0; k + 1 < len; k += 2) {
+            const uint16_t b = (uint16_t) (buf[k] << 8 | buf[k + 1]);
+            if (table[b]++ == 0) pairs[n++] = b;
+        }
+        sort_pairs(n);
+        for (uint32_t i = 0; i < n; i++) {
+            counts[i] = table[pairs[i]];
+            table[pairs[i]] = 0;
+        }
+        return (int) n;
+    }
+
+    Count    table[n_bigram];
+    uint16_t pairs[max_pairs];
+    uint32_t counts[max_pairs];
+
+private:
+    /* LSD radix sort, low byte then high byte, through counts[] as scratch */
+    void sort_pairs(uint32_t n) {
+        uint16_t *tmp = reinterpret_cast<uint16_t *>(counts);
+        uint32_t lo[257] = {0}, hi[257] = {0};
+        for (uint32_t i = 0; i < n; i++) {
+            lo[(pairs[i] & 0xff) + 1]++;
+            hi[(pairs[i] >> 8) + 1]++;
+        }
+        for (int k = 0; k < 256; k++) {
+            lo[k + 1] += lo[k];
+            hi[k + 1] += hi[k];
+        }
+        for (uint32_t i = 0; i < n; i++) tmp[lo[pairs[i] & 0xff]++] = pairs[i];
+        for (uint32_t i = 0; i < n; i++) pairs[hi[tmp[i] >> 8]++] = tmp[i];
+    }
+};
+
+}
+
+/* one counter per block-size class, narrowest first */
+struct sceadan_compact {
+    bigram_counter<uint8_t>  small;     /* 64 KB table, blocks up to 511 bytes */
+    bigram_counter<uint16_t> large;     /* 128 KB table, blocks up to 131071 bytes */
+};
+static_assert(bigram_counter<uint16_t>::max_block == SCEADAN_COMPACT_MAX_BLOCK, "compact block classes");
+
+extern "C" sceadan_compact *sceadan_compact_create(void)
+{
+    return new (std::nothrow) sceadan_compact();
+}
+
+extern "C" void sceadan_compact_destroy(sceadan_compact *c)
+{
+    delete c;
+}
+
+template <typename Count>
+static int count_with(bigram_counter<Count> &counter, const uint8_t *buf, size_t len,
+                      const uint16_t **pairs, const uint32_t **counts)
+{
+    const int n = counter.count(buf, len);
+    *pairs  = counter.pairs;
+    *counts = counter.counts;
+    return n;
+}
+
+extern "C" int sceadan_compact_bigrams(sceadan_compact *c, const uint8_t *buf, size_t len,
+                                       const uint16_t **pairs, const uint32_t **counts)
+{
+    if (len <= bigram_counter<uint8_t>::max_block)  return count_with(c->small, buf, len, pairs, counts);
+    if (len <= bigram_counter<uint16_t>::max_block) return count_with(c->large, buf, len, pairs, counts);
+    return -1;
+}
@@ -0,0 +1,36 @@
+#ifndef SCEADAN_COMPACT_H
+#define SCEADAN_COMPACT_H
+
+/*
+ * Compact bigram counters for bounded blocks.
+ *
+ * A block of len bytes has at most len/2 bigrams, so its counts fit in
+ * counters much narrower than the library's 64-bit ones: 8 bits up to
+ * 511 bytes and 16 bits up to 131071 bytes. The narrow table (64 KB or
+ * 128 KB instead of 512 KB) stays in cache while a block is counted.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+#define SCEADAN_COMPACT_MAX_BLOCK 131071    /* largest block any counter width holds */
+
+typedef struct sceadan_compact sceadan_compact;
+
+sceadan_compact *sceadan_compact_create(void); // 0 on allocation failure
+void sceadan_compact_destroy(sceadan_compact *);
+
+/* Count the bigrams of one block (the pairs at even offsets) with the
+ * narrowest counters that can hold them. The distinct bigrams are left
+ * in ascending order in *pairs, with their counts in *counts; both stay
+ * valid until the next call. Returns how many there are, or -1 if len
+ * is larger than SCEADAN_COMPACT_MAX_BLOCK. */
+int sceadan_compact_bigrams(sceadan_compact *,const uint8_t *buf,size_t len,
+                            const uint16_t **pairs,const uint32_t **counts);
+
+__END_DECLS
+
+#endif
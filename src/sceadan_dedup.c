@@ -0,0 +1,191 @@
+/*
+ * sceadan_dedup.c: block deduplication (see sceadan_dedup.h)
+ */
+
+#include "config.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "sceadan_dedup.h"
+#include "sceadan_cache.h"
+
+#define NIL UINT32_MAX
+
+struct node {
+    uint64_t hash;
+    uint32_t len;
+    int32_t  label;
+    uint32_t prev, next;                /* the LRU list, most recent first */
+    uint32_t chain;                     /* the next node in the same bucket */
+};
+
+/* one lock, table and list; aligned so that shards do not share lines */
+struct shard {
+    pthread_mutex_t lock;
+    struct node    *node;               /* cap of them, used in use */
+    uint32_t       *bucket;             /* mask+1 chain heads */
+    uint32_t        mask;
+    uint32_t        cap;
+    uint32_t        used;
+    uint32_t        head, tail;
+} __attribute__((aligned(64)));
+
+struct sceadan_dedup {
+    uint64_t     seed;
+    struct shard shard[SCEADAN_DEDUP_SHARDS];
+};
+
+/* shards by the top bits of the hash, buckets by the bottom ones */
+static struct shard *shard_of(sceadan_dedup *d,uint64_t hash)
+{
+    return &d->shard[hash >> 58];
+}
+
+sceadan_dedup *sceadan_dedup_create(size_t entries)
+{
+    sceadan_dedup *d = 0;
+    if(posix_memalign((void **)&d,64,sizeof(*d))) return 0;
+    memset(d,0,sizeof(*d));
+
+    /* a seed no one can predict, so that no one can craft colliding blocks */
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME,&ts);
+    const uint64_t salt[3] = {(uint64_t)ts.tv_sec,(uint64_t)ts.tv_nsec,(uint64_t)getpid()};
+    d->seed = sceadan_hash64(salt,sizeof(salt),(uint64_t)(uintptr_t)d);
+
+    const size_t per_shard = entries / SCEADAN_DEDUP_SHARDS ? entries / SCEADAN_DEDUP_SHARDS : 1;
+    uint32_t nbuckets = 1;
+    while(nbuckets<per_shard) nbuckets *= 2;
+    for(int i=0;i<SCEADAN_DEDUP_SHARDS;i++){
+        struct shard *sh = &d->shard[i];
+        pthread_mutex_init(&sh->lock,0);
+        sh->node   = (struct node *)malloc(per_shard * sizeof(struct node));
+        sh->bucket = (uint32_t *)malloc(nbuckets * sizeof(uint32_t));
+        if(sh->node==0 || sh->bucket==0){
+            sceadan_dedup_destroy(d);
+            return 0;
+        }
+        memset(sh->bucket,0xff,nbuckets * sizeof(uint32_t));
+        sh->mask = nbuckets - 1;
+        sh->cap  = (uint32_t)per_shard;
+        sh->head = sh->tail = NIL;
+    }
+    return d;
+}
+
+void sceadan_dedup_destroy(sceadan_dedup *d)
+{
+    if(d==0) return;
+    for(int i=0;i<SCEADAN_DEDUP_SHARDS;i++){
+        pthread_mutex_destroy(&d->shard[i].lock);
+        free(d->shard[i].node);
+        free(d->shard[i].bucket);
+    }
+    free(d);
+}
+
+uint64_t sceadan_dedup_hash(const sceadan_dedup *d,const uint8_t *buf,size_t len)
+{
+    return sceadan_hash64(buf,len,d->seed);
+}
+
+static void list_unlink(struct shard *sh,uint32_t i)
+{
+    struct node *n = &sh->node[i];
+    if(n->prev!=NIL) sh->node[n->prev].next = n->next;
+    else sh->head = n->next;
+    if(n->next!=NIL) sh->node[n->next].prev = n->prev;
+    else sh->tail = n->prev;
+}
+
+static void list_push(struct shard *sh,uint32_t i)
+{
+    struct node *n = &sh->node[i];
+    n->prev = NIL;
+    n->next = sh->head;
+    if(sh->head!=NIL) sh->node[sh->head].prev = i;
+    else sh->tail = i;
+    sh->head = i;
+}
+
+static uint32_t find(const struct shard *sh,uint64_t hash,uint32_t len)
+{
+    uint32_t i = sh->bucket[hash & sh->mask];
+    while(i!=NIL && (sh->node[i].hash!=hash || sh->node[i].len!=len)) i = sh->node[i].chain;
+    return i;
+}
+
+int sceadan_dedup_get(sceadan_dedup *d,uint64_t hash,size_t len)
+{
+    struct shard *sh = shard_of(d,hash);
+    pthread_mutex_lock(&sh->lock);
+    const uint32_t i = find(sh,hash,(uint32_t)len);
+    int label = -1;
+    if(i!=NIL){
+        label = sh->node[i].label;
+        if(sh->head!=i){
+            list_unlink(sh,i);
+            list_push(sh,i);
+        }
+    }
+    pthread_mutex_unlock(&sh->lock);
+    return label;
+}
+
+void sceadan_dedup_put(sceadan_dedup *d,uint64_t hash,size_t len,int label)
+{
+    struct shard *sh = shard_of(d,hash);
+    pthread_mutex_lock(&sh->lock);
+    uint32_t i = find(sh,hash,(uint32_t)len);
+    if(i!=NIL){                         /* another thread put it first */
+        pthread_mutex_unlock(&sh->lock);
+        return;
+    }
+    if(sh->used<sh->cap){
+        i = sh->used++;
+    } else {                            /* take the least recently used node */
+        i = sh->tail;
+        list_unlink(sh,i);
+        uint32_t *p = &sh->bucket[sh->node[i].hash & sh->mask];
+        while(*p!=i) p = &sh->node[*p].chain;
+        *p = sh->node[i].chain;
+    }
+    struct node *n = &sh->node[i];
+    n->hash  = hash;
+    n->len   = (uint32_t)len;
+    n->label = label;
+    n->chain = sh->bucket[hash & sh->mask];
+    sh->bucket[hash & sh->mask] = i;
+    list_push(sh,i);
+    pthread_mutex_unlock(&sh->lock);
+}
+
+int sceadan_fill_byte(const uint8_t *buf,size_t len)
+{
+    if(len==0) return -1;
+    const uint8_t b = buf[0];
+    size_t i = 0;
+#ifdef __SSE2__
+    /* most blocks differ within the first 64 bytes */
+    const __m128i v = _mm_set1_epi8((char)b);
+    for(;i+64<=len;i+=64){
+        const __m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i)),v);
+        const __m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i + 16)),v);
+        const __m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i + 32)),v);
+        const __m128i e3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i + 48)),v);
+        const __m128i e = _mm_and_si128(_mm_and_si128(e0,e1),_mm_and_si128(e2,e3));
+        if(_mm_movemask_epi8(e)!=0xffff) return -1;
+    }
+#endif
+    for(;i<len;i++){
+        if(buf[i]!=b) return -1;
+    }
+    return b;
+}
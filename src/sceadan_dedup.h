@@ -0,0 +1,41 @@
+#ifndef SCEADAN_DEDUP_H
+#define SCEADAN_DEDUP_H
+
+/*
+ * Block deduplication for block mode: disk images repeat blocks
+ * (zero-filled sectors, copies of filesystem metadata, copies of
+ * files), and a repeated block gets the label it got before instead of
+ * being counted and scored again.
+ *
+ * A context given a dedup with sceadan_ctx_set_dedup() first checks
+ * whether a block is one byte repeated, which a per-context memo of
+ * (byte, length) decides without hashing. Any other block is hashed
+ * with sceadan_hash64(), under a seed chosen when the dedup is created,
+ * and looked up by hash and length in a bounded LRU. The LRU is split
+ * into shards, each with its own lock, so that contexts in several
+ * threads can share one. Every context sharing a dedup must classify
+ * with the same model and settings.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+#define SCEADAN_DEDUP_SHARDS  64
+#define SCEADAN_DEDUP_ENTRIES 65536     /* a sensible size: about 2 MB */
+
+typedef struct sceadan_dedup sceadan_dedup;
+
+sceadan_dedup *sceadan_dedup_create(size_t entries); // 0 on allocation failure
+void sceadan_dedup_destroy(sceadan_dedup *);
+uint64_t sceadan_dedup_hash(const sceadan_dedup *,const uint8_t *buf,size_t len);
+int  sceadan_dedup_get(sceadan_dedup *,uint64_t hash,size_t len); // the label, or -1
+void sceadan_dedup_put(sceadan_dedup *,uint64_t hash,size_t len,int label); // evicts the least recently used
+
+int sceadan_fill_byte(const uint8_t *buf,size_t len); // the byte if buf is one byte repeated, else -1
+
+__END_DECLS
+
+#endif
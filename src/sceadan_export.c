@@ -0,0 +1,293 @@
+/*
+ * sceadan_export.c: training data export (see sceadan_export.h)
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sceadan_export.h"
+
+#define n_unigram 256
+#define n_feature (n_unigram + 65536)   /* unigrams, then every bigram */
+
+/* Formatted values, by the bits of the double. Within a vector the
+ * unigram frequencies are multiples of 1/size and the bigram values are
+ * counts, so a few values recur; across vectors of the same size too. */
+#define MEMO_BITS 10
+struct memo {
+    uint64_t bits;
+    uint8_t  len;                       /* 0: empty */
+    char     str[SCEADAN_EXPORT_DOUBLE_MAX - 1];
+};
+static __thread struct memo memo[1 << MEMO_BITS];
+
+char *sceadan_format_uint(char *p,uint64_t u)
+{
+    char tmp[20];
+    int n = 0;
+    do {
+        tmp[n++] = '0' + u % 10;
+        u /= 10;
+    } while(u);
+    while(n) *p++ = tmp[--n];
+    *p = 0;
+    return p;
+}
+
+char *sceadan_format_double(char *p,double x)
+{
+    /* %.16lg prints a whole number below 1e16 as its digits */
+    if(x>=1 && x<1e15){
+        const uint64_t u = (uint64_t)x;
+        const double back = (double)u;
+        if(memcmp(&back,&x,sizeof(x))==0) return sceadan_format_uint(p,u);
+    }
+    uint64_t bits;
+    memcpy(&bits,&x,sizeof(bits));
+    struct memo *m = &memo[(bits * 0x9e3779b97f4a7c15ULL) >> (64 - MEMO_BITS)];
+    if(m->len==0 || m->bits!=bits){
+        m->len  = (uint8_t)snprintf(m->str,sizeof(m->str),"%.16lg",x);
+        m->bits = bits;
+    }
+    memcpy(p,m->str,m->len + 1);
+    return p + m->len;
+}
+
+/* a line built in pieces and written a chunk at a time */
+struct chunk {
+    FILE  *out;
+    size_t n;
+    int    err;
+    char   buf[1 << 16];
+};
+
+static void chunk_flush(struct chunk *c)
+{
+    if(c->n && fwrite(c->buf,1,c->n,c->out)!=c->n) c->err = 1;
+    c->n = 0;
+}
+
+static void chunk_feature(struct chunk *c,uint32_t index,double value)
+{
+    if(c->n+32+SCEADAN_EXPORT_DOUBLE_MAX>sizeof(c->buf)) chunk_flush(c);
+    char *p = c->buf + c->n;
+    *p++ = ' ';
+    p = sceadan_format_uint(p,index);
+    *p++ = ':';
+    p = sceadan_format_double(p,value);
+    c->n = p - c->buf;
+}
+
+int sceadan_export_libsvm(FILE *out,const struct sceadan_export_vector *v)
+{
+    struct chunk c;
+    c.out = out;
+    c.err = 0;
+    c.n = snprintf(c.buf,sizeof(c.buf),"%d",v->label);
+    for(int u=0;u<n_unigram;u++){
+        if(v->ufreq[u]>0) chunk_feature(&c,u + 1,v->ufreq[u]);
+    }
+    for(uint32_t k=0;k<v->n_bigrams;k++){
+        chunk_feature(&c,n_unigram + 1 + v->bigram[k],v->bfreq[k]);
+    }
+    c.buf[c.n++] = '\n';
+    chunk_flush(&c);
+    return c.err ? -1 : 0;
+}
+
+/* CSR shards */
+
+#define ALIGN_UP(x) SCEADAN_ALIGN_UP(x,SCEADAN_CSR_ALIGN)
+
+struct sceadan_csr_writer {
+    pthread_mutex_t lock;
+    char     *prefix;
+    uint64_t  shard_rows;
+    unsigned  shard;                    /* number of the next shard written */
+    int       err;                      /* errno of the first failure, or 0 */
+    uint64_t  n_rows;                   /* in the shard being built */
+    uint64_t  nnz;
+    uint64_t  nnz_alloc;
+    int32_t  *label;                    /* shard_rows of them */
+    uint64_t *row;                      /* shard_rows+1 */
+    uint32_t *index;                    /* nnz_alloc */
+    double   *value;
+};
+
+static int write_shard(sceadan_csr_writer *w)
+{
+    struct sceadan_csr_header h;
+    memset(&h,0,sizeof(h));
+    memcpy(h.magic,SCEADAN_CSR_MAGIC,sizeof(h.magic));
+    h.version      = SCEADAN_CSR_VERSION;
+    h.byte_order   = SCEADAN_CSR_BYTE_ORDER;
+    h.n_features   = n_feature;
+    h.n_rows       = w->n_rows;
+    h.nnz          = w->nnz;
+    h.label_offset = ALIGN_UP(sizeof(h));
+    h.row_offset   = ALIGN_UP(h.label_offset + h.n_rows * sizeof(int32_t));
+    h.index_offset = ALIGN_UP(h.row_offset + (h.n_rows + 1) * sizeof(uint64_t));
+    h.value_offset = ALIGN_UP(h.index_offset + h.nnz * sizeof(uint32_t));
+    const struct sceadan_mapfile_section sections[] = {
+        {w->label,h.label_offset,h.n_rows * sizeof(int32_t)},
+        {w->row,h.row_offset,(h.n_rows + 1) * sizeof(uint64_t)},
+        {w->index,h.index_offset,h.nnz * sizeof(uint32_t)},
+        {w->value,h.value_offset,h.nnz * sizeof(double)},
+    };
+    char fname[4096];
+    snprintf(fname,sizeof(fname),"%s-%05u.csr",w->prefix,w->shard);
+    if(sceadan_mapfile_write(fname,&h,sizeof(h),sections,sizeof(sections) / sizeof(sections[0]))) return -1;
+    w->shard++;
+    w->n_rows = 0;
+    w->nnz    = 0;
+    return 0;
+}
+
+sceadan_csr_writer *sceadan_csr_writer_create(const char *prefix,uint64_t shard_rows)
+{
+    sceadan_csr_writer *w = (sceadan_csr_writer *)calloc(1,sizeof(*w));
+    if(w==0) return 0;
+    w->shard_rows = shard_rows ? shard_rows : SCEADAN_CSR_SHARD_ROWS;
+    w->prefix = strdup(prefix);
+    w->label  = (int32_t *)malloc(w->shard_rows * sizeof(int32_t));
+    w->row    = (uint64_t *)malloc((w->shard_rows + 1) * sizeof(uint64_t));
+    if(w->prefix==0 || w->label==0 || w->row==0){
+        free(w->prefix);
+        free(w->label);
+        free(w->row);
+        free(w);
+        return 0;
+    }
+    w->row[0] = 0;
+    pthread_mutex_init(&w->lock,0);
+    return w;
+}
+
+/* room for n more nonzero features */
+static int reserve(sceadan_csr_writer *w,uint64_t n)
+{
+    if(w->nnz+n<=w->nnz_alloc) return 0;
+    uint64_t alloc = w->nnz_alloc ? w->nnz_alloc : (1 << 20);
+    while(alloc<w->nnz+n) alloc *= 2;
+    uint32_t *index = (uint32_t *)realloc(w->index,alloc * sizeof(uint32_t));
+    if(index) w->index = index;
+    double *value = (double *)realloc(w->value,alloc * sizeof(double));
+    if(value) w->value = value;
+    if(index==0 || value==0) return -1;
+    w->nnz_alloc = alloc;
+    return 0;
+}
+
+int sceadan_csr_writer_add(sceadan_csr_writer *w,const struct sceadan_export_vector *v)
+{
+    pthread_mutex_lock(&w->lock);
+    int r = -1;
+    if(w->err==0 && reserve(w,n_unigram+v->n_bigrams)==0){
+        uint64_t nnz = w->nnz;
+        for(int u=0;u<n_unigram;u++){
+            if(v->ufreq[u]>0){
+                w->index[nnz] = u + 1;
+                w->value[nnz++] = v->ufreq[u];
+            }
+        }
+        for(uint32_t k=0;k<v->n_bigrams;k++){
+            w->index[nnz] = n_unigram + 1 + v->bigram[k];
+            w->value[nnz++] = v->bfreq[k];
+        }
+        w->nnz = nnz;
+        w->label[w->n_rows++] = v->label;
+        w->row[w->n_rows] = nnz;
+        r = (w->n_rows < w->shard_rows && nnz < SCEADAN_CSR_SHARD_NNZ) ? 0 : write_shard(w);
+    }
+    if(r && w->err==0) w->err = errno ? errno : EIO;
+    if(r) errno = w->err;
+    pthread_mutex_unlock(&w->lock);
+    return r;
+}
+
+int sceadan_csr_writer_close(sceadan_csr_writer *w)
+{
+    if(w==0) return 0;
+    if(w->err==0 && w->n_rows>0 && write_shard(w)) w->err = errno;
+    const int err = w->err;
+    pthread_mutex_destroy(&w->lock);
+    free(w->prefix);
+    free(w->label);
+    free(w->row);
+    free(w->index);
+    free(w->value);
+    free(w);
+    errno = err;
+    return err ? -1 : 0;
+}
+
+/* the magic, version, byte order, size and crcs are sceadan_mapfile_map()'s */
+static int header_valid(const struct sceadan_csr_header *h,uint64_t size)
+{
+    if((h->label_offset | h->row_offset | h->index_offset | h->value_offset)%SCEADAN_CSR_ALIGN) return 0;
+    if(h->n_rows>size || h->nnz>size) return 0;      /* so the lengths below cannot overflow */
+    if(!sceadan_in_file(h->label_offset,h->n_rows*sizeof(int32_t),size)) return 0;
+    if(!sceadan_in_file(h->row_offset,(h->n_rows+1)*sizeof(uint64_t),size)) return 0;
+    if(!sceadan_in_file(h->index_offset,h->nnz*sizeof(uint32_t),size)) return 0;
+    if(!sceadan_in_file(h->value_offset,h->nnz*sizeof(double),size)) return 0;
+    return 1;
+}
+
+/* rows ascend from 0 to nnz, and every index is a feature */
+static int rows_valid(const struct sceadan_csr *c)
+{
+    if(c->row[0]!=0 || c->row[c->n_rows]!=c->nnz) return 0;
+    for(uint64_t i=0;i<c->n_rows;i++){
+        if(c->row[i]>c->row[i+1]) return 0;
+    }
+    for(uint64_t k=0;k<c->nnz;k++){
+        if(c->index[k]<1 || c->index[k]>c->n_features) return 0;
+    }
+    return 1;
+}
+
+struct sceadan_csr *sceadan_csr_open(const char *fname)
+{
+    size_t size;
+    const void *map = sceadan_mapfile_map(fname,sizeof(struct sceadan_csr_header),
+                                          SCEADAN_CSR_MAGIC,SCEADAN_CSR_VERSION,&size);
+    if(map==0) return 0;
+    const struct sceadan_csr_header *h = (const struct sceadan_csr_header *)map;
+    const uint8_t *base = (const uint8_t *)map;
+    if(!header_valid(h,size)){
+        sceadan_mapfile_unmap(map,size);
+        errno = EINVAL;
+        return 0;
+    }
+    struct sceadan_csr *c = (struct sceadan_csr *)calloc(1,sizeof(*c));
+    if(c==0){
+        sceadan_mapfile_unmap(map,size);
+        return 0;
+    }
+    c->n_rows     = h->n_rows;
+    c->nnz        = h->nnz;
+    c->n_features = h->n_features;
+    c->label      = (const int32_t *)(base + h->label_offset);
+    c->row        = (const uint64_t *)(base + h->row_offset);
+    c->index      = (const uint32_t *)(base + h->index_offset);
+    c->value      = (const double *)(base + h->value_offset);
+    c->map        = map;
+    c->size       = size;
+    if(!rows_valid(c)){
+        sceadan_csr_close(c);
+        errno = EINVAL;
+        return 0;
+    }
+    return c;
+}
+
+void sceadan_csr_close(struct sceadan_csr *c)
+{
+    if(c==0) return;
+    sceadan_mapfile_unmap(c->map,c->size);
+    free(c);
+}
@@ -0,0 +1,95 @@
+#ifndef SCEADAN_EXPORT_H
+#define SCEADAN_EXPORT_H
+
+/*
+ * Training data export: the vectors sceadan_app -t dumps, written as
+ * liblinear/libsvm sparse text or as binary CSR shards.
+ *
+ * Feature indices are liblinear's, as the models use them: unigram u is
+ * u+1, bigram b is 257+b. Values are printed exactly as the JSON dump
+ * prints them (printf "%.16lg"), but each distinct value is formatted
+ * once per thread and then copied.
+ *
+ * A CSR shard is the header below, then, each 64-byte aligned, the
+ * rows' labels, the rows' starts in the index and value arrays
+ * (n_rows+1 of them, the first 0), the nonzero features' indices and
+ * their values. A shard is mapped and used in place, like a binary
+ * model file (sceadan_modelfile.h); the header begins and ends as
+ * every mapped file's (sceadan_mapfile.h).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/cdefs.h>
+
+#include "sceadan_mapfile.h"
+
+__BEGIN_DECLS
+
+/* one vector to export */
+struct sceadan_export_vector {
+    int             label;
+    const double   *ufreq;              /* 256 unigram frequencies */
+    uint32_t        n_bigrams;          /* bigrams that occur, ascending */
+    const uint16_t *bigram;
+    const double   *bfreq;
+};
+
+#define SCEADAN_EXPORT_DOUBLE_MAX 32    /* bytes sceadan_format_double() may write, with the NUL */
+
+char *sceadan_format_uint(char *p,uint64_t u); // what printf("%" PRIu64,u) prints; returns the NUL's address
+char *sceadan_format_double(char *p,double x); // what printf("%.16lg",x) prints; returns the NUL's address
+int  sceadan_export_libsvm(FILE *out,const struct sceadan_export_vector *); // one line; -1 on write error
+
+#define SCEADAN_CSR_MAGIC      "SCEADANC"
+#define SCEADAN_CSR_VERSION    1
+#define SCEADAN_CSR_BYTE_ORDER SCEADAN_MAPFILE_BYTE_ORDER
+#define SCEADAN_CSR_ALIGN      64
+#define SCEADAN_CSR_SHARD_ROWS 65536    /* default rows per shard */
+#define SCEADAN_CSR_SHARD_NNZ  (1 << 24) /* a shard ends at the row that reaches this many features */
+
+struct sceadan_csr_header {
+    char     magic[8];                  /* SCEADAN_CSR_MAGIC, no NUL */
+    uint32_t version;                   /* SCEADAN_CSR_VERSION */
+    uint32_t byte_order;                /* SCEADAN_CSR_BYTE_ORDER, as written */
+    uint32_t n_features;                /* highest feature index */
+    uint32_t reserved;
+    uint64_t n_rows;
+    uint64_t nnz;
+    uint64_t label_offset;              /* n_rows int32_t */
+    uint64_t row_offset;                /* n_rows+1 uint64_t */
+    uint64_t index_offset;              /* nnz uint32_t */
+    uint64_t value_offset;              /* nnz doubles */
+    uint64_t file_size;
+    uint32_t data_crc;                  /* crc32 of everything after the header */
+    uint32_t header_crc;                /* crc32 of the header before this field */
+};
+
+/* Shards named <prefix>-00000.csr, <prefix>-00001.csr, ..., each of up
+ * to shard_rows rows (0 for SCEADAN_CSR_SHARD_ROWS) and, but for its
+ * last row, SCEADAN_CSR_SHARD_NNZ features. Rows may be added
+ * from several threads; a shard holds them in the order they came. */
+typedef struct sceadan_csr_writer sceadan_csr_writer;
+sceadan_csr_writer *sceadan_csr_writer_create(const char *prefix,uint64_t shard_rows);
+int sceadan_csr_writer_add(sceadan_csr_writer *,const struct sceadan_export_vector *); // -1 with errno set on error
+int sceadan_csr_writer_close(sceadan_csr_writer *); // writes the last shard; -1 if that or an earlier write failed
+
+/* A mapped shard; 0 with errno set (EINVAL if it is not a valid shard) on failure */
+struct sceadan_csr {
+    uint64_t        n_rows;
+    uint64_t        nnz;
+    uint32_t        n_features;
+    const int32_t  *label;
+    const uint64_t *row;                /* row i is [row[i], row[i+1]) */
+    const uint32_t *index;
+    const double   *value;
+    const void     *map;
+    size_t          size;
+};
+struct sceadan_csr *sceadan_csr_open(const char *fname);
+void sceadan_csr_close(struct sceadan_csr *);
+
+__END_DECLS
+
+#endif
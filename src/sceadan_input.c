@@ -0,0 +1,111 @@
+/*
+ * sceadan_input.c: mmap input with a buffered-read fallback (see sceadan_input.h)
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sceadan_input.h"
+
+#define INPUT_ALIGN 4096
+
+/* hand buf to cb in pieces of block bytes (any size if block is 0) */
+static int input_pieces(const uint8_t *buf,size_t len,size_t block,sceadan_input_cb cb,void *arg)
+{
+    const size_t piece = block ? block : SCEADAN_INPUT_MAX_PIECE;
+    while(len>0){
+        const size_t n = len<piece ? len : piece;
+        const int r = (*cb)(arg,buf,n);
+        if(r) return r;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Fill a buffer that is a whole number of blocks, so that short reads
+ * from a pipe never split a block. */
+static int input_read(int fd,size_t block,sceadan_input_cb cb,void *arg)
+{
+    size_t bufsize = SCEADAN_INPUT_READ_SIZE;
+    if(block){
+        bufsize = block>bufsize ? block : bufsize/block*block;
+    }
+    void *mem = 0;
+    if(posix_memalign(&mem,INPUT_ALIGN,bufsize)) return -1;
+    uint8_t *buf = (uint8_t *)mem;
+    int r = 0;
+    bool eof = false;
+    while(!eof && r==0){
+        size_t fill = 0;
+        while(fill<bufsize){
+            const ssize_t rd = read(fd,buf+fill,bufsize-fill);
+            if(rd<0 && errno==EINTR) continue;
+            if(rd<0){ r = -1; break; }
+            if(rd==0){ eof = true; break; }
+            fill += rd;
+        }
+        if(r==0) r = input_pieces(buf,fill,block,cb,arg);
+    }
+    free(mem);
+    return r;
+}
+
+/* Map the file a window at a time, so that only one window is mapped
+ * and prefetched at once. If the file's size changes, or a window
+ * cannot be mapped, the rest is read instead: touching a page past the
+ * end of a file that was truncated under the mapping raises SIGBUS. */
+static int input_mmap(int fd,size_t len,size_t block,sceadan_input_cb cb,void *arg,bool prefetch)
+{
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t window = SCEADAN_INPUT_WINDOW;
+    if(block){
+        window = block>window ? block : window/block*block;
+    }
+    size_t off = 0;
+    while(off<len){
+        struct stat st;
+        if(fstat(fd,&st)!=0 || (size_t)st.st_size!=len) break;
+        const size_t n    = len-off<window ? len-off : window;
+        const size_t skew = off%page;   /* mmap offsets must be page-aligned */
+        void *map = mmap(0,n+skew,PROT_READ,MAP_PRIVATE,fd,(off_t)(off-skew));
+        if(map==MAP_FAILED) break;
+        madvise(map,n+skew,MADV_SEQUENTIAL);
+        if(prefetch) madvise(map,n+skew,MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+        madvise(map,n+skew,MADV_HUGEPAGE); /* only a hint; most filesystems ignore it */
+#endif
+        const int r = input_pieces((const uint8_t *)map+skew,n,block,cb,arg);
+        munmap(map,n+skew);
+        if(r) return r;
+        off += n;
+    }
+    if(off==len) return 0;
+    if(lseek(fd,(off_t)off,SEEK_SET)<0) return -1;
+    return input_read(fd,block,cb,arg);
+}
+
+static int input_each(int fd,size_t block,sceadan_input_cb cb,void *arg,bool prefetch)
+{
+    struct stat st;
+    if(fstat(fd,&st)==0 && S_ISREG(st.st_mode) && st.st_size>0 && lseek(fd,0,SEEK_CUR)==0){
+        return input_mmap(fd,(size_t)st.st_size,block,cb,arg,prefetch);
+    }
+    return input_read(fd,block,cb,arg);
+}
+
+int sceadan_input_each(int fd,size_t block,sceadan_input_cb cb,void *arg)
+{
+    return input_each(fd,block,cb,arg,true);
+}
+
+int sceadan_input_each_partial(int fd,size_t block,sceadan_input_cb cb,void *arg)
+{
+    return input_each(fd,block,cb,arg,false);
+}
@@ -0,0 +1,38 @@
+#ifndef SCEADAN_INPUT_H
+#define SCEADAN_INPUT_H
+
+/*
+ * Input path shared by the library and sceadan_app.
+ *
+ * A regular file is mapped a window at a time and handed to the
+ * callback straight from the mapping, so there is no copy and no
+ * read() per block. Pipes, devices, files that cannot be mapped and
+ * files whose size changes while they are read are read into a large
+ * page-aligned buffer instead.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+#define SCEADAN_INPUT_READ_SIZE (1<<20)     /* fallback read size */
+#define SCEADAN_INPUT_MAX_PIECE (1<<30)     /* largest piece passed when block is 0 */
+#define SCEADAN_INPUT_WINDOW    (1<<26)     /* bytes of a regular file mapped at once */
+
+/* return nonzero to stop; sceadan_input_each() then returns that value */
+typedef int (*sceadan_input_cb)(void *arg,const uint8_t *buf,size_t len);
+
+/* Pass the contents of fd to cb. With block>0 every piece is exactly
+ * block bytes except the last; with block==0 the pieces have any size.
+ * Returns 0, -1 on a read error, or the callback's nonzero result. */
+int sceadan_input_each(int fd,size_t block,sceadan_input_cb cb,void *arg);
+
+/* The same, for a callback that may stop early: the mapping is only
+ * read ahead as it is used, not each window prefetched as a whole. */
+int sceadan_input_each_partial(int fd,size_t block,sceadan_input_cb cb,void *arg);
+
+__END_DECLS
+
+#endif
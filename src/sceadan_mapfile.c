@@ -0,0 +1,152 @@
+/*
+ * sceadan_mapfile.c: mapped binary files (see sceadan_mapfile.h)
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "sceadan_mapfile.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+static const uint8_t zeros[64] = {0};
+
+/* zlib's crc32 takes 32-bit lengths */
+uint32_t sceadan_crc32(uint32_t crc,const void *p,uint64_t len)
+{
+    const uint8_t *buf = (const uint8_t *)p;
+    uLong c = crc;
+    while(len>0){
+        const uInt n = (len > (1u << 30)) ? (1u << 30) : (uInt)len;
+        c = crc32(c,buf,n);
+        buf += n;
+        len -= n;
+    }
+    return (uint32_t)c;
+}
+
+static uint32_t crc_zeros(uint32_t crc,uint64_t len)
+{
+    while(len>0){
+        const size_t n = (len < sizeof(zeros)) ? (size_t)len : sizeof(zeros);
+        crc = sceadan_crc32(crc,zeros,n);
+        len -= n;
+    }
+    return crc;
+}
+
+int sceadan_in_file(uint64_t offset,uint64_t len,uint64_t size)
+{
+    return offset <= size && len <= size - offset;
+}
+
+static struct sceadan_mapfile_suffix *suffix(const void *header,size_t header_size)
+{
+    return (struct sceadan_mapfile_suffix *)(uintptr_t)((const uint8_t *)header + header_size - sizeof(struct sceadan_mapfile_suffix));
+}
+
+static uint32_t header_crc(const void *header,size_t header_size)
+{
+    return sceadan_crc32(0,header,header_size - sizeof(uint32_t));
+}
+
+static int write_zeros(FILE *f,uint64_t len)
+{
+    while(len>0){
+        const size_t n = (len < sizeof(zeros)) ? (size_t)len : sizeof(zeros);
+        if(fwrite(zeros,1,n,f)!=n) return 0;
+        len -= n;
+    }
+    return 1;
+}
+
+int sceadan_mapfile_write(const char *fname,void *header,size_t header_size,
+                          const struct sceadan_mapfile_section *sections,int nsections)
+{
+    struct sceadan_mapfile_suffix *s = suffix(header,header_size);
+    uint32_t crc = 0;
+    uint64_t pos = header_size;
+    for(int i=0;i<nsections;i++){
+        crc = crc_zeros(crc,sections[i].offset - pos);
+        crc = sceadan_crc32(crc,sections[i].data,sections[i].len);
+        pos = sections[i].offset + sections[i].len;
+    }
+    s->file_size  = pos;
+    s->data_crc   = crc;
+    s->header_crc = header_crc(header,header_size);
+
+    char tmp[4096 + 32];
+    snprintf(tmp,sizeof(tmp),"%s.%d.tmp",fname,(int)getpid());
+    FILE *f = fopen(tmp,"wb");
+    if(f==0) return -1;
+    int ok = fwrite(header,1,header_size,f) == header_size;
+    pos = header_size;
+    for(int i=0;i<nsections && ok;i++){
+        ok = write_zeros(f,sections[i].offset - pos) &&
+            fwrite(sections[i].data,1,sections[i].len,f) == sections[i].len;
+        pos = sections[i].offset + sections[i].len;
+    }
+    if(fclose(f)!=0 || !ok || rename(tmp,fname)!=0){
+        const int e = errno;
+        unlink(tmp);
+        errno = e;
+        return -1;
+    }
+    return 0;
+}
+
+static int header_valid(const void *header,size_t header_size,const char *magic,uint32_t version,uint64_t size)
+{
+    const struct sceadan_mapfile_prefix *p = (const struct sceadan_mapfile_prefix *)header;
+    const struct sceadan_mapfile_suffix *s = suffix(header,header_size);
+    if(memcmp(p->magic,magic,sizeof(p->magic))!=0) return 0;
+    if(p->version!=version) return 0;
+    if(p->byte_order!=SCEADAN_MAPFILE_BYTE_ORDER) return 0;
+    if(s->header_crc!=header_crc(header,header_size)) return 0;
+    if(s->file_size!=size) return 0;
+    return 1;
+}
+
+const void *sceadan_mapfile_map(const char *fname,size_t header_size,const char *magic,uint32_t version,size_t *size)
+{
+    const int fd = open(fname,O_RDONLY|O_BINARY);
+    if(fd<0) return 0;
+    struct stat st;
+    if(fstat(fd,&st)<0){
+        close(fd);
+        return 0;
+    }
+    const size_t sz = (size_t)st.st_size;
+    if(sz<header_size){
+        close(fd);
+        errno = EINVAL;
+        return 0;
+    }
+    void *map = mmap(0,sz,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if(map==MAP_FAILED) return 0;
+    const uint8_t *base = (const uint8_t *)map;
+    if(!header_valid(map,header_size,magic,version,sz) ||
+        suffix(map,header_size)->data_crc!=sceadan_crc32(0,base+header_size,sz-header_size)){
+        munmap(map,sz);
+        errno = EINVAL;
+        return 0;
+    }
+    *size = sz;
+    return map;
+}
+
+void sceadan_mapfile_unmap(const void *map,size_t size)
+{
+    munmap((void *)(uintptr_t)map,size);
+}
@@ -0,0 +1,59 @@
+#ifndef SCEADAN_MAPFILE_H
+#define SCEADAN_MAPFILE_H
+
+/*
+ * What binary model files (sceadan_modelfile.h) and CSR shards
+ * (sceadan_export.h) have in common. The header starts with the fields
+ * of struct sceadan_mapfile_prefix and ends with those of struct
+ * sceadan_mapfile_suffix; the sections after it are at aligned offsets
+ * with zeros between them. A file is written beside its name and
+ * renamed into place, so a process that has the old file mapped keeps
+ * its copy rather than seeing it change, and is used in place from a
+ * read-only mapping.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+#define SCEADAN_MAPFILE_BYTE_ORDER 0x01020304
+#define SCEADAN_ALIGN_UP(x,a) (((x) + (a) - 1) & ~(uint64_t)((a) - 1))
+
+struct sceadan_mapfile_prefix {
+    char     magic[8];                  /* no NUL */
+    uint32_t version;
+    uint32_t byte_order;                /* SCEADAN_MAPFILE_BYTE_ORDER, as written */
+};
+
+struct sceadan_mapfile_suffix {
+    uint64_t file_size;
+    uint32_t data_crc;                  /* crc32 of everything after the header */
+    uint32_t header_crc;                /* crc32 of the header before this field */
+};
+
+struct sceadan_mapfile_section {
+    const void *data;
+    uint64_t    offset;                 /* from the start of the file, in ascending order */
+    uint64_t    len;
+};
+
+uint32_t sceadan_crc32(uint32_t crc,const void *buf,uint64_t len); // crc32 of any length; start with 0
+int sceadan_in_file(uint64_t offset,uint64_t len,uint64_t size); // whether [offset, offset+len) lies in size bytes
+
+/* Fill in the suffix of header (header_size bytes) for these sections,
+ * write the file and rename it to fname; -1 with errno set on failure,
+ * leaving any old fname as it was. */
+int sceadan_mapfile_write(const char *fname,void *header,size_t header_size,
+                          const struct sceadan_mapfile_section *,int nsections);
+
+/* Map fname read-only if it starts with a header of header_size with
+ * this magic and version, this byte order, its size and good crcs; 0
+ * with errno set (EINVAL if it does not) on failure. */
+const void *sceadan_mapfile_map(const char *fname,size_t header_size,const char *magic,uint32_t version,size_t *size);
+void sceadan_mapfile_unmap(const void *map,size_t size);
+
+__END_DECLS
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ * sceadan_modelfile.c: binary model files (see sceadan_modelfile.h)
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LINEAR_H
+#include <linear.h>
+#endif
+#ifdef HAVE_LIBLINEAR_LINEAR_H
+#include <liblinear/linear.h>
+#endif
+
+#include "sceadan.h"
+#include "sceadan_mapfile.h"
+#include "sceadan_modelfile.h"
+
+struct sceadan_modelfile {
+    const uint8_t *map;
+    size_t         size;
+    struct model   model;               /* w and label point into the mapping */
+    struct sceadan_qmodel qmodel;       /* likewise scale and q, if quantized */
+};
+
+#define ALIGN_UP(x) SCEADAN_ALIGN_UP(x,SCEADAN_MODELFILE_ALIGN)
+
+static size_t weight_bytes(int quant)
+{
+    if(quant==SCEADAN_QUANT_INT8) return sizeof(int8_t);
+    if(quant==SCEADAN_QUANT_FP16) return sizeof(uint16_t);
+    return sizeof(double);
+}
+
+int sceadan_modelfile_is(const char *fname)
+{
+    char magic[8];
+    FILE *f = fopen(fname,"rb");
+    if(f==0) return 0;
+    const int is = fread(magic,1,sizeof(magic),f) == sizeof(magic) &&
+        memcmp(magic,SCEADAN_MODELFILE_MAGIC,sizeof(magic)) == 0;
+    fclose(f);
+    return is;
+}
+
+/* the magic, version, byte order, size and crcs are sceadan_mapfile_map()'s */
+static int header_valid(const struct sceadan_modelfile_header *h,uint64_t size)
+{
+    if(h->nr_class<1 || h->nr_feature<1) return 0;
+    const int nr_w = (h->nr_class == 2 && h->solver_type != MCSVM_CS) ? 1 : h->nr_class;
+    if(h->nr_w!=nr_w) return 0;
+    if(h->w_size!=((h->bias>=0) ? h->nr_feature+1 : h->nr_feature)) return 0;
+    if(h->quant!=SCEADAN_QUANT_NONE && h->quant!=SCEADAN_QUANT_INT8 && h->quant!=SCEADAN_QUANT_FP16) return 0;
+    if(h->weight_offset%SCEADAN_MODELFILE_ALIGN) return 0;
+    if(!sceadan_in_file(h->label_offset,(uint64_t)h->nr_class*sizeof(int32_t),size)) return 0;
+    if(h->quant!=SCEADAN_QUANT_NONE && !sceadan_in_file(h->scale_offset,(uint64_t)h->nr_w*sizeof(float),size)) return 0;
+    if(!sceadan_in_file(h->weight_offset,(uint64_t)h->w_size*h->nr_w*weight_bytes(h->quant),size)) return 0;
+    return 1;
+}
+
+sceadan_modelfile *sceadan_modelfile_open(const char *fname)
+{
+    size_t size;
+    const void *map = sceadan_mapfile_map(fname,sizeof(struct sceadan_modelfile_header),
+                                          SCEADAN_MODELFILE_MAGIC,SCEADAN_MODELFILE_VERSION,&size);
+    if(map==0) return 0;
+    const struct sceadan_modelfile_header *h = (const struct sceadan_modelfile_header *)map;
+    if(!header_valid(h,size)){
+        sceadan_mapfile_unmap(map,size);
+        errno = EINVAL;
+        return 0;
+    }
+    sceadan_modelfile *mf = (sceadan_modelfile *)calloc(1,sizeof(*mf));
+    if(mf==0){
+        sceadan_mapfile_unmap(map,size);
+        return 0;
+    }
+    mf->map  = (const uint8_t *)map;
+    mf->size = size;
+
+    /* liblinear's struct is not const, but nothing writes through it */
+    struct model *m = &mf->model;
+    m->param.solver_type = h->solver_type;
+    m->nr_class   = h->nr_class;
+    m->nr_feature = h->nr_feature;
+    m->bias       = h->bias;
+    m->label      = (int *)(uintptr_t)(mf->map + h->label_offset);
+    if(h->quant==SCEADAN_QUANT_NONE){
+        m->w = (double *)(uintptr_t)(mf->map + h->weight_offset);
+    } else {
+        mf->qmodel.model = m;
+        mf->qmodel.quant = h->quant;
+        mf->qmodel.scale = (const float *)(mf->map + h->scale_offset);
+        mf->qmodel.q     = mf->map + h->weight_offset;
+    }
+    return mf;
+}
+
+void sceadan_modelfile_close(sceadan_modelfile *mf)
+{
+    if(mf==0) return;
+    sceadan_mapfile_unmap(mf->map,mf->size);
+    free(mf);
+}
+
+const struct model *sceadan_modelfile_model(const sceadan_modelfile *mf)
+{
+    return &mf->model;
+}
+
+const struct sceadan_qmodel *sceadan_modelfile_qmodel(const sceadan_modelfile *mf)
+{
+    return mf->qmodel.model ? &mf->qmodel : 0;
+}
+
+int sceadan_modelfile_write(const char *fname,const struct model *model,const struct sceadan_qmodel *qm)
+{
+    const int quant = qm ? qm->quant : SCEADAN_QUANT_NONE;
+    if(qm==0 && model->w==0){
+        errno = EINVAL;                 /* a quantized precompiled model has no doubles */
+        return -1;
+    }
+    struct sceadan_modelfile_header h;
+    memset(&h,0,sizeof(h));
+    memcpy(h.magic,SCEADAN_MODELFILE_MAGIC,sizeof(h.magic));
+    h.version     = SCEADAN_MODELFILE_VERSION;
+    h.byte_order  = SCEADAN_MODELFILE_BYTE_ORDER;
+    h.solver_type = model->param.solver_type;
+    h.nr_class    = model->nr_class;
+    h.nr_feature  = model->nr_feature;
+    h.nr_w        = (model->nr_class == 2 && model->param.solver_type != MCSVM_CS) ? 1 : model->nr_class;
+    h.w_size      = (model->bias >= 0) ? model->nr_feature + 1 : model->nr_feature;
+    h.quant       = quant;
+    h.bias        = model->bias;
+    h.label_offset = ALIGN_UP(sizeof(h));
+    uint64_t end  = h.label_offset + (uint64_t)h.nr_class * sizeof(int32_t);
+    if(quant!=SCEADAN_QUANT_NONE){
+        h.scale_offset = ALIGN_UP(end);
+        end = h.scale_offset + (uint64_t)h.nr_w * sizeof(float);
+    }
+    h.weight_offset = ALIGN_UP(end);
+
+    int32_t *labels = (int32_t *)malloc((size_t)h.nr_class * sizeof(int32_t));
+    if(labels==0) return -1;
+    for(int i=0;i<h.nr_class;i++) labels[i] = model->label[i];
+    struct sceadan_mapfile_section sections[3];
+    int n = 0;
+    sections[n++] = (struct sceadan_mapfile_section){labels,h.label_offset,(uint64_t)h.nr_class * sizeof(int32_t)};
+    if(quant!=SCEADAN_QUANT_NONE){
+        sections[n++] = (struct sceadan_mapfile_section){qm->scale,h.scale_offset,(uint64_t)h.nr_w * sizeof(float)};
+    }
+    sections[n++] = (struct sceadan_mapfile_section){qm ? qm->q : (const void *)model->w,h.weight_offset,
+                                                     (uint64_t)h.w_size * h.nr_w * weight_bytes(quant)};
+    const int r = sceadan_mapfile_write(fname,&h,sizeof(h),sections,n);
+    free(labels);
+    return r;
+}
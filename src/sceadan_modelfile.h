@@ -0,0 +1,67 @@
+#ifndef SCEADAN_MODELFILE_H
+#define SCEADAN_MODELFILE_H
+
+/*
+ * Binary model files, written by mcompile -b and mapped by sceadan_open().
+ *
+ * The file is the header below, the label table, the per-class scales
+ * of a quantized model, and the weights, feature-major like liblinear's
+ * (row i holds feature i+1's weight for every class) and 64-byte
+ * aligned. Everything is in the writer's byte order, which byte_order
+ * records. The weights are used straight from a read-only mapping, so
+ * opening a model costs a checksum rather than a parse, and processes
+ * using the same file share one copy of it in the page cache. The
+ * header begins and ends as every mapped file's (sceadan_mapfile.h).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+#include "sceadan_mapfile.h"
+
+__BEGIN_DECLS
+
+#define SCEADAN_MODELFILE_MAGIC      "SCEADANM"
+#define SCEADAN_MODELFILE_VERSION    1
+#define SCEADAN_MODELFILE_BYTE_ORDER SCEADAN_MAPFILE_BYTE_ORDER
+#define SCEADAN_MODELFILE_ALIGN      64
+
+struct sceadan_modelfile_header {
+    char     magic[8];                  /* SCEADAN_MODELFILE_MAGIC, no NUL */
+    uint32_t version;                   /* SCEADAN_MODELFILE_VERSION */
+    uint32_t byte_order;                /* SCEADAN_MODELFILE_BYTE_ORDER, as written */
+    int32_t  solver_type;
+    int32_t  nr_class;
+    int32_t  nr_feature;
+    int32_t  nr_w;                      /* columns of weights */
+    int32_t  w_size;                    /* rows of weights: nr_feature, and one more with a bias */
+    int32_t  quant;                     /* SCEADAN_QUANT_*; NONE is doubles */
+    double   bias;
+    uint64_t label_offset;              /* nr_class int32_t */
+    uint64_t scale_offset;              /* nr_w floats, if quantized */
+    uint64_t weight_offset;             /* w_size*nr_w weights */
+    uint64_t file_size;
+    uint32_t data_crc;                  /* crc32 of everything after the header */
+    uint32_t header_crc;                /* crc32 of the header before this field */
+};
+
+struct model;
+struct sceadan_qmodel;
+typedef struct sceadan_modelfile sceadan_modelfile;
+
+int sceadan_modelfile_is(const char *fname); // 1 if fname starts with the magic
+
+/* Map and check a model file; 0 with errno set (EINVAL if it is not a
+ * valid model file of this version and byte order) on failure. */
+sceadan_modelfile *sceadan_modelfile_open(const char *fname);
+void sceadan_modelfile_close(sceadan_modelfile *);
+const struct model *sceadan_modelfile_model(const sceadan_modelfile *);
+const struct sceadan_qmodel *sceadan_modelfile_qmodel(const sceadan_modelfile *); // 0 unless quantized
+
+/* Write model, or qm's weights if qm is not 0; -1 with errno set on failure */
+int sceadan_modelfile_write(const char *fname,const struct model *model,const struct sceadan_qmodel *qm);
+
+__END_DECLS
+
+#endif
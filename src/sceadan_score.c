@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2012-2013 The University of Texas at San Antonio
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Public License for more details.
+ */
+
+/*
+ * SIMD class-score kernels with runtime CPU dispatch.
+ *
+ * All variants are compiled into every binary; the widest one the
+ * running CPU supports is chosen with cpuid when a sceadan is opened.
+ * The scalar and SSE4.2 kernels perform the same multiply-then-add
+ * as liblinear and give bit-identical decision values. The AVX2 and
+ * AVX-512 kernels use fused multiply-add, which can differ in the
+ * last bit but not, in practice, in the predicted label.
+ */
+
+#include "config.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sceadan.h"
+#include "sceadan_score.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCEADAN_X86 1
+#include <immintrin.h>
+#endif
+
+static void score_row_scalar(const double *w, int nr_w, double value, double *dec_values)
+{
+    for (int j = 0; j < nr_w; j++) {
+        dec_values[j] += w[j] * value;
+    }
+}
+
+/* IEEE 754 binary16 conversions, round to nearest even */
+uint16_t sceadan_half_from_float(float f)
+{
+    uint32_t x;
+    memcpy(&x,&f,sizeof(x));
+    const uint32_t sign = (x >> 16) & 0x8000;
+    const uint32_t absx = x & 0x7fffffff;
+    if (absx >= 0x7f800000) {           /* inf or nan */
+        return sign | 0x7c00 | (absx > 0x7f800000 ? 0x200 : 0);
+    }
+    if (absx >= 0x477ff000) {           /* rounds to more than 65504 */
+        return sign | 0x7c00;
+    }
+    if (absx < 0x38800000) {            /* subnormal or zero in half */
+        if (absx < 0x33000000) return sign;
+        const uint32_t mant  = (absx & 0x7fffff) | 0x800000;
+        const int      shift = 126 - (int)(absx >> 23);
+        uint32_t h = mant >> shift;
+        const uint32_t rem  = mant & ((1u << shift) - 1);
+        const uint32_t half = 1u << (shift - 1);
+        if (rem > half || (rem == half && (h & 1))) h++;
+        return sign | h;
+    }
+    uint32_t h = ((absx - 0x38000000) >> 13);
+    const uint32_t rem = absx & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+    return sign | h;
+}
+
+float sceadan_half_to_float(uint16_t h)
+{
+    const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    const uint32_t exp  = (h >> 10) & 0x1f;
+    const uint32_t mant = h & 0x3ff;
+    uint32_t x;
+    if (exp == 0) {
+        if (mant == 0) {
+            x = sign;
+        } else {                        /* subnormal: renormalize */
+            int e = -1;
+            uint32_t m = mant;
+            do { e++; m <<= 1; } while ((m & 0x400) == 0);
+            x = sign | ((uint32_t)(112 - e) << 23) | ((m & 0x3ff) << 13);
+        }
+    } else if (exp == 0x1f) {
+        x = sign | 0x7f800000 | (mant << 13);
+    } else {
+        x = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    float f;
+    memcpy(&f,&x,sizeof(f));
+    return f;
+}
+
+static void score_row_q8_scalar(const void *q, int nr_w, double value, double *dec_values)
+{
+    const int8_t *w = (const int8_t *)q;
+    for (int j = 0; j < nr_w; j++) {
+        dec_values[j] += w[j] * value;
+    }
+}
+
+static void score_row_f16_scalar(const void *q, int nr_w, double value, double *dec_values)
+{
+    const uint16_t *w = (const uint16_t *)q;
+    for (int j = 0; j < nr_w; j++) {
+        dec_values[j] += sceadan_half_to_float(w[j]) * value;
+    }
+}
+
+#ifdef SCEADAN_X86
+__attribute__((target("sse4.2")))
+static void score_row_sse42(const double *w, int nr_w, double value, double *dec_values)
+{
+    const __m128d v = _mm_set1_pd(value);
+    int j = 0;
+    for (; j + 2 <= nr_w; j += 2) {
+        const __m128d d = _mm_loadu_pd(dec_values + j);
+        _mm_storeu_pd(dec_values + j, _mm_add_pd(d, _mm_mul_pd(_mm_loadu_pd(w + j), v)));
+    }
+    for (; j < nr_w; j++) {
+        dec_values[j] += w[j] * value;
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void score_row_avx2(const double *w, int nr_w, double value, double *dec_values)
+{
+    const __m256d v = _mm256_set1_pd(value);
+    int j = 0;
+    for (; j + 4 <= nr_w; j += 4) {
+        const __m256d d = _mm256_loadu_pd(dec_values + j);
+        _mm256_storeu_pd(dec_values + j, _mm256_fmadd_pd(_mm256_loadu_pd(w + j), v, d));
+    }
+    for (; j < nr_w; j++) {
+        dec_values[j] += w[j] * value;
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void score_row_q8_avx2(const void *q, int nr_w, double value, double *dec_values)
+{
+    const int8_t *w = (const int8_t *)q;
+    const __m256d v = _mm256_set1_pd(value);
+    int j = 0;
+    for (; j + 4 <= nr_w; j += 4) {
+        int32_t four;
+        memcpy(&four, w + j, sizeof(four));
+        const __m256d wd = _mm256_cvtepi32_pd(_mm_cvtepi8_epi32(_mm_cvtsi32_si128(four)));
+        const __m256d d = _mm256_loadu_pd(dec_values + j);
+        _mm256_storeu_pd(dec_values + j, _mm256_fmadd_pd(wd, v, d));
+    }
+    for (; j < nr_w; j++) {
+        dec_values[j] += w[j] * value;
+    }
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static void score_row_f16_avx2(const void *q, int nr_w, double value, double *dec_values)
+{
+    const uint16_t *w = (const uint16_t *)q;
+    const __m256d v = _mm256_set1_pd(value);
+    int j = 0;
+    for (; j + 4 <= nr_w; j += 4) {
+        const __m256d wd = _mm256_cvtps_pd(_mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)(w + j))));
+        const __m256d d = _mm256_loadu_pd(dec_values + j);
+        _mm256_storeu_pd(dec_values + j, _mm256_fmadd_pd(wd, v, d));
+    }
+    for (; j < nr_w; j++) {
+        dec_values[j] += sceadan_half_to_float(w[j]) * value;
+    }
+}
+
+__attribute__((target("avx512f")))
+static void score_row_avx512(const double *w, int nr_w, double value, double *dec_values)
+{
+    const __m512d v = _mm512_set1_pd(value);
+    int j = 0;
+    for (; j + 8 <= nr_w; j += 8) {
+        const __m512d d = _mm512_loadu_pd(dec_values + j);
+        _mm512_storeu_pd(dec_values + j, _mm512_fmadd_pd(_mm512_loadu_pd(w + j), v, d));
+    }
+    if (j < nr_w) {                     /* masked tail */
+        const __mmask8 m = (__mmask8)((1u << (nr_w - j)) - 1);
+        const __m512d d = _mm512_maskz_loadu_pd(m, dec_values + j);
+        _mm512_mask_storeu_pd(dec_values + j, m,
+                              _mm512_fmadd_pd(_mm512_maskz_loadu_pd(m, w + j), v, d));
+    }
+}
+#endif
+
+static int isa_supported(int isa)
+{
+    switch(isa){
+    case SCEADAN_ISA_SCALAR:
+        return 1;
+#ifdef SCEADAN_X86
+    case SCEADAN_ISA_SSE42:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.2");
+    case SCEADAN_ISA_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case SCEADAN_ISA_AVX512:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+        return 0;
+    }
+}
+
+sceadan_score_row_t sceadan_score_row_kernel(int isa)
+{
+    if(!isa_supported(isa)) return 0;
+    switch(isa){
+#ifdef SCEADAN_X86
+    case SCEADAN_ISA_SSE42:  return score_row_sse42;
+    case SCEADAN_ISA_AVX2:   return score_row_avx2;
+    case SCEADAN_ISA_AVX512: return score_row_avx512;
+#endif
+    default:                 return score_row_scalar;
+    }
+}
+
+/* The quantized rows are converted to double before the multiply, so
+ * AVX2 is as wide as it is worth going; AVX-512 machines use it too. */
+sceadan_score_row_q_t sceadan_score_row_q_kernel(int isa,int quant)
+{
+    if(!isa_supported(isa)) return 0;
+#ifdef SCEADAN_X86
+    if(isa>=SCEADAN_ISA_AVX2 && isa_supported(SCEADAN_ISA_AVX2)){
+        if(quant==SCEADAN_QUANT_INT8) return score_row_q8_avx2;
+        if(quant==SCEADAN_QUANT_FP16 && __builtin_cpu_supports("f16c")) return score_row_f16_avx2;
+    }
+#endif
+    switch(quant){
+    case SCEADAN_QUANT_INT8: return score_row_q8_scalar;
+    case SCEADAN_QUANT_FP16: return score_row_f16_scalar;
+    default:                 return 0;
+    }
+}
+
+int sceadan_isa_best(void)
+{
+    static int best = -1;               /* cpuid is only consulted once */
+    if(best<0){
+        int isa = SCEADAN_ISA_MAX;
+        while(isa>SCEADAN_ISA_SCALAR && !isa_supported(isa)) isa--;
+        best = isa;
+    }
+    return best;
+}
+
+const char *sceadan_isa_name(int isa)
+{
+    switch(isa){
+    case SCEADAN_ISA_SCALAR: return "scalar";
+    case SCEADAN_ISA_SSE42:  return "sse4.2";
+    case SCEADAN_ISA_AVX2:   return "avx2";
+    case SCEADAN_ISA_AVX512: return "avx512";
+    default:                 return 0;
+    }
+}
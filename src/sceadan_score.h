@@ -0,0 +1,32 @@
+#ifndef SCEADAN_SCORE_H
+#define SCEADAN_SCORE_H
+
+/*
+ * Class-score kernels used by the linear predictor.
+ *
+ * The weight matrix is stored feature-major, w[i*nr_w+j], so scoring
+ * one nonzero feature means adding value * (one row of nr_w weights)
+ * to the nr_w decision values.  Each kernel does exactly that; they
+ * differ only in the instruction set used.
+ */
+
+#include "sceadan.h"
+
+__BEGIN_DECLS
+
+typedef void (*sceadan_score_row_t)(const double *w, int nr_w, double value, double *dec_values);
+
+/* Quantized rows hold nr_w int8_t or IEEE half (uint16_t) weights.
+ * The kernels accumulate value * q; the caller applies the per-class
+ * scale to the decision values once, after all rows are summed. */
+typedef void (*sceadan_score_row_q_t)(const void *q, int nr_w, double value, double *dec_values);
+
+sceadan_score_row_t   sceadan_score_row_kernel(int isa); // 0 if isa is not supported
+sceadan_score_row_q_t sceadan_score_row_q_kernel(int isa,int quant); // quant is SCEADAN_QUANT_*
+
+uint16_t sceadan_half_from_float(float f);
+float    sceadan_half_to_float(uint16_t h);
+
+__END_DECLS
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ * sceadan_scorer.cpp: a scorer specialized for the precompiled model
+ *
+ * mcompile -x writes sceadan_model_specialized.h, which holds the
+ * model's dimensions as constants and its weights with every row padded
+ * to whole 64-byte lines. The template below is instantiated for exactly
+ * those dimensions: the decision values live in vector registers for the
+ * whole walk over the features, every load is aligned and there is no
+ * remainder loop, where the generic path calls a kernel per feature that
+ * loads and stores all of them. There is one instantiation per vector
+ * width, chosen by sceadan_set_isa() like the kernels in sceadan_score.c.
+ * The plain one multiplies then adds, as the scalar and SSE4.2 kernels
+ * do; with GCC's default -ffp-contract=fast the AVX2 and AVX-512 ones
+ * fuse them, as those kernels do.
+ *
+ * Without the header this file is empty, and sceadan_scorer_precompiled()
+ * is the weak default in sceadan.c, which returns 0.
+ */
+
+#include "config.h"
+#include <stdint.h>
+#include <string.h>
+
+#include "sceadan.h"
+
+#if defined(__has_include)
+#if __has_include("sceadan_model_specialized.h")
+#include "sceadan_model_specialized.h"
+#define SCEADAN_SPECIALIZED 1
+#endif
+#endif
+
+#ifdef SCEADAN_SPECIALIZED
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCEADAN_X86 1
+#endif
+
+namespace {
+
+typedef double v2d __attribute__((vector_size(16)));
+typedef double v4d __attribute__((vector_size(32)));
+typedef double v8d __attribute__((vector_size(64)));
+
+const int n_unigram = 256;
+
+/* acc += row * value, for one padded row of weights */
+template <typename Vec, int Blocks>
+__attribute__((always_inline)) inline void add_row(Vec *acc, const double *row, double value)
+{
+    const int lanes = sizeof(Vec) / sizeof(double);
+    Vec v;
+    for (int k = 0; k < lanes; k++) v[k] = value;
+#pragma GCC unroll 64
+    for (int j = 0; j < Blocks; j++) {
+        acc[j] += *(const Vec *) (row + j * lanes) * v;
+    }
+}
+
+/* The same walk as decision_values() in sceadan.c: the nonzero unigrams,
+ * the bigrams in ascending order, then the bias. */
+template <typename Vec, int NrW, int PaddedW, int NrFeature, bool HasBias>
+__attribute__((always_inline)) inline void score(const double (*w)[PaddedW], double bias,
+                                                 const double *ufreq, uint32_t n_bigrams,
+                                                 const uint16_t *bigram, const double *bfreq,
+                                                 double *dec_values)
+{
+    const int lanes  = sizeof(Vec) / sizeof(double);
+    const int blocks = PaddedW / lanes;
+    static_assert(PaddedW % lanes == 0, "rows are padded to whole vectors");
+
+    Vec acc[blocks];
+    for (int j = 0; j < blocks; j++) acc[j] = Vec{};
+
+    for (int k = 0; k < n_unigram && k < NrFeature; k++) {
+        if (ufreq[k] > 0) add_row<Vec, blocks>(acc, w[k], ufreq[k]);
+    }
+    for (uint32_t k = 0; k < n_bigrams; k++) {
+        const int row = n_unigram + bigram[k];
+        if (row >= NrFeature) break;
+        add_row<Vec, blocks>(acc, w[row], bfreq[k]);
+    }
+    if (HasBias) add_row<Vec, blocks>(acc, w[NrFeature], bias);
+
+    alignas(64) double out[PaddedW];
+    for (int j = 0; j < blocks; j++) *(Vec *) (out + j * lanes) = acc[j];
+    memcpy(dec_values, out, NrW * sizeof(double));
+}
+
+template <typename Vec>
+__attribute__((always_inline)) inline void score_specialized(const double *ufreq, uint32_t n_bigrams,
+                                                             const uint16_t *bigram, const double *bfreq,
+                                                             double *dec_values)
+{
+    using namespace specialized;
+    score<Vec, nr_w, padded_w, nr_feature, (bias >= 0)>(w, bias, ufreq, n_bigrams, bigram, bfreq, dec_values);
+}
+
+void score_plain(const double *ufreq, uint32_t n_bigrams, const uint16_t *bigram, const double *bfreq,
+                 double *dec_values)
+{
+    score_specialized<v2d>(ufreq, n_bigrams, bigram, bfreq, dec_values);
+}
+
+#ifdef SCEADAN_X86
+__attribute__((target("avx2,fma")))
+void score_avx2(const double *ufreq, uint32_t n_bigrams, const uint16_t *bigram, const double *bfreq,
+                double *dec_values)
+{
+    score_specialized<v4d>(ufreq, n_bigrams, bigram, bfreq, dec_values);
+}
+
+__attribute__((target("avx512f")))
+void score_avx512(const double *ufreq, uint32_t n_bigrams, const uint16_t *bigram, const double *bfreq,
+                  double *dec_values)
+{
+    score_specialized<v8d>(ufreq, n_bigrams, bigram, bfreq, dec_values);
+}
+#endif
+
+const sceadan_scorer scorer = {
+    specialized::nr_class,
+    specialized::nr_feature,
+    specialized::bias,
+    specialized::label,
+    specialized::padded_w,
+    &specialized::w[0][0],
+    specialized::fingerprint,
+#ifdef SCEADAN_X86
+    {score_plain, score_plain, score_avx2, score_avx512},
+#else
+    {score_plain, 0, 0, 0},
+#endif
+};
+
+}
+
+const struct sceadan_scorer *sceadan_scorer_precompiled(void)
+{
+    return &scorer;
+}
+
+#endif
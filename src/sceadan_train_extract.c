@@ -0,0 +1,417 @@
+/*
+ * sceadan_train_extract.c:
+ * Build a training set for liblinear from a manifest of class directories.
+ *
+ * Each manifest line is a class (a type name or number) and a directory,
+ * which is walked recursively. The items of a class are its files, or
+ * with -b every whole block of that many bytes in its files. Up to -n
+ * items per class are reservoir sampled (Algorithm L) from the file
+ * sizes alone, so only the chosen blocks are ever read. The samples are
+ * sorted by file and offset and split into shards, which -j threads
+ * extract and write in parallel. A shard's contents depend only on the
+ * manifest, the options and the seed, not on the number of threads.
+ *
+ * The shards are liblinear/libsvm text (<prefix>-00000.libsvm, ...) for
+ * liblinear's train, or with -f csr binary CSR shards (see
+ * sceadan_export.h); shard k is <prefix>-k-00000.csr and so on.
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#include "sceadan.h"
+#include "sceadan_export.h"
+#include "threadpool.h"
+
+static size_t   opt_block = 0;          /* -b: block size; 0 samples whole files */
+static uint64_t opt_per_class = 1800;   /* -n: items per class, as the shipped model; 0 for all */
+static const char *opt_prefix = "train"; /* -o */
+static int      opt_csr = 0;            /* -f csr */
+static uint64_t opt_shard_rows = 8192;  /* -r */
+static uint64_t opt_seed = 1;           /* -s */
+
+struct file {
+    char    *path;
+    uint64_t size;
+};
+
+struct class_dir {
+    int      label;
+    size_t   first_file;                /* its files, files[first_file..end_file) */
+    size_t   end_file;
+    uint64_t nitems;
+    uint64_t *cum;                      /* items before each file, and nitems at the end */
+};
+
+struct sample {
+    size_t   file;
+    uint64_t offset;
+    int      label;
+    int      cls;                       /* its class_dir */
+};
+
+/* one shard: samples [first, first+n) */
+struct shard {
+    unsigned number;
+    size_t   first;
+    size_t   n;
+};
+
+/* a worker's own classifier, with its open file and block buffer */
+struct worker {
+    sceadan     *s;
+    sceadan_ctx *ctx;
+    uint8_t     *buf;
+    size_t       file;
+    int          fd;
+    uint64_t    *vectors;               /* written, by class_dir */
+    uint64_t     skipped;               /* samples that could not be read whole */
+};
+
+static struct file   *files;
+static size_t         nfiles,files_alloc;
+static struct sample *samples;
+static size_t         nsamples;
+
+static void usage(void) __attribute__((noreturn));
+static void usage(void)
+{
+    puts("usage: sceadan_train_extract [options] manifest");
+    puts("  where each line of manifest is <class> <directory>; <class> is a type name or number");
+    puts("  -b <bytes>   - sample blocks of this size from the files (default 0: whole files)");
+    puts("  -n <count>   - items to sample per class (default 1800; 0 for all of them)");
+    puts("  -j <n>       - threads (default the number of CPUs)");
+    puts("  -o <prefix>  - shards are <prefix>-00000.libsvm, ... (default train)");
+    puts("  -f libsvm|csr - liblinear/libsvm text (default), or binary CSR shards");
+    puts("  -r <rows>    - rows per shard (default 8192)");
+    puts("  -s <seed>    - for the sampling (default 1)");
+    puts("then: cat train-*.libsvm > train.txt; train -s 2 -c 256 -e 0.005 train.txt model;");
+    puts("      mcompile model > sceadan_model_precompiled.c");
+    exit(1);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/* splitmix64, and uniform doubles in (0,1) from it */
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static double uniform(uint64_t *state)
+{
+    return ((next_random(state) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+static int compare_files(const void *a,const void *b)
+{
+    return strcmp(((const struct file *)a)->path,((const struct file *)b)->path);
+}
+
+static int compare_samples(const void *a,const void *b)
+{
+    const struct sample *x = (const struct sample *)a;
+    const struct sample *y = (const struct sample *)b;
+    if(x->file!=y->file) return (x->file < y->file) ? -1 : 1;
+    if(x->offset!=y->offset) return (x->offset < y->offset) ? -1 : 1;
+    return 0;
+}
+
+static int add_file(const char *path,const struct stat *st,int typeflag,struct FTW *ftw)
+{
+    if(typeflag==FTW_DNR || typeflag==FTW_NS) perror(path);
+    if(typeflag!=FTW_F || st->st_size==0) return 0;
+    if(nfiles==files_alloc){
+        files_alloc = files_alloc ? files_alloc*2 : 1024;
+        files = (struct file *)realloc(files,files_alloc*sizeof(*files));
+        if(files==0){ perror("realloc"); exit(1); }
+    }
+    files[nfiles].path = strdup(path);
+    files[nfiles].size = st->st_size;
+    nfiles++;
+    return 0;
+}
+
+/* every nonempty regular file under path; symbolic links are not
+ * followed, so a link to a parent directory cannot loop */
+static void add_files(const char *path)
+{
+    if(nftw(path,add_file,16,FTW_PHYS)) perror(path);
+}
+
+/* the classes of the manifest, with their files found and counted */
+static struct class_dir *read_manifest(const char *fname,int *nclasses)
+{
+    FILE *f = fopen(fname,"r");
+    if(f==0){ perror(fname); exit(1); }
+    struct class_dir *classes = 0;
+    int n = 0;
+    char line[PATH_MAX+64];
+    int lineno = 0;
+    while(fgets(line,sizeof(line),f)){
+        lineno++;
+        char name[64],dir[PATH_MAX];
+        if(line[0]=='#' || sscanf(line,"%63s %4095[^\n]",name,dir)!=2) continue;
+        int label = sceadan_type_for_name(name);
+        if(label<0){                    /* or a type number */
+            char *end;
+            const long v = strtol(name,&end,10);
+            if(*end!=0 || v<0 || v>=INT32_MAX){
+                fprintf(stderr,"%s:%d: unknown class %s\n",fname,lineno,name);
+                exit(1);
+            }
+            label = (int)v;
+        }
+        classes = (struct class_dir *)realloc(classes,(n+1)*sizeof(*classes));
+        if(classes==0){ perror("realloc"); exit(1); }
+        struct class_dir *c = &classes[n++];
+        c->label = label;
+        c->first_file = nfiles;
+        add_files(dir);
+        c->end_file = nfiles;
+        qsort(files+c->first_file,c->end_file-c->first_file,sizeof(*files),compare_files);
+
+        c->cum = (uint64_t *)malloc((c->end_file-c->first_file+1)*sizeof(uint64_t));
+        if(c->cum==0){ perror("malloc"); exit(1); }
+        c->nitems = 0;
+        for(size_t i=c->first_file;i<c->end_file;i++){
+            c->cum[i-c->first_file] = c->nitems;
+            c->nitems += opt_block ? files[i].size/opt_block : 1;
+        }
+        c->cum[c->end_file-c->first_file] = c->nitems;
+    }
+    fclose(f);
+    *nclasses = n;
+    return classes;
+}
+
+/* the file and offset of a class's item'th item */
+static struct sample item_sample(const struct class_dir *c,int cls,uint64_t item)
+{
+    size_t lo = 0,hi = c->end_file-c->first_file; /* cum[lo] <= item < cum[hi] */
+    while(hi-lo>1){
+        const size_t mid = (lo+hi)/2;
+        if(c->cum[mid]<=item) lo = mid;
+        else hi = mid;
+    }
+    const struct sample s = {c->first_file+lo,(item-c->cum[lo])*opt_block,c->label,cls};
+    return s;
+}
+
+/* k of the class's items, by Algorithm L, added to samples */
+static void sample_class(const struct class_dir *c,int cls,uint64_t k)
+{
+    const uint64_t n = c->nitems;
+    if(k==0 || k>n) k = n;
+    uint64_t *chosen = (uint64_t *)malloc((k ? k : 1)*sizeof(uint64_t));
+    if(chosen==0){ perror("malloc"); exit(1); }
+    for(uint64_t i=0;i<k;i++) chosen[i] = i;
+    if(k<n){
+        uint64_t state = opt_seed*0x100000001b3ULL + (uint64_t)c->label;
+        double w = exp(log(uniform(&state))/k);
+        uint64_t i = k-1;
+        for(;;){
+            const double skip = floor(log(uniform(&state))/log(1-w));
+            if(skip >= (double)(n-1-i)) break;
+            i += (uint64_t)skip + 1;
+            chosen[next_random(&state)%k] = i;
+            w *= exp(log(uniform(&state))/k);
+        }
+    }
+    samples = (struct sample *)realloc(samples,(nsamples+k)*sizeof(*samples));
+    if(samples==0 && nsamples+k>0){ perror("realloc"); exit(1); }
+    for(uint64_t i=0;i<k;i++) samples[nsamples++] = item_sample(c,cls,chosen[i]);
+    free(chosen);
+}
+
+/* the block at s into w->buf, keeping the last file open; fewer than
+ * opt_block bytes if the file has shrunk or cannot be read */
+static size_t read_block(struct worker *w,const struct sample *s)
+{
+    if(w->fd<0 || w->file!=s->file){
+        if(w->fd>=0) close(w->fd);
+        w->fd = open(files[s->file].path,O_RDONLY|O_BINARY);
+        w->file = s->file;
+        if(w->fd<0){
+            perror(files[s->file].path);
+            return 0;
+        }
+    }
+    size_t n = 0;
+    while(n<opt_block){
+        const ssize_t r = pread(w->fd,w->buf+n,opt_block-n,s->offset+n);
+        if(r<0 && errno==EINTR) continue;
+        if(r<0){
+            perror(files[s->file].path);
+            return 0;
+        }
+        if(r==0) break;
+        n += r;
+    }
+    return n;
+}
+
+static void extract_shard(void *worker_arg,void *item)
+{
+    struct worker *w = (struct worker *)worker_arg;
+    const struct shard *sh = (const struct shard *)item;
+    char fname[PATH_MAX],tmp[PATH_MAX+32];
+    FILE *out = 0;
+    sceadan_csr_writer *csr = 0;
+    if(opt_csr){
+        snprintf(fname,sizeof(fname),"%s-%05u",opt_prefix,sh->number);
+        csr = sceadan_csr_writer_create(fname,sh->n);
+        if(csr==0){ perror(fname); exit(1); }
+    } else {
+        snprintf(fname,sizeof(fname),"%s-%05u.libsvm",opt_prefix,sh->number);
+        snprintf(tmp,sizeof(tmp),"%s.%d.tmp",fname,(int)getpid());
+        out = fopen(tmp,"w");
+        if(out==0){ perror(tmp); exit(1); }
+        setvbuf(out,0,_IOFBF,1<<20);
+    }
+    for(size_t i=sh->first;i<sh->first+sh->n;i++){
+        const struct sample *s = &samples[i];
+        if(csr) sceadan_dump_vectors_to_csr(w->s,s->label,csr);
+        else {
+            sceadan_dump_vectors_on_classify(w->s,s->label,out);
+            sceadan_dump_vectors_format(w->s,SCEADAN_DUMP_LIBSVM);
+        }
+        if(opt_block==0){
+            if(sceadan_classify_file(w->s,files[s->file].path)<0){
+                perror(files[s->file].path);
+                w->skipped++;
+                continue;
+            }
+        } else {
+            if(read_block(w,s)<opt_block){  /* a short block is not what was sampled */
+                w->skipped++;
+                continue;
+            }
+            sceadan_ctx_classify(w->ctx,w->buf,opt_block);
+        }
+        w->vectors[s->cls]++;
+    }
+    if(csr && sceadan_csr_writer_close(csr)){ perror(fname); exit(1); }
+    if(out && (ferror(out) | fclose(out) || rename(tmp,fname))){ perror(fname); exit(1); }
+}
+
+int main(int argc,char **argv)
+{
+    int nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int ch;
+    while((ch = getopt(argc,argv,"b:n:j:o:f:r:s:h")) != -1){
+        switch(ch){
+        case 'b': opt_block = strtoull(optarg,0,10); break;
+        case 'n': opt_per_class = strtoull(optarg,0,10); break;
+        case 'j': nthreads = atoi(optarg); break;
+        case 'o': opt_prefix = optarg; break;
+        case 'f':
+            if(strcmp(optarg,"csr")==0) opt_csr = 1;
+            else if(strcmp(optarg,"libsvm")==0) opt_csr = 0;
+            else usage();
+            break;
+        case 'r': opt_shard_rows = strtoull(optarg,0,10); break;
+        case 's': opt_seed = strtoull(optarg,0,10); break;
+        case 'h':
+        default: usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if(argc!=1 || opt_shard_rows==0) usage();
+    if(nthreads<1) nthreads = 1;
+
+    const double t0 = now();
+    int nclasses;
+    struct class_dir *classes = read_manifest(argv[0],&nclasses);
+    size_t *sampled = (size_t *)calloc(nclasses ? nclasses : 1,sizeof(size_t));
+    if(sampled==0){ perror("calloc"); exit(1); }
+    for(int i=0;i<nclasses;i++){
+        const size_t before = nsamples;
+        sample_class(&classes[i],i,opt_per_class);
+        sampled[i] = nsamples-before;
+        free(classes[i].cum);
+    }
+    qsort(samples,nsamples,sizeof(*samples),compare_samples);
+
+    struct worker *workers = (struct worker *)calloc(nthreads,sizeof(*workers));
+    void **worker_args = (void **)calloc(nthreads,sizeof(*worker_args));
+    if(workers==0 || worker_args==0){ perror("calloc"); exit(1); }
+    for(int i=0;i<nthreads;i++){
+        workers[i].s = sceadan_open(0);
+        workers[i].ctx = workers[i].s ? sceadan_ctx_create(workers[i].s) : 0;
+        workers[i].buf = (uint8_t *)malloc(opt_block ? opt_block : 1);
+        workers[i].fd = -1;
+        workers[i].vectors = (uint64_t *)calloc(nclasses ? nclasses : 1,sizeof(uint64_t));
+        if(workers[i].vectors==0){ perror("calloc"); exit(1); }
+        if(workers[i].ctx==0 || workers[i].buf==0){ fprintf(stderr,"cannot open default model\n"); exit(1); }
+        worker_args[i] = &workers[i];
+    }
+    const size_t nshards = (nsamples+opt_shard_rows-1)/opt_shard_rows;
+    struct shard *shards = (struct shard *)calloc(nshards ? nshards : 1,sizeof(*shards));
+    if(shards==0){ perror("calloc"); exit(1); }
+    threadpool *pool = threadpool_create(nthreads,extract_shard,worker_args);
+    for(size_t i=0;i<nshards;i++){
+        shards[i].number = (unsigned)i;
+        shards[i].first = i*opt_shard_rows;
+        shards[i].n = (nsamples-shards[i].first < opt_shard_rows) ? nsamples-shards[i].first : opt_shard_rows;
+        threadpool_submit(pool,&shards[i]);
+    }
+    threadpool_wait(pool);
+
+    /* what was written, which is less than was sampled if files changed */
+    uint64_t total = 0,skipped = 0;
+    for(int i=0;i<nclasses;i++){
+        uint64_t vectors = 0;
+        for(int j=0;j<nthreads;j++) vectors += workers[j].vectors[i];
+        fprintf(stderr,"%-8s %zu files, %" PRIu64 " %s, %zu sampled, %" PRIu64 " vectors\n",
+                sceadan_name_for_type(classes[i].label) ? sceadan_name_for_type(classes[i].label) : "?",
+                classes[i].end_file-classes[i].first_file,classes[i].nitems,
+                opt_block ? "blocks" : "files",sampled[i],vectors);
+        total += vectors;
+    }
+    for(int i=0;i<nthreads;i++){
+        skipped += workers[i].skipped;
+        if(workers[i].fd>=0) close(workers[i].fd);
+        free(workers[i].buf);
+        free(workers[i].vectors);
+        sceadan_ctx_destroy(workers[i].ctx);
+        sceadan_close(workers[i].s);
+    }
+    if(skipped) fprintf(stderr,"%" PRIu64 " samples could not be read whole and were skipped\n",skipped);
+    fprintf(stderr,"%" PRIu64 " vectors in %zu shards, %.1f s\n",total,nshards,now()-t0);
+    free(classes);
+    free(sampled);
+    free(shards);
+    free(workers);
+    free(worker_args);
+    for(size_t i=0;i<nfiles;i++) free(files[i].path);
+    free(files);
+    free(samples);
+    return 0;
+}
@@ -20,4 +20,52 @@ doline() {
 
 ./sceadan_app $srcdir/../testdata/good/ 0  | doline
 
+# --cache: a second run reuses every result; a file rewritten with the
+# same size and mtime keeps its old result unless --cache-strict
+rm -rf test.cache test.cachedir && mkdir test.cachedir
+./sceadan_app --cache test.cache $srcdir/../testdata/good/ 0 > test.out1 || exit 1
+./sceadan_app --cache test.cache $srcdir/../testdata/good/ 0 > test.out2 || exit 1
+cmp -s test.out1 test.out2 || { echo cache changed the results; exit 1; }
+f=test.cachedir/f
+cp $srcdir/../testdata/good/html.txt $f
+first=`./sceadan_app --cache test.cache $f | awk '{print $2;}'`
+touch -r $f test.cachedir/mtime
+head -c `wc -c < $f` $srcdir/../testdata/good/gz.txt > $f.new && cat $f.new > $f
+touch -r test.cachedir/mtime $f
+cached=`./sceadan_app --cache test.cache $f | awk '{print $2;}'`
+strict=`./sceadan_app --cache test.cache --cache-strict $f | awk '{print $2;}'`
+plain=`./sceadan_app $f | awk '{print $2;}'`
+if [ -z "$first" ] || [ "$cached" != "$first" ] || [ "$strict" != "$plain" ] || [ "$strict" = "$first" ]; then
+  echo cache: $first $cached $strict $plain
+  exit 1
+fi
+rm -rf test.cache test.cachedir test.out1 test.out2
+
+# --output and --extents: the same label for every block
+./sceadan_app $srcdir/../testdata/good/ 512 | awk '{print $2, $4;}' > test.blocks
+./sceadan_app --extents $srcdir/../testdata/good/ 512 | awk '{for(i=0;i<$2;i+=512) print $3, $5;}' > test.extents
+./sceadan_app --output csv $srcdir/../testdata/good/ 512 | awk -F, 'NR>1 {print $3, $4;}' > test.csv
+cmp -s test.blocks test.extents || { echo extents differ from blocks; exit 1; }
+cmp -s test.blocks test.csv || { echo csv differs from text; exit 1; }
+rm -f test.blocks test.extents test.csv
+
+# --queue-depth: the same results as reading the image in order, across
+# several reads and a short last one
+cat $srcdir/../testdata/good/* > test.img
+for bf in 512 100; do
+  ./sceadan_app test.img $bf > test.plain || exit 1
+  ./sceadan_app -j 2 --queue-depth 4 test.img $bf > test.queued || exit 1
+  cmp -s test.plain test.queued || { echo queue-depth differs at $bf; exit 1; }
+done
+rm -f test.img test.plain test.queued
+
+# -j: the same results as the serial run; with --sorted, in path order
+./sceadan_app $srcdir/../testdata/good/ 512 | LC_ALL=C sort > test.serial || exit 1
+./sceadan_app -j 4 $srcdir/../testdata/good/ 512 | LC_ALL=C sort > test.jobs || exit 1
+./sceadan_app -j 4 --sorted $srcdir/../testdata/good/ 512 > test.sorted || exit 1
+cmp -s test.serial test.jobs || { echo -j differs from serial; exit 1; }
+LC_ALL=C sort test.sorted | cmp -s test.serial - || { echo --sorted differs from serial; exit 1; }
+awk -F' # ' '{print $2;}' test.sorted | LC_ALL=C sort -c || { echo --sorted out of order; exit 1; }
+rm -f test.serial test.jobs test.sorted
+
 exit 0
@@ -0,0 +1,334 @@
+/*
+ * test_score.c:
+ * Check that every scoring kernel the CPU supports predicts the same
+ * label as the scalar kernel, on the test corpus and on synthetic data,
+ * with the double weights and with int8 and fp16 quantized weights,
+ * and that batched classification agrees with one block at a time.
+ * A hand-built cascade checks the routing between the stages, and
+ * binary model files must classify exactly like the model they were
+ * written from, and be refused when damaged.
+ */
+
+#include "config.h"
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINEAR_H
+#include <linear.h>
+#endif
+#ifdef HAVE_LIBLINEAR_LINEAR_H
+#include <liblinear/linear.h>
+#endif
+
+#include "sceadan.h"
+#include "file_type.h"
+
+static const size_t block_sizes[] = {512, 4096, 0};  /* 0 means the whole buffer */
+
+#define n_triage_rows 257                   /* the 256 unigrams and the bias */
+
+static int failures = 0;
+static int checks   = 0;
+
+static void check_buf(sceadan *s,const char *what,const uint8_t *buf,size_t len)
+{
+    for(int b=0;b<(int)(sizeof(block_sizes)/sizeof(block_sizes[0]));b++){
+        const size_t bs = block_sizes[b] ? block_sizes[b] : len;
+        for(size_t off=0;off<len;off+=bs){
+            const size_t n = (len-off < bs) ? len-off : bs;
+            sceadan_set_isa(s,SCEADAN_ISA_SCALAR);
+            const int expected = sceadan_classify_buf(s,buf+off,n);
+            for(int isa=SCEADAN_ISA_SCALAR+1;isa<=SCEADAN_ISA_MAX;isa++){
+                if(sceadan_set_isa(s,isa)<0) continue;
+                const int got = sceadan_classify_buf(s,buf+off,n);
+                checks++;
+                if(got!=expected){
+                    printf("%s offset %zu len %zu: %s predicts %s, scalar predicts %s\n",
+                           what,off,n,sceadan_isa_name(isa),
+                           sceadan_name_for_type(got),sceadan_name_for_type(expected));
+                    failures++;
+                }
+            }
+        }
+    }
+}
+
+/* every kernel: a batch of all the blocks gives each block's own label */
+static void check_batch(sceadan *s,const char *what,const uint8_t *buf,size_t len)
+{
+    for(int b=0;b<(int)(sizeof(block_sizes)/sizeof(block_sizes[0]));b++){
+        const size_t bs = block_sizes[b] ? block_sizes[b] : len;
+        const size_t n = (len+bs-1)/bs;
+        const uint8_t **bufs = calloc(n,sizeof(*bufs));
+        size_t *lens = calloc(n,sizeof(*lens));
+        int *labels = calloc(n,sizeof(*labels));
+        for(size_t i=0;i<n;i++){
+            bufs[i] = buf+i*bs;
+            lens[i] = (len-i*bs < bs) ? len-i*bs : bs;
+        }
+        for(int isa=SCEADAN_ISA_SCALAR;isa<=SCEADAN_ISA_MAX;isa++){
+            if(sceadan_set_isa(s,isa)<0) continue;
+            if(sceadan_classify_batch(s,bufs,lens,n,labels)){ perror("sceadan_classify_batch"); exit(1); }
+            for(size_t i=0;i<n;i++){
+                const int expected = sceadan_classify_buf(s,bufs[i],lens[i]);
+                checks++;
+                if(labels[i]!=expected){
+                    printf("%s offset %zu len %zu: %s batch predicts %s, alone %s\n",
+                           what,i*bs,lens[i],sceadan_isa_name(isa),
+                           sceadan_name_for_type(labels[i]),sceadan_name_for_type(expected));
+                    failures++;
+                }
+            }
+        }
+        free(bufs);
+        free(lens);
+        free(labels);
+    }
+}
+
+/*
+ * A triage model whose only weight is the bias picks family 0 (the full
+ * model) when the bias is positive and family 1 (a single label) when
+ * it is negative, with a margin of 1 either way.
+ */
+static void check_cascade(sceadan *s,const char *what,const uint8_t *buf,size_t len)
+{
+    static int triage_label[] = {0,1};
+    double *w = calloc(n_triage_rows,sizeof(double));
+    struct model triage;
+    memset(&triage,0,sizeof(triage));
+    triage.param.solver_type = L2R_L2LOSS_SVC;
+    triage.nr_class = 2;
+    triage.nr_feature = n_triage_rows-1;
+    triage.w = w;
+    triage.label = triage_label;
+    triage.bias = 1;
+    const struct sceadan_cascade_family family[] = {{s->model,-1},{0,JPG}};
+    struct sceadan_cascade c = {&triage,2,family,0};
+
+    for(size_t off=0;off<len;off+=4096){
+        const size_t n = (len-off < 4096) ? len-off : 4096;
+        sceadan_set_cascade(s,0);
+        const int full = sceadan_classify_buf(s,buf+off,n);
+        const bool by_rule = (full==RAND || full==UCV_CONST || full==BCV_CONST);
+        const struct { double bias,min_margin; int expected; } cases[] = {
+            { 1,0,full},                            /* family 0: the full model */
+            {-1,0,by_rule ? full : JPG},       /* family 1: exits at triage */
+            {-1,2,full},                            /* triage not sure enough */
+        };
+        for(int i=0;i<3;i++){
+            w[n_triage_rows-1] = cases[i].bias;
+            c.min_margin = cases[i].min_margin;
+            sceadan_set_cascade(s,&c);
+            const int got = sceadan_classify_buf(s,buf+off,n);
+            int batch = -1;
+            const uint8_t *bufs[1] = {buf+off};
+            sceadan_classify_batch(s,bufs,&n,1,&batch);
+            checks++;
+            if(got!=cases[i].expected || batch!=got){
+                printf("%s offset %zu: cascade case %d predicts %s (batch %s), expected %s\n",
+                       what,off,i,sceadan_name_for_type(got),sceadan_name_for_type(batch),
+                       sceadan_name_for_type(cases[i].expected));
+                failures++;
+            }
+        }
+    }
+    sceadan_set_cascade(s,0);
+    free(w);
+}
+
+static uint8_t *read_file(const char *path,size_t *lenp)
+{
+    FILE *f = fopen(path,"rb");
+    if(f==0){ perror(path); exit(1); }
+    fseek(f,0,SEEK_END);
+    const long len = ftell(f);
+    fseek(f,0,SEEK_SET);
+    uint8_t *buf = malloc(len);
+    if(fread(buf,1,len,f)!=(size_t)len){ perror(path); exit(1); }
+    fclose(f);
+    *lenp = len;
+    return buf;
+}
+
+static void check_dir(sceadan *s,const char *dirname,bool cascade)
+{
+    DIR *dir = opendir(dirname);
+    if(dir==0){ perror(dirname); exit(1); }
+    struct dirent *de;
+    while((de = readdir(dir))!=0){
+        if(de->d_name[0]=='.') continue;
+        char path[4096];
+        snprintf(path,sizeof(path),"%s/%s",dirname,de->d_name);
+        size_t len;
+        uint8_t *buf = read_file(path,&len);
+        check_buf(s,path,buf,len);
+        check_batch(s,path,buf,len);
+        if(cascade) check_cascade(s,path,buf,len);
+        free(buf);
+    }
+    closedir(dir);
+}
+
+/* the file sceadan_write_model() writes classifies like s; damaged, it is refused */
+static void check_modelfile(sceadan *s,const char *dirname)
+{
+    const char *fname = "test_score.model.bin";
+    checks++;
+    if(sceadan_write_model(s,fname)){
+        perror(fname);
+        failures++;
+        return;
+    }
+    sceadan *m = sceadan_open(fname);
+    if(m==0 || m->model->w==s->model->w || (m->qmodel==0) != (s->qmodel==0)){
+        printf("%s: not mapped as written\n",fname);
+        failures++;
+        if(m) sceadan_close(m);
+        unlink(fname);
+        return;
+    }
+    DIR *dir = opendir(dirname);
+    if(dir==0){ perror(dirname); exit(1); }
+    struct dirent *de;
+    while((de = readdir(dir))!=0){
+        if(de->d_name[0]=='.') continue;
+        char path[4096];
+        snprintf(path,sizeof(path),"%s/%s",dirname,de->d_name);
+        checks++;
+        if(sceadan_classify_file(m,path)!=sceadan_classify_file(s,path)){
+            printf("%s: %s with the model file\n",path,sceadan_name_for_type(sceadan_classify_file(m,path)));
+            failures++;
+        }
+    }
+    closedir(dir);
+    sceadan_close(m);
+
+    /* one flipped bit, and a truncated file */
+    FILE *f = fopen(fname,"r+b");
+    if(f==0){ perror(fname); exit(1); }
+    fseek(f,-1,SEEK_END);
+    const int c = fgetc(f);
+    fseek(f,-1,SEEK_END);
+    fputc(c^1,f);
+    fclose(f);
+    checks++;
+    if((m = sceadan_open(fname))!=0){
+        printf("%s: opened with a flipped bit\n",fname);
+        failures++;
+        sceadan_close(m);
+    }
+    if(truncate(fname,100)){ perror(fname); exit(1); }
+    checks++;
+    if((m = sceadan_open(fname))!=0){
+        printf("%s: opened truncated\n",fname);
+        failures++;
+        sceadan_close(m);
+    }
+    unlink(fname);
+}
+
+/* the specialized scorer, if built in, labels like the kernels, and refuses another model */
+static void check_scorer(sceadan *s,const char *dirname)
+{
+    const struct sceadan_scorer *sc = s->scorer;
+    if(sc==0) return;
+    printf("specialized scorer for %d classes\n",sc->nr_class);
+    DIR *dir = opendir(dirname);
+    if(dir==0){ perror(dirname); exit(1); }
+    struct dirent *de;
+    while((de = readdir(dir))!=0){
+        if(de->d_name[0]=='.') continue;
+        char path[4096];
+        snprintf(path,sizeof(path),"%s/%s",dirname,de->d_name);
+        size_t len;
+        uint8_t *buf = read_file(path,&len);
+        for(int isa=SCEADAN_ISA_SCALAR;isa<=SCEADAN_ISA_MAX;isa++){
+            if(sceadan_set_isa(s,isa)<0) continue;
+            for(size_t off=0;off<len;off+=4096){
+                const size_t n = (len-off < 4096) ? len-off : 4096;
+                sceadan_set_scorer(s,0);
+                const int expected = sceadan_classify_buf(s,buf+off,n);
+                sceadan_set_scorer(s,sc);
+                const int got = sceadan_classify_buf(s,buf+off,n);
+                checks++;
+                if(got!=expected){
+                    printf("%s offset %zu: %s specialized predicts %s, kernel %s\n",path,off,
+                           sceadan_isa_name(isa),sceadan_name_for_type(got),sceadan_name_for_type(expected));
+                    failures++;
+                }
+            }
+        }
+        free(buf);
+    }
+    closedir(dir);
+    sceadan_set_isa(s,sceadan_isa_best());
+
+    struct sceadan_scorer other = *sc;
+    other.fingerprint ^= 1;
+    checks++;
+    if(sceadan_set_scorer(s,&other)==0){
+        printf("specialized scorer accepted for another model\n");
+        failures++;
+    }
+    sceadan_set_scorer(s,sc);
+}
+
+/* synthetic blocks: random bytes, and random text-like bytes */
+static void check_synthetic(sceadan *s)
+{
+    const size_t len = 1<<16;
+    uint8_t *buf = malloc(len);
+    uint32_t state = 1;
+    for(size_t i=0;i<len;i++){
+        state = state*1103515245 + 12345;
+        buf[i] = state>>16;
+    }
+    check_buf(s,"random",buf,len);
+    check_batch(s,"random",buf,len);
+    for(size_t i=0;i<len;i++){
+        state = state*1103515245 + 12345;
+        buf[i] = 0x20 + (state>>16)%0x5f;
+    }
+    check_buf(s,"text",buf,len);
+    check_batch(s,"text",buf,len);
+    free(buf);
+}
+
+int main(void)
+{
+    const char *srcdir = getenv("srcdir");
+    char dirname[4096];
+    snprintf(dirname,sizeof(dirname),"%s/../testdata/good",srcdir ? srcdir : ".");
+
+    sceadan *s = sceadan_open(0);
+    if(s==0){ fprintf(stderr,"cannot open default model\n"); exit(1); }
+
+    printf("best isa: %s\n",sceadan_isa_name(sceadan_isa_best()));
+    check_dir(s,dirname,true);
+    check_synthetic(s);
+    check_modelfile(s,dirname);
+    check_scorer(s,dirname);
+
+    /* the quantized kernels must agree with each other too */
+    const int quants[] = {SCEADAN_QUANT_INT8,SCEADAN_QUANT_FP16};
+    for(int i=0;i<2;i++){
+        struct sceadan_qmodel *qm = sceadan_qmodel_create(s->model,quants[i]);
+        if(qm==0) continue;             /* the precompiled model is already quantized */
+        sceadan_set_qmodel(s,qm);
+        check_dir(s,dirname,false);
+        check_synthetic(s);
+        check_modelfile(s,dirname);
+        sceadan_set_qmodel(s,0);
+        sceadan_qmodel_free(qm);
+    }
+    sceadan_close(s);
+
+    printf("%d checks, %d failures\n",checks,failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,622 @@
+/*
+ * test_stream.c:
+ * Check that the streaming API produces the same feature vectors and
+ * label however the input is split into chunks and whichever feature
+ * loop is used, and that each sliding window and each multi-resolution
+ * block gets the same vectors as classifying its bytes from scratch.
+ * Blocks classified alone, which use the compact counters, must match
+ * the stream too, and progressive container mode must give the label of
+ * the bytes it read. With --enable-stats, the statistics must count
+ * every block and byte once. Vectors exported as libsvm lines and CSR
+ * shards must carry the values the JSON dump prints. Blocks labelled by
+ * the dedup stage must get the labels they would have been classified
+ * as, however small the LRU.
+ */
+
+#include "config.h"
+#include <dirent.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sceadan.h"
+#include "sceadan_export.h"
+#include "sceadan_dedup.h"
+
+static int failures = 0;
+static int checks   = 0;
+
+/* classify buf fed in chunks of at most max_chunk bytes (0 = one piece),
+ * returning the vectors as dumped JSON */
+static char *stream_vectors(sceadan *s,sceadan_ctx *ctx,const uint8_t *buf,size_t len,
+                            size_t max_chunk,uint32_t *state,int *label)
+{
+    char  *json = 0;
+    size_t json_len = 0;
+    FILE *out = open_memstream(&json,&json_len);
+    sceadan_dump_vectors_on_classify(s,1,out);
+
+    sceadan_stream_begin(ctx);
+    size_t off = 0;
+    while(off<len){
+        size_t n = len-off;
+        if(max_chunk){
+            *state = *state*1103515245 + 12345;
+            const size_t r = 1 + (*state>>8) % max_chunk;
+            if(r<n) n = r;
+        }
+        sceadan_stream_update(ctx,buf+off,n);
+        off += n;
+    }
+    sceadan_stream_finalize(ctx);
+    fclose(out);
+
+    sceadan_dump_vectors_on_classify(s,0,0);
+    sceadan_stream_begin(ctx);
+    sceadan_stream_update(ctx,buf,len);
+    *label = sceadan_stream_finalize(ctx);
+    return json;
+}
+
+/* the vectors sceadan_ctx_classify() dumps, which come from the compact counters for bounded blocks */
+static char *block_vectors(sceadan *s,sceadan_ctx *ctx,const uint8_t *buf,size_t len)
+{
+    char  *json = 0;
+    size_t json_len = 0;
+    FILE *out = open_memstream(&json,&json_len);
+    sceadan_dump_vectors_on_classify(s,1,out);
+    sceadan_ctx_classify(ctx,buf,len);
+    fclose(out);
+    sceadan_dump_vectors_on_classify(s,0,0);
+    return json;
+}
+
+/* progressive container mode: stopping at a checkpoint gives the label of
+ * the bytes read so far, and an unreachable margin reads everything */
+static void check_progressive(sceadan *s,const char *path,const uint8_t *buf,size_t len)
+{
+    static const double margins[] = {0,0.5,2,INFINITY};
+    for(size_t i=0;i<sizeof(margins)/sizeof(margins[0]);i++){
+        uint64_t bytes_read = 0;
+        const int label = sceadan_classify_file_progressive(s,path,margins[i],&bytes_read);
+        checks++;
+        if(bytes_read>len || (isinf(margins[i]) && bytes_read!=len)
+           || (bytes_read<len && bytes_read!=SCEADAN_PROGRESSIVE_FIRST && bytes_read%SCEADAN_PROGRESSIVE_SECOND!=0)
+           || label!=sceadan_classify_buf(s,buf,bytes_read)){
+            printf("%s: margin %g stops after %" PRIu64 " bytes with %s\n",
+                   path,margins[i],bytes_read,sceadan_name_for_type(label));
+            failures++;
+        }
+    }
+}
+
+/* data a rule decides stops once the rule has held at two checkpoints */
+static void check_progressive_rule(sceadan *s,const uint8_t *buf,size_t len)
+{
+    const char *path = "test_stream.zeros";
+    FILE *f = fopen(path,"wb");
+    if(f==0){ perror(path); exit(1); }
+    for(size_t i=0;i<4*SCEADAN_PROGRESSIVE_SECOND;i+=len) fwrite(buf,1,len,f);
+    if(fclose(f)){ perror(path); exit(1); }
+    static const double margins[] = {0,INFINITY};
+    for(size_t i=0;i<sizeof(margins)/sizeof(margins[0]);i++){
+        uint64_t bytes_read = 0;
+        const int label = sceadan_classify_file_progressive(s,path,margins[i],&bytes_read);
+        const uint64_t expected = isinf(margins[i]) ? 4*SCEADAN_PROGRESSIVE_SECOND : SCEADAN_PROGRESSIVE_SECOND;
+        checks++;
+        if(bytes_read!=expected || label!=sceadan_classify_buf(s,buf,len)){
+            printf("zeros: margin %g stops after %" PRIu64 " bytes with %s\n",
+                   margins[i],bytes_read,sceadan_name_for_type(label));
+            failures++;
+        }
+    }
+    unlink(path);
+}
+
+/* every counter width agrees with the stream's 64-bit counters */
+static void check_blocks(sceadan *s,sceadan_ctx *ctx,const char *what,const uint8_t *buf,size_t len)
+{
+    static const size_t sizes[] = {1,2,255,256,511,512,4096,65536,131071,131072};
+    for(size_t i=0;i<sizeof(sizes)/sizeof(sizes[0]) && sizes[i]<=len;i++){
+        uint32_t state = 1;
+        int label;
+        char *expected = stream_vectors(s,ctx,buf,sizes[i],0,&state,&label);
+        char *got = block_vectors(s,ctx,buf,sizes[i]);
+        checks++;
+        if(strcmp(got,expected)!=0 || sceadan_ctx_classify(ctx,buf,sizes[i])!=label){
+            printf("%s: a %zu byte block classified alone differs from the stream\n",what,sizes[i]);
+            failures++;
+        }
+        free(got);
+        free(expected);
+    }
+}
+
+static void check_buf(sceadan *s,sceadan_ctx *ctx,const char *what,const uint8_t *buf,size_t len)
+{
+    static const size_t max_chunks[] = {1,2,3,7,64,511,4096,65537};
+    uint32_t state = 1;
+    int expected_label;
+    char *expected = stream_vectors(s,ctx,buf,len,0,&state,&expected_label);
+    for(size_t i=0;i<sizeof(max_chunks)/sizeof(max_chunks[0]);i++){
+        int label;
+        char *got = stream_vectors(s,ctx,buf,len,max_chunks[i],&state,&label);
+        checks++;
+        if(strcmp(got,expected)!=0 || label!=expected_label){
+            printf("%s: chunks of up to %zu bytes change the vectors\n",what,max_chunks[i]);
+            failures++;
+        }
+        free(got);
+    }
+    /* the byte-at-a-time reference loop gives the same vectors */
+    sceadan_ctx_reference_update(ctx,1);
+    for(size_t i=0;i<sizeof(max_chunks)/sizeof(max_chunks[0]);i++){
+        int label;
+        char *got = stream_vectors(s,ctx,buf,len,max_chunks[i],&state,&label);
+        checks++;
+        if(strcmp(got,expected)!=0 || label!=expected_label){
+            printf("%s: the reference loop, in chunks of up to %zu bytes, gives different vectors\n",what,max_chunks[i]);
+            failures++;
+        }
+        free(got);
+    }
+    sceadan_ctx_reference_update(ctx,0);
+
+    /* and the one-shot call agrees with the stream */
+    checks++;
+    if(sceadan_classify_buf(s,buf,len)!=expected_label){
+        printf("%s: sceadan_classify_buf disagrees with the stream\n",what);
+        failures++;
+    }
+    free(expected);
+}
+
+/* each window's dumped vectors are followed by its offset and label */
+static void window_cb(void *arg,uint64_t offset,int file_type)
+{
+    fprintf((FILE *)arg,"%" PRIu64 " %d\n",offset,file_type);
+}
+
+/* classify the windows of buf, fed in chunks of at most max_chunk bytes */
+static char *window_vectors(sceadan *s,sceadan_ctx *ctx,const uint8_t *buf,size_t len,
+                            size_t window,size_t step,size_t max_chunk,uint32_t *state)
+{
+    char  *json = 0;
+    size_t json_len = 0;
+    FILE *out = open_memstream(&json,&json_len);
+    sceadan_dump_vectors_on_classify(s,1,out);
+    sceadan_window_begin(ctx,window,step);
+    size_t off = 0;
+    while(off<len){
+        *state = *state*1103515245 + 12345;
+        size_t n = 1 + (*state>>8) % max_chunk;
+        if(n>len-off) n = len-off;
+        sceadan_window_update(ctx,buf+off,n,window_cb,out);
+        off += n;
+    }
+    sceadan_window_finish(ctx,window_cb,out);
+    fclose(out);
+    sceadan_dump_vectors_on_classify(s,0,0);
+    return json;
+}
+
+/* the same, classifying each window with sceadan_ctx_classify() */
+static char *window_reference(sceadan *s,sceadan_ctx *ctx,const uint8_t *buf,size_t len,
+                              size_t window,size_t step)
+{
+    char  *json = 0;
+    size_t json_len = 0;
+    FILE *out = open_memstream(&json,&json_len);
+    sceadan_dump_vectors_on_classify(s,1,out);
+    if(len<window){
+        fprintf(out,"0 %d\n",sceadan_ctx_classify(ctx,buf,len));
+    }
+    for(size_t off=0;off+window<=len;off+=step){
+        const int label = sceadan_ctx_classify(ctx,buf+off,window);
+        fprintf(out,"%zu %d\n",off,label);
+    }
+    fclose(out);
+    sceadan_dump_vectors_on_classify(s,0,0);
+    return json;
+}
+
+static void check_windows(sceadan *s,sceadan_ctx *ctx,const char *what,const uint8_t *buf,size_t len)
+{
+    static const size_t shapes[][2] = {{512,512},{512,64},{4096,512},{256,1024},{512,2},{2,2}};
+    static const size_t max_chunks[] = {1,7,65537};
+    sceadan_ctx *wctx = sceadan_ctx_create(s);
+    uint32_t state = 1;
+    if(len>8192) len = 8192;              /* every window is dumped, so keep it short */
+    for(size_t i=0;i<sizeof(shapes)/sizeof(shapes[0]);i++){
+        const size_t window = shapes[i][0], step = shapes[i][1];
+        if(step<16 && len>640) len = 640;       /* the small steps come last */
+        char *expected = window_reference(s,ctx,buf,len,window,step);
+        for(size_t j=0;j<sizeof(max_chunks)/sizeof(max_chunks[0]);j++){
+            char *got = window_vectors(s,wctx,buf,len,window,step,max_chunks[j],&state);
+            checks++;
+            if(strcmp(got,expected)!=0){
+                printf("%s: %zu byte windows every %zu bytes, in chunks of up to %zu, differ from classifying each window\n",
+                       what,window,step,max_chunks[j]);
+                failures++;
+            }
+            free(got);
+        }
+        free(expected);
+    }
+    sceadan_ctx_destroy(wctx);
+}
+
+static void multires_cb(void *arg,size_t block_size,uint64_t offset,int file_type)
+{
+    fprintf((FILE *)arg,"%zu %" PRIu64 " %d\n",block_size,offset,file_type);
+}
+
+/* classify the blocks of buf at every size, fed in chunks of at most max_chunk bytes */
+static char *multires_vectors(sceadan *s,sceadan_ctx *ctx,const uint8_t *buf,size_t len,
+                              const size_t *sizes,int nlevels,size_t max_chunk,uint32_t *state)
+{
+    char  *json = 0;
+    size_t json_len = 0;
+    FILE *out = open_memstream(&json,&json_len);
+    sceadan_dump_vectors_on_classify(s,1,out);
+    sceadan_multires_begin(ctx,sizes,nlevels);
+    size_t off = 0;
+    while(off<len){
+        *state = *state*1103515245 + 12345;
+        size_t n = 1 + (*state>>8) % max_chunk;
+        if(n>len-off) n = len-off;
+        sceadan_multires_update(ctx,buf+off,n,multires_cb,out);
+        off += n;
+    }
+    sceadan_multires_finish(ctx,multires_cb,out);
+    fclose(out);
+    sceadan_dump_vectors_on_classify(s,0,0);
+    return json;
+}
+
+/* the same, classifying each block with sceadan_ctx_classify(), in the same order */
+static char *multires_reference(sceadan *s,sceadan_ctx *ctx,const uint8_t *buf,size_t len,
+                                const size_t *sizes,int nlevels)
+{
+    char  *json = 0;
+    size_t json_len = 0;
+    FILE *out = open_memstream(&json,&json_len);
+    sceadan_dump_vectors_on_classify(s,1,out);
+    for(size_t end=sizes[0];end<len+sizes[0];end+=sizes[0]){
+        if(end>len) end = len;
+        for(int i=0;i<nlevels;i++){
+            if(end%sizes[i]==0 || end==len){
+                const size_t start = (end-1)/sizes[i]*sizes[i];
+                const int label = sceadan_ctx_classify(ctx,buf+start,end-start);
+                fprintf(out,"%zu %zu %d\n",sizes[i],start,label);
+            }
+        }
+    }
+    fclose(out);
+    sceadan_dump_vectors_on_classify(s,0,0);
+    return json;
+}
+
+static void check_multires(sceadan *s,sceadan_ctx *ctx,const char *what,const uint8_t *buf,size_t len)
+{
+    static const size_t sizes[][4] = {{512,4096,65536,1048576},{512,1024,0,0},{2,8,64,0}};
+    static const int nlevels[] = {4,2,3};
+    static const size_t max_chunks[] = {1,7,65537};
+    sceadan_ctx *mctx = sceadan_ctx_create(s);
+    uint32_t state = 1;
+    for(size_t i=0;i<sizeof(nlevels)/sizeof(nlevels[0]);i++){
+        size_t n = len<16384 ? len : 16384;                     /* every block is dumped */
+        if(sizes[i][0]<16 && n>640) n = 640;
+        char *expected = multires_reference(s,ctx,buf,n,sizes[i],nlevels[i]);
+        for(size_t j=0;j<sizeof(max_chunks)/sizeof(max_chunks[0]);j++){
+            char *got = multires_vectors(s,mctx,buf,n,sizes[i],nlevels[i],max_chunks[j],&state);
+            checks++;
+            if(strcmp(got,expected)!=0){
+                printf("%s: %zu byte blocks merged upward, in chunks of up to %zu, differ from classifying each block\n",
+                       what,sizes[i][0],max_chunks[j]);
+                failures++;
+            }
+            free(got);
+        }
+        free(expected);
+    }
+    sceadan_ctx_destroy(mctx);
+}
+
+/* with --enable-stats, a context's blocks, bytes and early exits reach
+ * the totals when it is destroyed; calls without a context, at once */
+static void check_stats(const uint8_t *zeros,size_t len)
+{
+    sceadan *s = sceadan_open(0);
+    sceadan_ctx *ctx = s ? sceadan_ctx_create(s) : 0;
+    if(ctx==0){ fprintf(stderr,"cannot open default model\n"); exit(1); }
+    struct sceadan_stats st,cst;
+    if(sceadan_get_stats(s,&st)==0){
+        for(int i=0;i<4;i++) sceadan_ctx_classify(ctx,zeros,4096);
+        sceadan_classify_buf(s,zeros,len);
+        sceadan_ctx_get_stats(ctx,&cst);
+        sceadan_get_stats(s,&st);
+        checks++;
+        if(cst.blocks!=4 || cst.bytes!=4*4096 || cst.ucv_const_exits!=4
+           || st.blocks!=1 || st.bytes!=len || st.ucv_const_exits!=1){
+            printf("stats: context %" PRIu64 " blocks %" PRIu64 " bytes, totals %" PRIu64 " blocks %" PRIu64 " bytes\n",
+                   cst.blocks,cst.bytes,st.blocks,st.bytes);
+            failures++;
+        }
+        sceadan_ctx_destroy(ctx);
+        ctx = 0;
+        sceadan_get_stats(s,&st);
+        checks++;
+        if(st.blocks!=5 || st.bytes!=len+4*4096 || st.ucv_const_exits!=5 || st.rand_exits!=0){
+            printf("stats: %" PRIu64 " blocks %" PRIu64 " bytes after the context is destroyed\n",st.blocks,st.bytes);
+            failures++;
+        }
+    }
+    if(ctx) sceadan_ctx_destroy(ctx);
+    sceadan_close(s);
+}
+
+/* the features between p and end of a JSON dump, as libsvm " index:value"s */
+static void json_features(FILE *out,const char *p,const char *end,int base)
+{
+    p = strchr(p,'{');
+    int index,n;
+    char value[64];
+    while((p = strchr(p,'"'))!=0 && p<end && sscanf(p,"\"%d\" : %63[^, \n]%n",&index,value,&n)==2){
+        fprintf(out," %d:%s",index+base,value);
+        p += n;
+    }
+}
+
+/* the vectors of a JSON dump, as the libsvm lines they should export as */
+static char *json_to_libsvm(const char *json,int label)
+{
+    char  *text = 0;
+    size_t text_len = 0;
+    FILE *out = open_memstream(&text,&text_len);
+    const char *p = json;
+    while((p = strstr(p,"\"unigrams\""))!=0){
+        const char *bigrams = strstr(p,"\"bigrams:\"");
+        const char *end = strstr(bigrams,"\"bigram_entropy\"");
+        fprintf(out,"%d",label);
+        json_features(out,p,bigrams,1);
+        json_features(out,bigrams,end,257);
+        fputc('\n',out);
+        p = end;
+    }
+    fclose(out);
+    return text;
+}
+
+/* a shard's rows as libsvm lines, formatted by printf */
+static void csr_to_libsvm(FILE *out,const struct sceadan_csr *c)
+{
+    for(uint64_t i=0;i<c->n_rows;i++){
+        fprintf(out,"%d",c->label[i]);
+        for(uint64_t k=c->row[i];k<c->row[i+1];k++) fprintf(out," %u:%.16lg",c->index[k],c->value[k]);
+        fputc('\n',out);
+    }
+}
+
+/* classify buf's 4 KiB blocks, dumping them as set up beforehand */
+static void dump_blocks(sceadan *s,const uint8_t *buf,size_t len)
+{
+    for(size_t off=0;off<len;off+=4096){
+        sceadan_classify_buf(s,buf+off,(len-off < 4096) ? len-off : 4096);
+    }
+}
+
+/* libsvm lines have the JSON dump's values, and CSR shards the libsvm lines' */
+static void check_export(sceadan *s,const char *what,const uint8_t *buf,size_t len)
+{
+    const int label = 7;
+    char  *json = 0,*text = 0,*shards = 0;
+    size_t json_len = 0,text_len = 0,shards_len = 0;
+
+    FILE *out = open_memstream(&json,&json_len);
+    sceadan_dump_vectors_on_classify(s,label,out);
+    dump_blocks(s,buf,len);
+    fclose(out);
+    out = open_memstream(&text,&text_len);
+    sceadan_dump_vectors_on_classify(s,label,out);
+    sceadan_dump_vectors_format(s,SCEADAN_DUMP_LIBSVM);
+    dump_blocks(s,buf,len);
+    fclose(out);
+    sceadan_dump_vectors_format(s,SCEADAN_DUMP_JSON);
+
+    const char *prefix = "test_stream.shard";
+    sceadan_csr_writer *w = sceadan_csr_writer_create(prefix,3);
+    sceadan_dump_vectors_to_csr(s,label,w);
+    dump_blocks(s,buf,len);
+    sceadan_dump_vectors_to_csr(s,0,0);
+    checks++;
+    if(sceadan_csr_writer_close(w)){
+        perror(prefix);
+        failures++;
+    }
+    out = open_memstream(&shards,&shards_len);
+    for(int i=0;;i++){
+        char fname[64];
+        snprintf(fname,sizeof(fname),"%s-%05d.csr",prefix,i);
+        struct sceadan_csr *c = sceadan_csr_open(fname);
+        if(c==0) break;
+        csr_to_libsvm(out,c);
+        sceadan_csr_close(c);
+        unlink(fname);
+    }
+    fclose(out);
+    sceadan_dump_vectors_on_classify(s,0,0);
+
+    char *expected = json_to_libsvm(json,label);
+    checks++;
+    if(strcmp(text,expected)){
+        printf("%s: libsvm export differs from the JSON dump\n",what);
+        failures++;
+    }
+    checks++;
+    if(strcmp(shards,text)){
+        printf("%s: CSR shards differ from the libsvm export\n",what);
+        failures++;
+    }
+    free(expected);
+    free(json);
+    free(text);
+    free(shards);
+}
+
+/* buf's whole blocks, zero blocks, 0xff blocks, buf's blocks again and a
+ * short zero block, classified alone, through a dedup and in batches
+ * through it; with --enable-stats, the repeats come from memory */
+static void check_dedup(sceadan *s,const char *what,const uint8_t *buf,size_t len)
+{
+    static const size_t sizes[] = {512,4096};
+    static const size_t entries[] = {1,SCEADAN_DEDUP_ENTRIES};
+    for(int b=0;b<2;b++){
+        const size_t bs = sizes[b];
+        const size_t nfile = len/bs;
+        const size_t n = 2*nfile+8+4+1;
+        uint8_t *image = calloc(n,bs);
+        memcpy(image,buf,nfile*bs);
+        memset(image+(nfile+8)*bs,0xff,4*bs);
+        memcpy(image+(nfile+12)*bs,buf,nfile*bs);
+        const uint8_t **bufs = calloc(n,sizeof(*bufs));
+        size_t *lens = calloc(n,sizeof(*lens));
+        int *expected = calloc(n,sizeof(*expected));
+        int *labels = calloc(n,sizeof(*labels));
+        sceadan_ctx *ctx = sceadan_ctx_create(s);
+        for(size_t i=0;i<n;i++){
+            bufs[i] = image+i*bs;
+            lens[i] = (i==n-1) ? bs/2 : bs;
+            expected[i] = sceadan_ctx_classify(ctx,bufs[i],lens[i]);
+        }
+        sceadan_ctx_destroy(ctx);
+
+        for(int e=0;e<2;e++){
+            sceadan_dedup *d = sceadan_dedup_create(entries[e]);
+            sceadan_ctx *alone = sceadan_ctx_create(s);
+            sceadan_ctx *batch = sceadan_ctx_create(s);
+            sceadan_ctx_set_dedup(alone,d);
+            sceadan_ctx_set_dedup(batch,d);
+            for(size_t i=0;i<n;i++){
+                const int got = sceadan_ctx_classify(alone,bufs[i],lens[i]);
+                checks++;
+                if(got!=expected[i]){
+                    printf("%s: block %zu of %zu bytes is %s through a dedup of %zu, %s alone\n",what,i,bs,
+                           sceadan_name_for_type(got),entries[e],sceadan_name_for_type(expected[i]));
+                    failures++;
+                }
+            }
+            for(size_t i=0;i<n;i+=100){
+                if(sceadan_ctx_classify_batch(batch,bufs+i,lens+i,(n-i<100) ? n-i : 100,labels+i)){
+                    perror("sceadan_ctx_classify_batch");
+                    exit(1);
+                }
+            }
+            checks++;
+            if(memcmp(labels,expected,n*sizeof(int))){
+                printf("%s: %zu byte blocks batched through a dedup of %zu differ\n",what,bs,entries[e]);
+                failures++;
+            }
+            struct sceadan_stats st;
+            if(e==1 && sceadan_ctx_get_stats(alone,&st)==0){
+                checks++;
+                if(st.dedup_blocks!=n || st.dedup_fill<10 || st.dedup_fill+st.dedup_hits<nfile+10){
+                    printf("%s: %" PRIu64 " blocks deduplicated, %" PRIu64 " fills and %" PRIu64 " hits\n",
+                           what,st.dedup_blocks,st.dedup_fill,st.dedup_hits);
+                    failures++;
+                }
+            }
+            sceadan_ctx_destroy(alone);
+            sceadan_ctx_destroy(batch);
+            sceadan_dedup_destroy(d);
+        }
+        free(image);
+        free(bufs);
+        free(lens);
+        free(expected);
+        free(labels);
+    }
+
+    /* the fill check, at every length and position of the odd byte out */
+    uint8_t fill[200];
+    for(size_t n=1;n<=sizeof(fill);n+=7){
+        memset(fill,0x5a,n);
+        checks++;
+        if(sceadan_fill_byte(fill,n)!=0x5a){ printf("fill: %zu bytes not seen as a fill\n",n); failures++; }
+        for(size_t i=0;i<n && n>1;i++){   /* one byte is always a fill */
+            fill[i] = 0x5b;
+            checks++;
+            if(sceadan_fill_byte(fill,n)!=-1){ printf("fill: byte %zu of %zu missed\n",i,n); failures++; }
+            fill[i] = 0x5a;
+        }
+    }
+}
+
+int main(void)
+{
+    const char *srcdir = getenv("srcdir");
+    char dirname[4096];
+    snprintf(dirname,sizeof(dirname),"%s/../testdata/good",srcdir ? srcdir : ".");
+
+    sceadan *s = sceadan_open(0);
+    sceadan_ctx *ctx = s ? sceadan_ctx_create(s) : 0;
+    if(ctx==0){ fprintf(stderr,"cannot open default model\n"); exit(1); }
+
+    DIR *dir = opendir(dirname);
+    if(dir==0){ perror(dirname); exit(1); }
+    struct dirent *de;
+    while((de = readdir(dir))!=0){
+        if(de->d_name[0]=='.') continue;
+        char path[4096];
+        snprintf(path,sizeof(path),"%s/%s",dirname,de->d_name);
+        FILE *f = fopen(path,"rb");
+        if(f==0){ perror(path); exit(1); }
+        fseek(f,0,SEEK_END);
+        const long len = ftell(f);
+        fseek(f,0,SEEK_SET);
+        uint8_t *buf = malloc(len);
+        if(fread(buf,1,len,f)!=(size_t)len){ perror(path); exit(1); }
+        fclose(f);
+        check_buf(s,ctx,path,buf,len);
+        check_blocks(s,ctx,path,buf,len);
+        check_progressive(s,path,buf,len);
+        check_windows(s,ctx,path,buf,len);
+        check_multires(s,ctx,path,buf,len);
+        check_export(s,path,buf,len);
+        check_dedup(s,path,buf,len);
+        free(buf);
+    }
+    closedir(dir);
+
+    /* runs of repeated bytes of every length, for the streak tracking */
+    const size_t len = 1<<17;
+    uint8_t *buf = malloc(len);
+    uint32_t state = 7;
+    for(size_t i=0;i<len;){
+        state = state*1103515245 + 12345;
+        size_t run = 1 + (state>>8) % ((state>>28) ? 8 : 300);
+        state = state*1103515245 + 12345;
+        if(run>len-i) run = len-i;
+        memset(buf+i,(state>>16)&3,run);
+        i += run;
+    }
+    check_buf(s,ctx,"runs",buf,len);
+    check_blocks(s,ctx,"runs",buf,len);
+    check_export(s,"runs",buf,len);
+    check_dedup(s,"runs",buf,len);
+    memset(buf,0,len);
+    check_buf(s,ctx,"zeros",buf,len);
+    check_blocks(s,ctx,"zeros",buf,len);
+    check_progressive_rule(s,buf,len);
+    check_stats(buf,len);
+    free(buf);
+
+    sceadan_ctx_destroy(ctx);
+    sceadan_close(s);
+    printf("%d checks, %d failures\n",checks,failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * threadpool.c: work-stealing thread pool (see threadpool.h)
+ */
+
+#include "config.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "threadpool.h"
+
+#define THREADPOOL_QUEUE 64             /* waiting items per worker before threadpool_submit blocks */
+
+/* a growable ring buffer of items, guarded by its own lock */
+struct deque {
+    pthread_mutex_t lock;
+    void  **items;
+    size_t  cap;
+    size_t  head;                       /* index of the front item */
+    size_t  count;
+};
+
+struct worker {
+    struct threadpool *pool;
+    int       id;
+    void     *arg;
+    pthread_t thread;
+};
+
+struct threadpool {
+    int             nworkers;
+    threadpool_fn   fn;
+    struct deque   *deques;
+    struct worker  *workers;
+    size_t          next;               /* round-robin submission cursor */
+
+    pthread_mutex_t lock;               /* guards pending, done and the conditions */
+    pthread_cond_t  cond;
+    pthread_cond_t  room;               /* pending fell below max_pending */
+    size_t          pending;            /* submitted but not yet taken */
+    size_t          max_pending;
+    bool            done;               /* no more submissions */
+};
+
+static void deque_push_back(struct deque *d,void *item)
+{
+    pthread_mutex_lock(&d->lock);
+    if(d->count==d->cap){
+        const size_t ncap = d->cap ? d->cap*2 : 64;
+        void **n = (void **)malloc(ncap*sizeof(void *));
+        if(n==0){ perror("malloc"); exit(1); }
+        for(size_t i=0;i<d->count;i++) n[i] = d->items[(d->head+i)%d->cap];
+        free(d->items);
+        d->items = n;
+        d->cap   = ncap;
+        d->head  = 0;
+    }
+    d->items[(d->head+d->count)%d->cap] = item;
+    d->count++;
+    pthread_mutex_unlock(&d->lock);
+}
+
+static void *deque_pop_front(struct deque *d)
+{
+    void *item = 0;
+    pthread_mutex_lock(&d->lock);
+    if(d->count){
+        item = d->items[d->head];
+        d->head = (d->head+1)%d->cap;
+        d->count--;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return item;
+}
+
+static void *deque_steal_back(struct deque *d)
+{
+    void *item = 0;
+    pthread_mutex_lock(&d->lock);
+    if(d->count){
+        d->count--;
+        item = d->items[(d->head+d->count)%d->cap];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return item;
+}
+
+/* take an item from our own deque, or steal one; 0 if there are none */
+static void *take(struct threadpool *pool,int id)
+{
+    void *item = deque_pop_front(&pool->deques[id]);
+    for(int i=1;item==0 && i<pool->nworkers;i++){
+        item = deque_steal_back(&pool->deques[(id+i)%pool->nworkers]);
+    }
+    return item;
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = (struct worker *)arg;
+    struct threadpool *pool = w->pool;
+    while(true){
+        pthread_mutex_lock(&pool->lock);
+        while(pool->pending==0 && !pool->done){
+            pthread_cond_wait(&pool->cond,&pool->lock);
+        }
+        if(pool->pending==0 && pool->done){
+            pthread_mutex_unlock(&pool->lock);
+            return 0;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        void *item = take(pool,w->id);
+        if(item==0) continue;           /* another worker got there first */
+        pthread_mutex_lock(&pool->lock);
+        pool->pending--;
+        pthread_cond_signal(&pool->room);
+        pthread_mutex_unlock(&pool->lock);
+        (*pool->fn)(w->arg,item);
+    }
+}
+
+threadpool *threadpool_create(int nworkers,threadpool_fn fn,void **worker_args)
+{
+    threadpool *pool = (threadpool *)calloc(1,sizeof(threadpool));
+    if(pool==0) return 0;
+    pool->nworkers = nworkers;
+    pool->fn       = fn;
+    pool->max_pending = (size_t)nworkers*THREADPOOL_QUEUE;
+    pool->deques   = (struct deque *)calloc(nworkers,sizeof(struct deque));
+    pool->workers  = (struct worker *)calloc(nworkers,sizeof(struct worker));
+    if(pool->deques==0 || pool->workers==0){ perror("calloc"); exit(1); }
+    pthread_mutex_init(&pool->lock,0);
+    pthread_cond_init(&pool->cond,0);
+    pthread_cond_init(&pool->room,0);
+    for(int i=0;i<nworkers;i++){
+        pthread_mutex_init(&pool->deques[i].lock,0);
+        pool->workers[i].pool = pool;
+        pool->workers[i].id   = i;
+        pool->workers[i].arg  = worker_args ? worker_args[i] : 0;
+        if(pthread_create(&pool->workers[i].thread,0,worker_main,&pool->workers[i])){
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    return pool;
+}
+
+void threadpool_submit(threadpool *pool,void *item)
+{
+    pthread_mutex_lock(&pool->lock);
+    while(pool->pending>=pool->max_pending){
+        pthread_cond_wait(&pool->room,&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    deque_push_back(&pool->deques[pool->next++ % pool->nworkers],item);
+    pthread_mutex_lock(&pool->lock);
+    pool->pending++;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void threadpool_wait(threadpool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->done = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    for(int i=0;i<pool->nworkers;i++){
+        pthread_join(pool->workers[i].thread,0);
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].items);
+    }
+    pthread_cond_destroy(&pool->cond);
+    pthread_cond_destroy(&pool->room);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->deques);
+    free(pool->workers);
+    free(pool);
+}
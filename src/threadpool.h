@@ -0,0 +1,28 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+/*
+ * A small work-stealing thread pool for sceadan_app.
+ *
+ * Each worker owns a deque. Submitted items are dealt round-robin to
+ * the workers; a worker takes from the front of its own deque and,
+ * when that is empty, steals from the back of another worker's.
+ * The pool is bounded: threadpool_submit blocks while a few dozen
+ * items per worker are already waiting, so a fast producer cannot
+ * queue up more than the workers will get to soon.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+
+struct threadpool;
+typedef struct threadpool threadpool;
+
+/* called on a worker thread; worker_arg is that worker's own state */
+typedef void (*threadpool_fn)(void *worker_arg,void *item);
+
+threadpool *threadpool_create(int nworkers,threadpool_fn fn,void **worker_args);
+void threadpool_submit(threadpool *,void *item);   // blocks while the queue is full
+void threadpool_wait(threadpool *);    // no more submissions; drain, join and free
+
+#endif
@@ -0,0 +1,249 @@
+/*
+ * writer.c: block-mode result writer for sceadan_app (see writer.h)
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sceadan.h"
+#include "sceadan_export.h"
+#include "writer.h"
+
+#define WRITER_BUF_SIZE (1<<16)
+#define RESULT_MAX      128             /* bytes of a result besides the path */
+#define NAMES           128             /* types whose names are looked up once */
+
+struct writer {
+    FILE       *out;
+    int         format;
+    bool        extents;
+    int         error;                  /* errno of a failed write, or 0 */
+    char       *path;                   /* as the format prints it */
+    size_t      path_len;
+    bool        open;                   /* extents: an extent is being extended */
+    uint64_t    offset;
+    uint64_t    length;
+    int         type;
+    const char *name[NAMES];
+    size_t      name_len[NAMES];
+    char       *buf;
+    size_t      used;
+    size_t      size;
+};
+
+int writer_format(const char *name)
+{
+    static const char *const names[] = {"text","csv","jsonl","binary"};
+    for(int i=0;i<4;i++){
+        if(strcmp(name,names[i])==0) return i;
+    }
+    return -1;
+}
+
+void writer_header(FILE *out,int format)
+{
+    if(format==WRITER_CSV) fputs("offset,length,type,path\n",out);
+    if(format==WRITER_BINARY){
+        struct writer_header h;
+        memset(&h,0,sizeof(h));
+        memcpy(h.magic,WRITER_MAGIC,sizeof(h.magic));
+        h.version    = WRITER_VERSION;
+        h.byte_order = WRITER_BYTE_ORDER;
+        fwrite(&h,sizeof(h),1,out);
+    }
+}
+
+writer *writer_open(FILE *out,int format,bool extents)
+{
+    writer *w = (writer *)calloc(1,sizeof(*w));
+    if(w==0) return 0;
+    w->buf = (char *)malloc(WRITER_BUF_SIZE);
+    if(w->buf==0){
+        free(w);
+        return 0;
+    }
+    w->size    = WRITER_BUF_SIZE;
+    w->out     = out;
+    w->format  = format;
+    w->extents = extents;
+    for(int i=0;i<NAMES;i++){
+        w->name[i] = sceadan_name_for_type(i);
+        if(w->name[i]==0) w->name[i] = "(null)";   /* as printf("%s") shows it */
+        w->name_len[i] = strlen(w->name[i]);
+    }
+    return w;
+}
+
+static void drain(writer *w)
+{
+    if(w->used && fwrite(w->buf,1,w->used,w->out)!=w->used && w->error==0) w->error = errno ? errno : EIO;
+    w->used = 0;
+}
+
+/* room for n more bytes */
+static char *reserve(writer *w,size_t n)
+{
+    if(w->used+n > w->size) drain(w);
+    if(n > w->size){
+        char *b = (char *)realloc(w->buf,n);
+        if(b==0){ perror("realloc"); exit(1); }
+        w->buf  = b;
+        w->size = n;
+    }
+    return w->buf+w->used;
+}
+
+/* printf("%-10" PRIu64 " ") */
+static char *put_column(char *p,uint64_t u)
+{
+    char *const start = p;
+    p = sceadan_format_uint(p,u);
+    while(p-start < 10) *p++ = ' ';
+    *p++ = ' ';
+    return p;
+}
+
+static char *put(char *p,const char *s,size_t n)
+{
+    memcpy(p,s,n);
+    return p+n;
+}
+
+static void emit(writer *w,uint64_t offset,uint64_t length,int type)
+{
+    const char *name = (type>=0 && type<NAMES) ? w->name[type] : sceadan_name_for_type(type);
+    if(name==0) name = "(null)";
+    const size_t name_len = (type>=0 && type<NAMES) ? w->name_len[type] : strlen(name);
+    char *const start = reserve(w,RESULT_MAX+name_len+w->path_len);
+    char *p = start;
+    switch(w->format){
+    case WRITER_TEXT:
+        p = put_column(p,offset);
+        if(w->extents) p = put_column(p,length);
+        p = put(p,name,name_len);
+        p = put(p," # ",3);
+        p = put(p,w->path,w->path_len);
+        *p++ = '\n';
+        break;
+    case WRITER_CSV:
+        p = sceadan_format_uint(p,offset);
+        *p++ = ',';
+        p = sceadan_format_uint(p,length);
+        *p++ = ',';
+        p = put(p,name,name_len);
+        *p++ = ',';
+        p = put(p,w->path,w->path_len);
+        *p++ = '\n';
+        break;
+    case WRITER_JSONL:
+        p = put(p,"{\"offset\":",10);
+        p = sceadan_format_uint(p,offset);
+        p = put(p,",\"length\":",10);
+        p = sceadan_format_uint(p,length);
+        p = put(p,",\"type\":\"",9);
+        p = put(p,name,name_len);
+        p = put(p,"\",\"path\":\"",10);
+        p = put(p,w->path,w->path_len);
+        p = put(p,"\"}\n",3);
+        break;
+    case WRITER_BINARY: {
+        struct writer_record r;
+        memset(&r,0,sizeof(r));
+        r.offset = offset;
+        r.length = length;
+        r.type   = type;
+        p = put(p,(const char *)&r,sizeof(r));
+        break;
+    }
+    }
+    w->used += p-start;
+}
+
+/* the path as the format prints it: quoted for CSV if it must be,
+ * escaped for JSON */
+void writer_file(writer *w,const char *path)
+{
+    if(w->open){
+        emit(w,w->offset,w->length,w->type);
+        w->open = false;
+    }
+    const size_t n = strlen(path);
+    free(w->path);
+    w->path = (char *)malloc(6*n+3);
+    if(w->path==0){ perror("malloc"); exit(1); }
+    char *p = w->path;
+    if(w->format==WRITER_CSV && strpbrk(path,",\"\r\n")){
+        *p++ = '"';
+        for(const char *s=path;*s;s++){
+            if(*s=='"') *p++ = '"';
+            *p++ = *s;
+        }
+        *p++ = '"';
+    } else if(w->format==WRITER_JSONL){
+        for(const unsigned char *s=(const unsigned char *)path;*s;s++){
+            if(*s=='"' || *s=='\\'){
+                *p++ = '\\';
+                *p++ = *s;
+            } else if(*s<0x20){
+                p += sprintf(p,"\\u%04x",*s);
+            } else {
+                *p++ = *s;
+            }
+        }
+    } else {
+        p = put(p,path,n);
+    }
+    w->path_len = p-w->path;
+    if(w->format==WRITER_BINARY){       /* a path record, then the path */
+        struct writer_record r;
+        memset(&r,0,sizeof(r));
+        r.length = n;
+        r.type   = WRITER_PATH;
+        char *q = reserve(w,sizeof(r)+n);
+        memcpy(q,&r,sizeof(r));
+        memcpy(q+sizeof(r),path,n);
+        w->used += sizeof(r)+n;
+    }
+}
+
+void writer_block(writer *w,uint64_t offset,uint64_t length,int type)
+{
+    if(!w->extents){
+        emit(w,offset,length,type);
+        return;
+    }
+    if(w->open && type==w->type && offset==w->offset+w->length){
+        w->length += length;
+        return;
+    }
+    if(w->open) emit(w,w->offset,w->length,w->type);
+    w->open   = true;
+    w->offset = offset;
+    w->length = length;
+    w->type   = type;
+}
+
+int writer_flush(writer *w)
+{
+    if(w->open){
+        emit(w,w->offset,w->length,w->type);
+        w->open = false;
+    }
+    drain(w);
+    if(w->error){
+        errno = w->error;
+        return -1;
+    }
+    return 0;
+}
+
+int writer_close(writer *w)
+{
+    const int r = writer_flush(w);
+    free(w->path);
+    free(w->buf);
+    free(w);
+    return r;
+}
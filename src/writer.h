@@ -0,0 +1,57 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+/*
+ * Block-mode result writer for sceadan_app.
+ *
+ * Results are formatted by hand into a large buffer, which is written
+ * to the output in one piece when it fills, instead of one printf per
+ * block. With extents, consecutive blocks of the same type are merged
+ * as they arrive into one (offset, length, type) result, so a run of
+ * a million zero blocks is one line.
+ *
+ * The binary format is a struct writer_header, then struct
+ * writer_records in the writer's byte order. A record of type
+ * WRITER_PATH names the file of the records after it: its length is
+ * that of the path, whose bytes (no NUL) follow it.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define WRITER_TEXT   0                 /* "offset type # path", or "offset length type # path" with extents */
+#define WRITER_CSV    1                 /* offset,length,type,path after a header line */
+#define WRITER_JSONL  2                 /* {"offset":...,"length":...,"type":"...","path":"..."} */
+#define WRITER_BINARY 3                 /* the records below */
+
+#define WRITER_MAGIC      "SCEADANR"
+#define WRITER_VERSION    1
+#define WRITER_BYTE_ORDER 0x01020304
+#define WRITER_PATH       (-1)          /* the type of a record that names a file */
+
+struct writer_header {
+    char     magic[8];                  /* WRITER_MAGIC, no NUL */
+    uint32_t version;                   /* WRITER_VERSION */
+    uint32_t byte_order;                /* WRITER_BYTE_ORDER, as written */
+};
+
+struct writer_record {
+    uint64_t offset;
+    uint64_t length;                    /* bytes; for WRITER_PATH, of the path that follows */
+    int32_t  type;                      /* a file type, or WRITER_PATH */
+    uint32_t reserved;
+};
+
+struct writer;
+typedef struct writer writer;
+
+int writer_format(const char *name);            // WRITER_* for "text", "csv", "jsonl" or "binary"; -1 if none
+void writer_header(FILE *out,int format);       // once, at the start of the output: CSV's header line, binary's header
+writer *writer_open(FILE *out,int format,bool extents); // 0 on allocation failure
+void writer_file(writer *,const char *path);    // the blocks that follow are this file's
+void writer_block(writer *,uint64_t offset,uint64_t length,int type);
+int  writer_flush(writer *);                    // the open extent and the buffer to out; -1 on a write error
+int  writer_close(writer *);                    // flush and free
+
+#endif